@@ -0,0 +1,369 @@
+/**
+ * Micro-benchmarks of the hot paths of training and detection on synthetic
+ * inputs with fixed seeds, so no data directories are needed and runs are
+ * comparable across commits. Results are printed as a table and written as
+ * JSON for regression tracking.
+ *
+ * Usage: pd_bench [--filter substring] [--min-time seconds] [--json file] [--scratch directory]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <functional>
+#include <opencv2/opencv.hpp>
+#include "../lib/featurestore.h"
+#include "../lib/linearsvm.h"
+#include "../lib/blockgriddetector.h"
+#include "../lib/nms.h"
+#include "../lib/hogmirror.h"
+#include "../thirdparty/svmlight/svmlight.h"
+
+using namespace cv;
+using namespace std;
+
+// Seed of all synthetic inputs
+static const uint64 benchmarkSeed = 12345;
+// Training windows, as in main.cpp
+static const Size winSize = Size(48, 96);
+static const Size winStride = Size(8, 8);
+// Samples of the training benchmarks, rates are reported per 1000
+static const int trainingSamples = 1000;
+
+struct BenchmarkResult {
+    string name;
+    string unit;          // what one item is
+    double items;         // items per run
+    int runs;
+    double medianMs;      // per run
+    double minMs;
+};
+
+struct BenchmarkOptions {
+    string filter;
+    double minSeconds;
+    string jsonFile;
+    string scratchDir;
+};
+
+static bool selected(const BenchmarkOptions& options, const string& name) {
+    return options.filter.empty() || name.find(options.filter) != string::npos;
+}
+
+/**
+ * Times a benchmark: runs it until minSeconds have passed, at least three times. The first run
+ * is a warm-up unless it alone takes longer than minSeconds.
+ * @param name unique name, selectable by --filter
+ * @param unit what one item is, e.g. "window"
+ * @param items items processed per run
+ * @param run the work of one run
+ */
+static void runBenchmark(const BenchmarkOptions& options, vector<BenchmarkResult>& results, const string& name,
+        const string& unit, double items, const function<void()>& run) {
+    if (!selected(options, name)) {
+        return;
+    }
+    vector<double> times;
+    int64 start = getTickCount();
+    run();
+    double ms = (getTickCount() - start) * 1000. / getTickFrequency();
+    if (ms >= options.minSeconds * 1000.) {
+        times.push_back(ms);
+    } else {
+        double elapsedMs = 0.;
+        while (elapsedMs < options.minSeconds * 1000. || times.size() < 3) {
+            start = getTickCount();
+            run();
+            ms = (getTickCount() - start) * 1000. / getTickFrequency();
+            times.push_back(ms);
+            elapsedMs += ms;
+        }
+    }
+    sort(times.begin(), times.end());
+    BenchmarkResult result;
+    result.name = name;
+    result.unit = unit;
+    result.items = items;
+    result.runs = (int) times.size();
+    result.medianMs = times[times.size() / 2];
+    result.minMs = times[0];
+    results.push_back(result);
+    printf("%-36s %8d runs %12.4f ms/run %12.5f ms/%-10s %12.1f %s/s\n", name.c_str(), result.runs, result.medianMs,
+            result.medianMs / items, unit.c_str(), items * 1000. / result.medianMs, unit.c_str());
+    fflush(stdout);
+}
+
+/**
+ * Synthetic grayscale training window: smoothed noise, with a bright upright figure for positives
+ * @param rng random source
+ * @param positive draw the figure
+ */
+static Mat syntheticWindow(RNG& rng, bool positive) {
+    Mat window(winSize, CV_8U);
+    rng.fill(window, RNG::UNIFORM, 0, 256);
+    GaussianBlur(window, window, Size(5, 5), 1.5);
+    if (positive) {
+        const Point centre(winSize.width / 2 + rng.uniform(-3, 4), winSize.height / 2 + rng.uniform(-3, 4));
+        const Scalar shade(rng.uniform(160, 256));
+        ellipse(window, centre + Point(0, 4), Size(10, 30), 0., 0., 360., shade, -1);
+        circle(window, centre - Point(0, 32), 7, shade, -1);
+    }
+    return window;
+}
+
+// Synthetic street scene: smoothed noise with figures of several sizes
+static Mat syntheticFrame(const Size& size, uint64 seed) {
+    RNG rng(seed);
+    Mat frame(size, CV_8UC3);
+    rng.fill(frame, RNG::UNIFORM, 0, 256);
+    GaussianBlur(frame, frame, Size(9, 9), 3.);
+    for (int i = 0; i < 12; ++i) {
+        const int height = rng.uniform(64, max(65, size.height / 2));
+        const Point feet(rng.uniform(0, size.width), rng.uniform(height, size.height));
+        const Scalar shade(rng.uniform(0, 256), rng.uniform(0, 256), rng.uniform(0, 256));
+        ellipse(frame, feet - Point(0, height * 2 / 5), Size(height / 8, height * 2 / 5), 0., 0., 360., shade, -1);
+        circle(frame, feet - Point(0, height * 9 / 10), height / 10, shade, -1);
+    }
+    return frame;
+}
+
+// Candidate windows of a dense scan: jittered clusters around random pedestrians, as in pd bench-nms
+static void syntheticCandidates(int candidates, vector<Rect>& boxes, vector<double>& scores) {
+    RNG rng(benchmarkSeed);
+    const int pedestrians = max(1, candidates / 200);
+    while ((int) boxes.size() < candidates) {
+        RNG centre((uint64) boxes.size() % pedestrians + 1);
+        const double height = centre.uniform(96., 400.);
+        const Point2d c(centre.uniform(0., 960.), centre.uniform(0., 640.));
+        const double h = height * exp(rng.gaussian(0.1));
+        boxes.push_back(Rect(cvRound(c.x + rng.gaussian(0.08 * h) - h / 4), cvRound(c.y + rng.gaussian(0.08 * h) - h / 2), cvRound(h / 2), cvRound(h)));
+        scores.push_back(rng.uniform(0., 2.));
+    }
+}
+
+static void writeJson(const BenchmarkOptions& options, const vector<BenchmarkResult>& results) {
+    FILE* f = fopen(options.jsonFile.c_str(), "w");
+    if (f == NULL) {
+        printf("Error: Could not open '%s' for writing!\n", options.jsonFile.c_str());
+        return;
+    }
+    fprintf(f, "{\n  \"opencv\": \"%s\",\n  \"threads\": %d,\n  \"seed\": %llu,\n  \"min_time_s\": %g,\n  \"benchmarks\": [\n",
+            CV_VERSION, getNumThreads(), (unsigned long long) benchmarkSeed, options.minSeconds);
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchmarkResult& r = results[i];
+        fprintf(f, "    {\"name\": \"%s\", \"unit\": \"%s\", \"items\": %g, \"runs\": %d, \"median_ms\": %.6g, \"min_ms\": %.6g, \"ms_per_item\": %.6g, \"items_per_s\": %.6g}%s\n",
+                r.name.c_str(), r.unit.c_str(), r.items, r.runs, r.medianMs, r.minMs, r.medianMs / r.items,
+                r.items * 1000. / r.medianMs, i + 1 < results.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    if (fclose(f) == 0) {
+        printf("Results written to '%s'\n", options.jsonFile.c_str());
+    }
+}
+
+int main(int argc, char** argv) {
+    BenchmarkOptions options;
+    options.minSeconds = 0.5;
+    options.jsonFile = "pd_bench.json";
+    options.scratchDir = ".";
+    for (int i = 1; i < argc; i += 2) {
+        const string option = argv[i];
+        if (i + 1 < argc && option == "--filter") {
+            options.filter = argv[i + 1];
+        } else if (i + 1 < argc && option == "--min-time") {
+            options.minSeconds = atof(argv[i + 1]);
+        } else if (i + 1 < argc && option == "--json") {
+            options.jsonFile = argv[i + 1];
+        } else if (i + 1 < argc && option == "--scratch") {
+            options.scratchDir = argv[i + 1];
+        } else {
+            printf("Usage: %s [--filter substring] [--min-time seconds] [--json file] [--scratch directory]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    setlocale(LC_ALL, "C");
+    theRNG().state = benchmarkSeed;
+    // No SVMlight progress output between the result lines, its constructor sets the verbosity
+    SVMlight::getInstance();
+    verbosity = 0;
+    vector<BenchmarkResult> results;
+
+    HOGDescriptor hog;
+    hog.winSize = winSize;
+    const int dimension = (int) hog.getDescriptorSize();
+
+    // Training samples, half positive
+    RNG rng(benchmarkSeed);
+    vector<Mat> windows;
+    vector<float> labels;
+    for (int i = 0; i < trainingSamples; ++i) {
+        labels.push_back(i % 2 == 0 ? +1.f : -1.f);
+        windows.push_back(syntheticWindow(rng, labels.back() > 0));
+    }
+
+    // Decoding of the training windows from memory, without file system overhead
+    vector<vector<uchar> > png(windows.size()), jpeg(windows.size());
+    for (size_t i = 0; i < windows.size(); ++i) {
+        imencode(".png", windows[i], png[i]);
+        imencode(".jpg", windows[i], jpeg[i]);
+    }
+    runBenchmark(options, results, "decode_png_48x96", "image", (double) png.size(), [&]() {
+        for (size_t i = 0; i < png.size(); ++i) {
+            imdecode(png[i], IMREAD_GRAYSCALE);
+        }
+    });
+    runBenchmark(options, results, "decode_jpeg_48x96", "image", (double) jpeg.size(), [&]() {
+        for (size_t i = 0; i < jpeg.size(); ++i) {
+            imdecode(jpeg[i], IMREAD_GRAYSCALE);
+        }
+    });
+
+    vector<vector<float> > features(windows.size());
+    runBenchmark(options, results, "hog_compute_window_48x96", "window", (double) windows.size(), [&]() {
+        for (size_t i = 0; i < windows.size(); ++i) {
+            hog.compute(windows[i], features[i], winStride, Size(0, 0));
+        }
+    });
+    if (!selected(options, "hog_compute_window_48x96")) {
+        for (size_t i = 0; i < windows.size(); ++i) {
+            hog.compute(windows[i], features[i], winStride, Size(0, 0));
+        }
+    }
+
+    // Mirror augmentation: flipping the window and computing its descriptor against permuting the computed one
+    runBenchmark(options, results, "hog_mirror_flip_compute_48x96", "window", (double) windows.size(), [&]() {
+        Mat flipped;
+        vector<float> mirrored;
+        for (size_t i = 0; i < windows.size(); ++i) {
+            flip(windows[i], flipped, 1);
+            hog.compute(flipped, mirrored, winStride, Size(0, 0));
+        }
+    });
+    HogMirror mirror;
+    mirror.init(hog);
+    runBenchmark(options, results, "hog_mirror_permutation_48x96", "window", (double) features.size(), [&]() {
+        vector<float> mirrored;
+        for (size_t i = 0; i < features.size(); ++i) {
+            mirror.apply(features[i], mirrored);
+        }
+    });
+
+    // Feature serialisation and parsing, binary store and SVMlight text
+    const string storeFile = options.scratchDir + "/pd_bench_features.bin";
+    const string textFile = options.scratchDir + "/pd_bench_features.dat";
+    runBenchmark(options, results, "feature_store_write", "vector", (double) features.size(), [&]() {
+        FeatureStoreWriter writer;
+        writer.open(storeFile, hog, winStride, Size(0, 0), (uint32_t) features.size());
+        for (size_t i = 0; i < features.size(); ++i) {
+            writer.append(labels[i], features[i]);
+        }
+        writer.close();
+    });
+    FeatureStoreWriter writer;
+    writer.open(storeFile, hog, winStride, Size(0, 0), (uint32_t) features.size());
+    for (size_t i = 0; i < features.size(); ++i) {
+        writer.append(labels[i], features[i]);
+    }
+    writer.close();
+    runBenchmark(options, results, "feature_svmlight_write", "vector", (double) features.size(), [&]() {
+        FeatureStore(storeFile).exportSvmlight(textFile);
+    });
+    FeatureStore(storeFile).exportSvmlight(textFile);
+    runBenchmark(options, results, "feature_store_read", "vector", (double) features.size(), [&]() {
+        FeatureStore store(storeFile);
+        float sum = 0.f;
+        for (uint32_t i = 0; i < store.getCount(); ++i) {
+            sum += store.getLabel(i) * store.getRow(i)[0];
+        }
+        volatile float sink = sum;
+        (void) sink;
+    });
+    runBenchmark(options, results, "feature_svmlight_parse", "vector", (double) features.size(), [&]() {
+        DOC** docs = NULL;
+        double* target = NULL;
+        long totwords = 0, totdoc = 0;
+        read_documents(const_cast<char*>(textFile.c_str()), &docs, &target, &totwords, &totdoc);
+        for (long i = 0; i < totdoc; ++i) {
+            free_example(docs[i], 1);
+        }
+        free(docs);
+        free(target);
+    });
+
+    // Linear training on the 1k samples, the examples are added once and the solver reruns from scratch
+    if (selected(options, "linearsvm_train_1k")) {
+        LinearSVM* linearSvm = LinearSVM::getInstance();
+        linearSvm->reserve_examples(trainingSamples);
+        for (int i = 0; i < trainingSamples; ++i) {
+            linearSvm->add_example(labels[i], features[i]);
+        }
+        runBenchmark(options, results, "linearsvm_train_1k", "1k samples", trainingSamples / 1000., [&]() {
+            linearSvm->train();
+        });
+    }
+    const bool trainSvmLight = selected(options, "svmlight_train_1k");
+    if (trainSvmLight || selected(options, "svmlight_weight_vector")) {
+        SVMlight* svmLight = SVMlight::getInstance();
+        svmLight->reserve_examples(trainingSamples);
+        for (int i = 0; i < trainingSamples; ++i) {
+            svmLight->add_example(labels[i], features[i]);
+        }
+        runBenchmark(options, results, "svmlight_train_1k", "1k samples", trainingSamples / 1000., [&]() {
+            svmLight->train();
+        });
+        if (!trainSvmLight) {
+            // The weight vector is extracted from a trained model
+            svmLight->train();
+        }
+        vector<float> detectorVector;
+        vector<unsigned int> detectorVectorIndices;
+        runBenchmark(options, results, "svmlight_weight_vector", "vector", 1., [&]() {
+            svmLight->getSingleDetectingVector(detectorVector, detectorVectorIndices);
+        });
+    }
+    remove(storeFile.c_str());
+    remove(textFile.c_str());
+
+    // Detection per frame size with a fixed random detector, the threshold keeps the raw hits few
+    RNG weightRng(benchmarkSeed);
+    vector<float> weights(dimension);
+    for (int i = 0; i < dimension; ++i) {
+        weights[i] = (float) weightRng.gaussian(0.05);
+    }
+    hog.setSVMDetector(weights);
+    const double hitThreshold = 1.;
+    const BlockGridDetector engine(hog);
+    const Size frameSizes[] = {Size(640, 480), Size(960, 640), Size(1280, 720), Size(1920, 1080)};
+    for (size_t s = 0; s < sizeof(frameSizes) / sizeof(frameSizes[0]); ++s) {
+        const Mat frame = syntheticFrame(frameSizes[s], benchmarkSeed + s);
+        char name[64];
+        vector<Rect> found;
+        vector<double> foundWeights;
+        snprintf(name, sizeof(name), "hog_detect_multiscale_%dx%d", frameSizes[s].width, frameSizes[s].height);
+        runBenchmark(options, results, name, "frame", 1., [&]() {
+            hog.detectMultiScale(frame, found, foundWeights, hitThreshold, winStride, Size(8, 8), 1.05, 2.0);
+        });
+        snprintf(name, sizeof(name), "blockgrid_detect_multiscale_%dx%d", frameSizes[s].width, frameSizes[s].height);
+        runBenchmark(options, results, name, "frame", 1., [&]() {
+            engine.detectMultiScale(frame, found, foundWeights, hitThreshold, winStride, Size(8, 8), 1.05, 2.0);
+        });
+    }
+
+    // Grouping of the raw windows of a dense scan
+    vector<Rect> boxes;
+    vector<double> scores;
+    syntheticCandidates(10000, boxes, scores);
+    vector<int> keep;
+    runBenchmark(options, results, "nms_10k", "candidate", (double) boxes.size(), [&]() {
+        nonMaximumSuppression(boxes, scores, 0.45, keep);
+    });
+    runBenchmark(options, results, "meanshift_grouping_10k", "candidate", (double) boxes.size(), [&]() {
+        vector<Rect> grouped = boxes;
+        vector<double> groupedScores = scores;
+        meanShiftGrouping(grouped, groupedScores, 0.);
+    });
+
+    writeJson(options, results);
+    return EXIT_SUCCESS;
+}
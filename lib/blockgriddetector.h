@@ -0,0 +1,847 @@
+#ifndef BLOCKGRIDDETECTOR_H
+#define BLOCKGRIDDETECTOR_H
+
+#include <stdio.h>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cfloat>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <stdint.h>
+#include <opencv2/opencv.hpp>
+#include "simd.h"
+#include "softcascade.h"
+#include "quantisation.h"
+
+// Normalised HOG blocks of one pyramid level on the block stride grid.
+// Row (gy * width + gx) of blocks holds the histogram of the block whose
+// top left corner is at origin + (gx, gy) * blockStride - padding in the
+// level, the origin is nonzero for grids of a part of the level only.
+// A quantised detector keeps the blocks as 8 bit only, unless it also has a
+// soft cascade, which scores the float blocks.
+struct BlockGrid {
+	cv::Mat blocks;      // (width * height) x blockHistogramSize, CV_32F, empty if only quantised
+	cv::Mat quantised;   // (width * height) x blockHistogramSize, CV_8U, empty if not quantised
+	int width, height;
+	cv::Size padding;
+	cv::Point origin;    // top left corner of the grid's image in the level
+};
+
+// Per call counters of the detection engine
+struct BlockGridDetectorStats {
+	unsigned long levels;
+	unsigned long blocksComputed;
+	unsigned long windowsEvaluated;
+	unsigned long windowsPruned;     // windows outside the region of interest or ground plane band, never evaluated
+	unsigned long blocksSkipped;     // blocks not covered by any evaluated window, never computed
+	unsigned long blockEvaluations;  // block dot products of the window scoring, less than windows x blocks with a soft cascade
+	unsigned long gridBytes;         // memory of the block grids
+	double gridMs;    // summed over levels, levels run in parallel
+	double scoringMs;
+};
+
+// Calibration of a forward facing camera above a flat ground plane. A
+// pedestrian of height P whose feet are at image row y appears with a pixel
+// height of (y - horizon) * P / cameraHeight, independent of the focal
+// length, so every window height is only plausible in a band of rows.
+struct GroundPlaneConstraint {
+	double horizonRow;          // image row of the horizon, in an image of imageHeight rows
+	double imageHeight;
+	double cameraHeight;        // metres above the ground, <= 0 disables the constraint
+	double minPedestrianHeight; // metres
+	double maxPedestrianHeight;
+	double personWindowRatio;   // height of the person in a training window relative to the window
+	double tolerance;           // relative slack on both ends of the band (calibration error, pitch, slopes)
+
+	GroundPlaneConstraint():
+	horizonRow(0.), imageHeight(640.), cameraHeight(0.), minPedestrianHeight(1.0), maxPedestrianHeight(2.0),
+	personWindowRatio(0.8), tolerance(0.15){
+	}
+
+	bool enabled() const { return cameraHeight > 0; }
+};
+
+// Sliding window detection engine for linear HOG detectors that computes
+// the normalised block grid once per pyramid level and evaluates the
+// detector as a correlation of its per-block weight slices over that grid
+// (as in deformable part models): every block's dot product with every
+// slice is computed once, in one matrix product, and shared by all windows
+// containing that block, instead of re-gathering the same blocks for each
+// overlapping window as HOGDescriptor::detect does.
+//
+// The blocks are computed by a HOGDescriptor whose window is a single
+// block, so gradients, Gaussian weighting and L2-Hys normalisation are
+// exactly those of the full descriptor and the results match
+// detectMultiScale up to float rounding. Requires the window stride to be
+// a multiple of the block stride, other strides fall back to HOGDescriptor.
+//
+// An optional region of interest mask restricts detectMultiScale to the
+// windows whose centre lies in the mask. The mask is resampled onto the
+// window grid of every pyramid level and only the blocks of the remaining
+// windows are computed, so masked out parts of the frame cost nothing.
+// A ground plane constraint works the same way with a band of window rows
+// per level, most levels only have a few rows where a pedestrian of their
+// scale can stand. A level is only resampled over the part holding the
+// remaining windows, by an affine warp with the sampling positions of
+// cv::resize, which matches the resized level up to interpolation rounding.
+//
+// With a soft cascade the windows are scored one by one, block by block in
+// cascade order, and abandoned as soon as the partial sum falls below the
+// rejection trace, instead of all blocks in one matrix product.
+//
+// With quantisation the block grid is stored as 8 bit features and the
+// weight slices as 8 or 16 bit integers, the block responses are integer
+// dot products rescaled to the float decision value.
+class
+BlockGridDetector{
+protected:
+	cv::HOGDescriptor _hog;
+	cv::HOGDescriptor _blockHog;
+	int _blocksX, _blocksY;        // blocks per window
+	int _blockHistogramSize;
+	cv::Mat _weights;              // one row per block of the window, in descriptor order
+	float _rho;
+	cv::Mat _roiMask;              // CV_8U, nonzero where windows are evaluated, empty for the whole image
+	GroundPlaneConstraint _groundPlane;
+	SoftCascade _cascade;
+	QuantisedWeights _quantised;
+
+	// Padding as HOGDescriptor aligns it, a multiple of the block stride
+	cv::Size alignedPadding(const cv::Size& padding) const {
+		const cv::Size stride = _hog.blockStride;
+		return cv::Size((std::max(padding.width, 0) + stride.width - 1) / stride.width * stride.width,
+			(std::max(padding.height, 0) + stride.height - 1) / stride.height * stride.height);
+	}
+
+	// Block grid of a level image for an aligned padding, in blocks
+	cv::Size blockGridSize(const cv::Size& imageSize, const cv::Size& padding) const {
+		return cv::Size(std::max(0, (imageSize.width + 2 * padding.width - _hog.blockSize.width) / _hog.blockStride.width + 1),
+			std::max(0, (imageSize.height + 2 * padding.height - _hog.blockSize.height) / _hog.blockStride.height + 1));
+	}
+
+	// Window grid of a level for the given stride, in windows, empty for strides not aligned with the block grid
+	cv::Size windowGrid(const BlockGrid& grid, const cv::Size& winStride) const {
+		if (!alignedStride(winStride))
+			return cv::Size(0, 0);
+		const int rx = winStride.width / _hog.blockStride.width;
+		const int ry = winStride.height / _hog.blockStride.height;
+		return cv::Size(grid.width >= _blocksX ? (grid.width - _blocksX) / rx + 1 : 0,
+			grid.height >= _blocksY ? (grid.height - _blocksY) / ry + 1 : 0);
+	}
+
+	bool constrained() const { return !_roiMask.empty() || _groundPlane.enabled(); }
+
+	/**
+	 * Range of window top rows in a level where a pedestrian can stand on the ground plane
+	 * @param imageHeight rows of the full resolution image
+	 * @param scale scale of the level
+	 * @param minTop receives the first window top row in level coordinates
+	 * @param maxTop receives the last window top row in level coordinates
+	 */
+	void groundPlaneBand(int imageHeight, double scale, double& minTop, double& maxTop) const {
+		const GroundPlaneConstraint& g = _groundPlane;
+		const double horizon = g.horizonRow * imageHeight / g.imageHeight;
+		const double windowHeight = _hog.winSize.height * scale;
+		const double personHeight = g.personWindowRatio * windowHeight;
+		// The person is centred in the window, feet below the window top
+		const double feetOffset = windowHeight * (1. + g.personWindowRatio) / 2.;
+		const double minFeet = horizon + personHeight * g.cameraHeight / g.maxPedestrianHeight * (1. - g.tolerance);
+		const double maxFeet = horizon + personHeight * g.cameraHeight / g.minPedestrianHeight * (1. + g.tolerance);
+		minTop = (minFeet - feetOffset) / scale;
+		maxTop = (maxFeet - feetOffset) / scale;
+	}
+
+	/**
+	 * Resamples the region of interest mask and the ground plane band onto the window grid of a level
+	 * @param imageSize size of the full resolution image
+	 * @param scale scale of the level
+	 * @param grid block grid of the level, only its size and padding are used
+	 * @param winStride window stride
+	 * @param windowMask receives nonzero for the windows to evaluate (rows x cols = windows y x windows x)
+	 * @return number of windows to evaluate
+	 */
+	int levelWindowMask(const cv::Size& imageSize, double scale, const BlockGrid& grid, const cv::Size& winStride, cv::Mat& windowMask) const {
+		const cv::Size windows = windowGrid(grid, winStride);
+		windowMask.create(windows.height, windows.width, CV_8U);
+		double minTop = -1e30, maxTop = 1e30;
+		if (_groundPlane.enabled())
+			groundPlaneBand(imageSize.height, scale, minTop, maxTop);
+		const double sx = _roiMask.empty() ? 0. : scale * _roiMask.cols / imageSize.width;
+		const double sy = _roiMask.empty() ? 0. : scale * _roiMask.rows / imageSize.height;
+		int allowed = 0;
+		for (int wy = 0; wy < windows.height; ++wy) {
+			uchar* row = windowMask.ptr<uchar>(wy);
+			const int top = grid.origin.y + wy * winStride.height - grid.padding.height;
+			if (top < minTop || top > maxTop) {
+				memset(row, 0, windows.width);
+				continue;
+			}
+			if (_roiMask.empty()) {
+				memset(row, 255, windows.width);
+				allowed += windows.width;
+				continue;
+			}
+			const int cy = top + _hog.winSize.height / 2;
+			const int my = std::min(std::max(cvFloor(cy * sy), 0), _roiMask.rows - 1);
+			const uchar* maskRow = _roiMask.ptr<uchar>(my);
+			for (int wx = 0; wx < windows.width; ++wx) {
+				const int cx = grid.origin.x + wx * winStride.width - grid.padding.width + _hog.winSize.width / 2;
+				const int mx = std::min(std::max(cvFloor(cx * sx), 0), _roiMask.cols - 1);
+				row[wx] = maskRow[mx] ? 255 : 0;
+				allowed += row[wx] != 0;
+			}
+		}
+		return allowed;
+	}
+
+	// Blocks covered by at least one window of the window mask
+	void coveredBlockMask(const cv::Mat& windowMask, const BlockGrid& grid, const cv::Size& winStride, cv::Mat& blockMask) const {
+		const int rx = winStride.width / _hog.blockStride.width;
+		const int ry = winStride.height / _hog.blockStride.height;
+		blockMask = cv::Mat::zeros(grid.height, grid.width, CV_8U);
+		for (int wy = 0; wy < windowMask.rows; ++wy) {
+			const uchar* row = windowMask.ptr<uchar>(wy);
+			for (int wx = 0; wx < windowMask.cols; ++wx) {
+				if (row[wx])
+					blockMask(cv::Rect(wx * rx, wy * ry, _blocksX, _blocksY)).setTo(cv::Scalar(255));
+			}
+		}
+	}
+
+	/**
+	 * Smallest part of a level whose block grid holds all windows of a window mask at their positions
+	 * in the full level grid: its corner is on the window stride grid and its padding takes the pixels
+	 * around it, so cropping the level to it changes no block
+	 * @param levelSize size of the level
+	 * @param padding aligned padding
+	 * @param winStride window stride
+	 * @param windowMask windows of the full level to evaluate, at least one nonzero
+	 * @return part of the level, in level coordinates
+	 */
+	cv::Rect windowRegion(const cv::Size& levelSize, const cv::Size& padding, const cv::Size& winStride, const cv::Mat& windowMask) const {
+		int minX = windowMask.cols, maxX = -1, minY = windowMask.rows, maxY = -1;
+		for (int wy = 0; wy < windowMask.rows; ++wy) {
+			const uchar* row = windowMask.ptr<uchar>(wy);
+			for (int wx = 0; wx < windowMask.cols; ++wx) {
+				if (row[wx]) {
+					minX = std::min(minX, wx);
+					maxX = std::max(maxX, wx);
+					minY = std::min(minY, wy);
+					maxY = std::max(maxY, wy);
+				}
+			}
+		}
+		if (maxX < 0)
+			return cv::Rect(0, 0, levelSize.width, levelSize.height);
+		// The last window reaches winSize - padding beyond its offset from the corner
+		const int x = minX * winStride.width, y = minY * winStride.height;
+		const int width = (maxX - minX) * winStride.width + _hog.winSize.width - 2 * padding.width;
+		const int height = (maxY - minY) * winStride.height + _hog.winSize.height - 2 * padding.height;
+		return cv::Rect(x, y, std::max(width, 1), std::max(height, 1)) & cv::Rect(0, 0, levelSize.width, levelSize.height);
+	}
+
+	/**
+	 * Resamples a part of a pyramid level from the image, as cv::resize samples the full level. The part
+	 * is returned as view into a resampled margin of one block plus the padding around it, HOG takes
+	 * the gradients and padding at its borders from there.
+	 * @param image full resolution image
+	 * @param levelSize size of the level
+	 * @param region part of the level
+	 * @param padding aligned padding
+	 */
+	cv::Mat levelRegion(const cv::Mat& image, const cv::Size& levelSize, const cv::Rect& region, const cv::Size& padding) const {
+		const cv::Rect level(0, 0, levelSize.width, levelSize.height);
+		cv::Mat levelImage;
+		if (levelSize == image.size()) {
+			levelImage = image;
+		} else if (region == level) {
+			cv::resize(image, levelImage, levelSize, 0, 0, cv::INTER_LINEAR);
+		} else {
+			const cv::Size margin(padding.width + _hog.blockSize.width, padding.height + _hog.blockSize.height);
+			const cv::Rect outer = cv::Rect(region.x - margin.width, region.y - margin.height,
+				region.width + 2 * margin.width, region.height + 2 * margin.height) & level;
+			// Pixel centres mapped as by cv::resize: src = (dst + 0.5) * inverse scale - 0.5
+			const double fx = (double) image.cols / levelSize.width;
+			const double fy = (double) image.rows / levelSize.height;
+			cv::Mat transform(2, 3, CV_64F);
+			transform.at<double>(0, 0) = fx;
+			transform.at<double>(0, 1) = 0.;
+			transform.at<double>(0, 2) = (outer.x + 0.5) * fx - 0.5;
+			transform.at<double>(1, 0) = 0.;
+			transform.at<double>(1, 1) = fy;
+			transform.at<double>(1, 2) = (outer.y + 0.5) * fy - 0.5;
+			cv::Mat part;
+			cv::warpAffine(image, part, transform, outer.size(), cv::INTER_LINEAR | cv::WARP_INVERSE_MAP, cv::BORDER_REPLICATE);
+			return part(region - outer.tl());
+		}
+		return region == level ? levelImage : levelImage(region);
+	}
+
+	// Float blocks of a grid, dequantised into buffer if the grid is only quantised
+	const cv::Mat& floatBlocks(const BlockGrid& grid, cv::Mat& buffer) const {
+		if (!grid.blocks.empty() || grid.quantised.empty())
+			return grid.blocks;
+		dequantiseBlocks(grid.quantised, _hog.L2HysThreshold, buffer);
+		return buffer;
+	}
+
+	/**
+	 * Scores the windows of a level: correlates the weight slices with the block grid. With a window
+	 * mask the block responses are only computed for the grid rows and columns covered by windows to
+	 * score, and only those windows are summed up; the others keep the score rho.
+	 * @param grid block grid of the level
+	 * @param winStride window stride, a multiple of the block stride
+	 * @param windowMask optional, only the nonzero windows are scored
+	 * @param scores receives the decision values, one per window (rows x cols = windows y x windows x)
+	 */
+	void scoreGrid(const BlockGrid& grid, const cv::Size& winStride, const cv::Mat& windowMask, cv::Mat& scores) const {
+		const int rx = winStride.width / _hog.blockStride.width;
+		const int ry = winStride.height / _hog.blockStride.height;
+		const cv::Size windows = windowGrid(grid, winStride);
+		scores.create(windows.height, windows.width, CV_32F);
+		scores.setTo(cv::Scalar(_rho));
+		if (windows.area() == 0)
+			return;
+		// First and last window to score in every window row, first > last for rows without any
+		std::vector<int> firstWindow(windows.height, 0), lastWindow(windows.height, windows.width - 1);
+		// Span of grid columns [first, last) read by these windows in every grid row
+		std::vector<int> firstColumn(grid.height, windowMask.empty() ? 0 : grid.width), lastColumn(grid.height, windowMask.empty() ? grid.width : 0);
+		if (!windowMask.empty()) {
+			for (int wy = 0; wy < windows.height; ++wy) {
+				const uchar* allowed = windowMask.ptr<uchar>(wy);
+				int& first = firstWindow[wy];
+				int& last = lastWindow[wy];
+				while (first <= last && !allowed[first])
+					++first;
+				while (last >= first && !allowed[last])
+					--last;
+				for (int gy = wy * ry; first <= last && gy < wy * ry + _blocksY; ++gy) {
+					firstColumn[gy] = std::min(firstColumn[gy], first * rx);
+					lastColumn[gy] = std::max(lastColumn[gy], last * rx + _blocksX);
+				}
+			}
+		}
+
+		// responses(k, g) = weights slice k * block g, for the covered blocks of the grid
+		cv::Mat buffer;
+		const cv::Mat* blocks = &grid.blocks;
+		if (_quantised.empty()) {
+			blocks = &floatBlocks(grid, buffer);
+		} else if (!grid.quantised.empty()) {
+			blocks = &grid.quantised;
+		} else {
+			// Grid computed by a float detector sharing the block grid
+			quantiseBlocks(grid.blocks, _hog.L2HysThreshold, buffer);
+			blocks = &buffer;
+		}
+		cv::Mat responses(_weights.rows, grid.width * grid.height, CV_32F);
+		if (windowMask.empty()) {
+			blockResponses(*blocks, responses);
+		} else {
+			for (int gy = 0; gy < grid.height; ++gy) {
+				if (firstColumn[gy] >= lastColumn[gy])
+					continue;
+				const int first = gy * grid.width + firstColumn[gy], last = gy * grid.width + lastColumn[gy];
+				cv::Mat rowResponses, target = responses.colRange(first, last);
+				blockResponses(blocks->rowRange(first, last), rowResponses);
+				rowResponses.copyTo(target);
+			}
+		}
+
+		for (int k = 0; k < _weights.rows; ++k) {
+			// Descriptor order is column-major over the blocks of the window
+			const int bx = k / _blocksY;
+			const int by = k % _blocksY;
+			const float* response = responses.ptr<float>(k);
+			for (int wy = 0; wy < windows.height; ++wy) {
+				const int first = firstWindow[wy];
+				const int count = lastWindow[wy] - first + 1;
+				if (count <= 0)
+					continue;
+				const float* src = response + (wy * ry + by) * grid.width + bx + first * rx;
+				float* dst = scores.ptr<float>(wy) + first;
+				if (rx == 1) {
+					addScaled(dst, src, 1.f, count);
+				} else {
+					for (int wx = 0; wx < count; ++wx)
+						dst[wx] += src[wx * rx];
+				}
+			}
+		}
+	}
+
+	// Responses of every weight slice to a set of blocks (one row each), float or quantised as the detector scores
+	void blockResponses(const cv::Mat& blocks, cv::Mat& responses) const {
+		if (_quantised.empty()) {
+			cv::gemm(_weights, blocks, 1., cv::Mat(), 0., responses, cv::GEMM_2_T);
+		} else {
+			_quantised.blockResponses(blocks, responses);
+		}
+	}
+
+	/**
+	 * Scores the windows of a level with the soft cascade, rejected windows score -FLT_MAX.
+	 * Only valid for hit thresholds the cascade was trained for, see SoftCascade::validFor
+	 * @param grid block grid of the level
+	 * @param winStride window stride, a multiple of the block stride
+	 * @param windowMask optional, only the nonzero windows are scored
+	 * @param scores receives the decision values, one per window (rows x cols = windows y x windows x)
+	 * @return number of block dot products evaluated
+	 */
+	unsigned long scoreGridCascade(const BlockGrid& grid, const cv::Size& winStride, const cv::Mat& windowMask, cv::Mat& scores) const {
+		const int rx = winStride.width / _hog.blockStride.width;
+		const int ry = winStride.height / _hog.blockStride.height;
+		const cv::Size windows = windowGrid(grid, winStride);
+		scores.create(windows.height, windows.width, CV_32F);
+		scores.setTo(cv::Scalar(-FLT_MAX));
+		const std::vector<int>& order = _cascade.getOrder();
+		const std::vector<float>& trace = _cascade.getTrace();
+		const int blocks = (int) order.size();
+		cv::Mat buffer;
+		const cv::Mat& gridBlocks = floatBlocks(grid, buffer);
+		// Offset of each cascade block from the top left block of a window, in grid rows
+		std::vector<int> offsets(blocks);
+		for (int t = 0; t < blocks; ++t)
+			offsets[t] = (order[t] % _blocksY) * grid.width + order[t] / _blocksY;
+		unsigned long evaluations = 0;
+		for (int wy = 0; wy < windows.height; ++wy) {
+			const uchar* allowed = windowMask.empty() ? NULL : windowMask.ptr<uchar>(wy);
+			float* row = scores.ptr<float>(wy);
+			for (int wx = 0; wx < windows.width; ++wx) {
+				if (allowed && !allowed[wx])
+					continue;
+				const int origin = wy * ry * grid.width + wx * rx;
+				float sum = 0.f;
+				int t = 0;
+				for (; t < blocks; ++t) {
+					sum += dotProduct(_weights.ptr<float>(order[t]), gridBlocks.ptr<float>(origin + offsets[t]), _blockHistogramSize);
+					if (sum < trace[t])
+						break;
+				}
+				evaluations += std::min(t + 1, blocks);
+				if (t == blocks)
+					row[wx] = _rho + sum;
+			}
+		}
+		return evaluations;
+	}
+
+	// Stores float blocks in a grid as this detector scores them
+	void quantiseGrid(const cv::Mat& blocks, BlockGrid& grid) const {
+		quantiseBlocks(blocks, _hog.L2HysThreshold, grid.quantised);
+		if (_cascade.empty()) {
+			grid.blocks.release();
+		} else {
+			blocks.copyTo(grid.blocks);
+		}
+	}
+
+	// Collect the windows scoring at least hitThreshold, restricted to the nonzero windows of windowMask if given
+	void collectHits(const cv::Mat& scores, const BlockGrid& grid, const cv::Size& winStride, double hitThreshold,
+		std::vector<cv::Point>& hits, std::vector<double>& weights, const cv::Mat& windowMask = cv::Mat()) const {
+		for (int wy = 0; wy < scores.rows; ++wy) {
+			const float* row = scores.ptr<float>(wy);
+			const uchar* allowed = windowMask.empty() ? NULL : windowMask.ptr<uchar>(wy);
+			for (int wx = 0; wx < scores.cols; ++wx) {
+				if (row[wx] >= hitThreshold && (allowed == NULL || allowed[wx])) {
+					hits.push_back(cv::Point(grid.origin.x + wx * winStride.width - grid.padding.width, grid.origin.y + wy * winStride.height - grid.padding.height));
+					weights.push_back(row[wx]);
+				}
+			}
+		}
+	}
+
+public:
+	BlockGridDetector(const cv::HOGDescriptor& hog) {
+		setDescriptor(hog);
+	}
+
+	// Take geometry and linear detector (svmDetector, optionally with rho appended) of a HOG descriptor.
+	void setDescriptor(const cv::HOGDescriptor& hog) {
+		hog.copyTo(_hog);
+		_blockHog = cv::HOGDescriptor(hog.blockSize, hog.blockSize, hog.blockStride, hog.cellSize, hog.nbins,
+			hog.derivAperture, hog.winSigma, hog.histogramNormType, hog.L2HysThreshold, hog.gammaCorrection,
+			hog.nlevels, hog.signedGradient);
+		_blocksX = (hog.winSize.width - hog.blockSize.width) / hog.blockStride.width + 1;
+		_blocksY = (hog.winSize.height - hog.blockSize.height) / hog.blockStride.height + 1;
+		const size_t descriptorSize = hog.getDescriptorSize();
+		_blockHistogramSize = (int) (descriptorSize / (_blocksX * _blocksY));
+		_rho = hog.svmDetector.size() > descriptorSize ? hog.svmDetector[descriptorSize] : 0.f;
+		if (hog.svmDetector.size() >= descriptorSize) {
+			_weights = cv::Mat(_blocksX * _blocksY, _blockHistogramSize, CV_32F, (void*) &hog.svmDetector[0]).clone();
+		} else {
+			printf("Error: HOG descriptor has no detector of size %lu set!\n", (unsigned long) descriptorSize);
+			_weights = cv::Mat::zeros(_blocksX * _blocksY, _blockHistogramSize, CV_32F);
+		}
+		if (!_quantised.empty())
+			_quantised.calibrate(_weights, _hog.L2HysThreshold, _quantised.getBits());
+	}
+
+	const cv::HOGDescriptor& getDescriptor() const { return _hog; }
+
+	// True if windows at this stride lie on the block grid, i.e. the stride is a positive multiple of the block stride
+	bool alignedStride(const cv::Size& winStride) const {
+		return winStride.width >= _hog.blockStride.width && winStride.height >= _hog.blockStride.height
+			&& winStride.width % _hog.blockStride.width == 0 && winStride.height % _hog.blockStride.height == 0;
+	}
+
+	// Pyramid scales as used by HOGDescriptor::detectMultiScale
+	std::vector<double> levelScales(const cv::Size& imageSize, double scale0) const {
+		std::vector<double> scales;
+		double scale = 1.;
+		int levels = 0;
+		for (; levels < _hog.nlevels; ++levels) {
+			scales.push_back(scale);
+			if (cvRound(imageSize.width / scale) < _hog.winSize.width || cvRound(imageSize.height / scale) < _hog.winSize.height || scale0 <= 1)
+				break;
+			scale *= scale0;
+		}
+		// The scale that no longer fits the window is dropped, unless it is the only one
+		scales.resize(std::max(levels, 1));
+		return scales;
+	}
+
+	// True if both detectors compute identical block grids and can share them
+	bool sharesBlockGrid(const BlockGridDetector& other) const {
+		const cv::HOGDescriptor& a = _hog;
+		const cv::HOGDescriptor& b = other._hog;
+		return a.blockSize == b.blockSize && a.blockStride == b.blockStride && a.cellSize == b.cellSize
+			&& a.nbins == b.nbins && a.derivAperture == b.derivAperture && a.getWinSigma() == b.getWinSigma()
+			&& a.histogramNormType == b.histogramNormType && a.L2HysThreshold == b.L2HysThreshold
+			&& a.gammaCorrection == b.gammaCorrection && a.signedGradient == b.signedGradient;
+	}
+
+	/**
+	 * Scores the windows of a pyramid level on a block grid computed by this or any detector sharing its block grid
+	 * @param grid block grid of the level
+	 * @param scale scale of the level
+	 * @param found receives the windows scoring at least hitThreshold, in image coordinates
+	 * @param foundWeights receives their decision values
+	 * @param windowMask optional, only the nonzero windows are reported
+	 * @param blockEvaluations optional, receives the number of block dot products of the scoring
+	 * @return number of windows of the level
+	 */
+	unsigned long scoreLevel(const BlockGrid& grid, double scale, double hitThreshold, const cv::Size& winStride,
+		std::vector<cv::Rect>& found, std::vector<double>& foundWeights, const cv::Mat& windowMask = cv::Mat(),
+		unsigned long* blockEvaluations = NULL) const {
+		if (blockEvaluations)
+			*blockEvaluations = 0;
+		if (!alignedStride(winStride)) {
+			printf("Error: Window stride %dx%d is not a multiple of the block stride %dx%d!\n", winStride.width, winStride.height,
+				_hog.blockStride.width, _hog.blockStride.height);
+			return 0;
+		}
+		cv::Mat scores;
+		unsigned long evaluations;
+		if (!_cascade.validFor(hitThreshold, _rho)) {
+			scoreGrid(grid, winStride, windowMask, scores);
+			evaluations = (unsigned long) (windowMask.empty() ? scores.rows * scores.cols : cv::countNonZero(windowMask)) * _weights.rows;
+		} else {
+			evaluations = scoreGridCascade(grid, winStride, windowMask, scores);
+		}
+		if (blockEvaluations)
+			*blockEvaluations = evaluations;
+		std::vector<cv::Point> hits;
+		std::vector<double> weights;
+		collectHits(scores, grid, winStride, hitThreshold, hits, weights, windowMask);
+		const cv::Size scaledWinSize(cvRound(_hog.winSize.width * scale), cvRound(_hog.winSize.height * scale));
+		for (size_t hit = 0; hit < hits.size(); ++hit) {
+			found.push_back(cv::Rect(cvRound(hits[hit].x * scale), cvRound(hits[hit].y * scale), scaledWinSize.width, scaledWinSize.height));
+		}
+		foundWeights.insert(foundWeights.end(), weights.begin(), weights.end());
+		return scores.rows * scores.cols;
+	}
+
+	/**
+	 * Restricts detectMultiScale to a region of interest. The mask may have any size,
+	 * it is stretched over the image.
+	 * @param mask CV_8U, nonzero where a window centre may lie, empty to scan the whole image
+	 */
+	void setRoiMask(const cv::Mat& mask) {
+		if (!mask.empty() && mask.type() != CV_8U) {
+			printf("Error: Region of interest mask must be a single channel 8 bit image!\n");
+			return;
+		}
+		_roiMask = mask.clone();
+	}
+
+	const cv::Mat& getRoiMask() const { return _roiMask; }
+
+	/**
+	 * Scores windows with early rejection, an empty cascade restores full scoring. Detections with
+	 * a lower threshold than the cascade was trained for are scored in full.
+	 * @param cascade soft cascade trained for this detector
+	 */
+	bool setSoftCascade(const SoftCascade& cascade) {
+		if (!cascade.empty() && (cascade.getBlockCount() != _weights.rows || cascade.getBlockHistogramSize() != _blockHistogramSize)) {
+			printf("Error: Soft cascade with %d blocks of %d bins does not fit the detector!\n", cascade.getBlockCount(), cascade.getBlockHistogramSize());
+			return false;
+		}
+		_cascade = cascade;
+		return true;
+	}
+
+	const SoftCascade& getSoftCascade() const { return _cascade; }
+
+	/**
+	 * Scores on 8 bit block features with fixed point weights, calibrated from the detector weights
+	 * @param bits 8 or 16 bit weights, 0 restores float scoring
+	 */
+	bool setQuantisation(int bits) {
+		return _quantised.calibrate(_weights, _hog.L2HysThreshold, bits);
+	}
+
+	// Bits of the quantised weights, 0 for float scoring
+	int getQuantisation() const { return _quantised.getBits(); }
+	// Weights of the blocks of a window, one row per block in descriptor order
+	const cv::Mat& getBlockWeights() const { return _weights; }
+	float getRho() const { return _rho; }
+
+	/**
+	 * Scores every window of a block grid, without soft cascade and constraints
+	 * @param winStride window stride, a multiple of the block stride
+	 * @param scores receives the decision values, one per window (rows x cols = windows y x windows x)
+	 */
+	void scoreWindows(const BlockGrid& grid, const cv::Size& winStride, cv::Mat& scores) const {
+		scoreGrid(grid, winStride, cv::Mat(), scores);
+	}
+
+	/**
+	 * Gathers the descriptor of a window from the float blocks of a grid, as hog.compute returns it
+	 * @param window column and row of the window in the window grid
+	 * @param descriptor receives the getDescriptorSize() components
+	 */
+	void windowDescriptor(const BlockGrid& grid, const cv::Size& winStride, const cv::Point& window, float* descriptor) const {
+		const int rx = winStride.width / _hog.blockStride.width;
+		const int ry = winStride.height / _hog.blockStride.height;
+		for (int k = 0; k < _weights.rows; ++k) {
+			// Descriptor order is column-major over the blocks of the window
+			const float* block = grid.blocks.ptr<float>((window.y * ry + k % _blocksY) * grid.width + window.x * rx + k / _blocksY);
+			std::copy(block, block + _blockHistogramSize, descriptor + k * _blockHistogramSize);
+		}
+	}
+
+	// Restricts detectMultiScale to the rows where pedestrians of each level's scale can stand, cameraHeight <= 0 disables it
+	void setGroundPlane(const GroundPlaneConstraint& groundPlane) {
+		_groundPlane = groundPlane;
+	}
+
+	const GroundPlaneConstraint& getGroundPlane() const { return _groundPlane; }
+
+	/**
+	 * Loads a region of interest mask: an image (nonzero = region of interest) or a polygon list text file
+	 * with the reference size "width height" in the first line and one polygon "x1 y1 x2 y2 ..." per line
+	 * @param fileName mask image or .txt polygon list
+	 * @param mask receives the mask
+	 */
+	static bool loadRoiMask(const std::string& fileName, cv::Mat& mask) {
+		if (fileName.size() < 4 || fileName.substr(fileName.size() - 4) != ".txt") {
+			mask = cv::imread(fileName, cv::IMREAD_GRAYSCALE);
+			if (mask.empty()) {
+				printf("Error: Could not read region of interest mask '%s'!\n", fileName.c_str());
+				return false;
+			}
+			return true;
+		}
+		std::ifstream file(fileName.c_str());
+		cv::Size size;
+		if (!(file >> size.width >> size.height) || size.area() <= 0) {
+			printf("Error: Region of interest file '%s' does not start with the mask size!\n", fileName.c_str());
+			return false;
+		}
+		std::vector<std::vector<cv::Point> > polygons;
+		std::string line;
+		while (std::getline(file, line)) {
+			std::istringstream points(line);
+			std::vector<cv::Point> polygon;
+			cv::Point point;
+			while (points >> point.x >> point.y)
+				polygon.push_back(point);
+			if (polygon.size() >= 3)
+				polygons.push_back(polygon);
+		}
+		mask = cv::Mat::zeros(size, CV_8U);
+		cv::fillPoly(mask, polygons, cv::Scalar(255));
+		return true;
+	}
+
+	/**
+	 * Computes the normalised block grid of an image
+	 * @param image level image
+	 * @param padding padding around the image, aligned to the block stride
+	 * @param grid receives the block grid
+	 * @param blockMask optional, only the blocks nonzero in this grid sized mask are computed, the others are zero
+	 */
+	void computeBlockGrid(const cv::Mat& image, const cv::Size& padding, BlockGrid& grid, const cv::Mat& blockMask = cv::Mat()) const {
+		grid.padding = alignedPadding(padding);
+		grid.origin = cv::Point(0, 0);
+		const cv::Size gridSize = blockGridSize(image.size(), grid.padding);
+		grid.width = gridSize.width;
+		grid.height = gridSize.height;
+		grid.quantised.release();
+		if (grid.width * grid.height == 0) {
+			grid.blocks.release();
+			return;
+		}
+		std::vector<float> descriptors;
+		if (blockMask.empty()) {
+			_blockHog.compute(image, descriptors, _hog.blockStride, grid.padding);
+			const cv::Mat blocks(grid.width * grid.height, _blockHistogramSize, CV_32F, &descriptors[0]);
+			if (_quantised.empty()) {
+				blocks.copyTo(grid.blocks);
+			} else {
+				quantiseGrid(blocks, grid);
+			}
+			return;
+		}
+		std::vector<cv::Point> locations;
+		std::vector<int> rows;
+		for (int gy = 0; gy < grid.height; ++gy) {
+			const uchar* row = blockMask.ptr<uchar>(gy);
+			for (int gx = 0; gx < grid.width; ++gx) {
+				if (row[gx]) {
+					locations.push_back(cv::Point(gx * _hog.blockStride.width - grid.padding.width, gy * _hog.blockStride.height - grid.padding.height));
+					rows.push_back(gy * grid.width + gx);
+				}
+			}
+		}
+		cv::Mat blocks = cv::Mat::zeros(grid.width * grid.height, _blockHistogramSize, CV_32F);
+		if (!locations.empty()) {
+			_blockHog.compute(image, descriptors, _hog.blockStride, grid.padding, locations);
+			for (size_t i = 0; i < rows.size(); ++i)
+				std::copy(&descriptors[i * _blockHistogramSize], &descriptors[(i + 1) * _blockHistogramSize], blocks.ptr<float>(rows[i]));
+		}
+		if (_quantised.empty()) {
+			grid.blocks = blocks;
+		} else {
+			quantiseGrid(blocks, grid);
+		}
+	}
+
+	/**
+	 * Single scale detection, the equivalent of HOGDescriptor::detect. Falls back to HOGDescriptor
+	 * for strides not aligned with the block grid.
+	 * @param hits top left corners of the windows scoring at least hitThreshold
+	 * @param weights decision values of the hits
+	 */
+	void detect(const cv::Mat& image, std::vector<cv::Point>& hits, std::vector<double>& weights,
+		double hitThreshold = 0, cv::Size winStride = cv::Size(8, 8), cv::Size padding = cv::Size(0, 0)) const {
+		hits.clear();
+		weights.clear();
+		if (!alignedStride(winStride)) {
+			_hog.detect(image, hits, weights, hitThreshold, winStride, padding);
+			return;
+		}
+		BlockGrid grid;
+		computeBlockGrid(image, padding, grid);
+		cv::Mat scores;
+		if (!_cascade.validFor(hitThreshold, _rho)) {
+			scoreGrid(grid, winStride, cv::Mat(), scores);
+		} else {
+			scoreGridCascade(grid, winStride, cv::Mat(), scores);
+		}
+		collectHits(scores, grid, winStride, hitThreshold, hits, weights);
+	}
+
+	/**
+	 * Multi scale detection, the equivalent of HOGDescriptor::detectMultiScale. Applies the
+	 * region of interest mask and ground plane constraint, except in the HOGDescriptor fallback
+	 * for unaligned strides.
+	 * @param found grouped detections
+	 * @param foundWeights decision values of the detections
+	 * @param stats optional counters of the call
+	 */
+	void detectMultiScale(const cv::Mat& image, std::vector<cv::Rect>& found, std::vector<double>& foundWeights,
+		double hitThreshold = 0, cv::Size winStride = cv::Size(8, 8), cv::Size padding = cv::Size(0, 0),
+		double scale0 = 1.05, double finalThreshold = 2.0, BlockGridDetectorStats* stats = NULL) const {
+		found.clear();
+		foundWeights.clear();
+		if (!alignedStride(winStride)) {
+			// Windows would not be aligned with the block grid
+			_hog.detectMultiScale(image, found, foundWeights, hitThreshold, winStride, padding, scale0, finalThreshold);
+			return;
+		}
+		const std::vector<double> scales = levelScales(image.size(), scale0);
+		const int levels = (int) scales.size();
+		std::vector<std::vector<cv::Rect> > levelFound(levels);
+		std::vector<std::vector<double> > levelWeights(levels);
+		std::vector<BlockGridDetectorStats> levelStats(levels, BlockGridDetectorStats());
+
+		cv::parallel_for_(cv::Range(0, levels), [&](const cv::Range& range) {
+			for (int level = range.start; level < range.end; ++level) {
+				const double scale = scales[level];
+				const cv::Size size(cvRound(image.cols / scale), cvRound(image.rows / scale));
+				BlockGridDetectorStats& s = levelStats[level];
+				int64_t start = cv::getTickCount();
+
+				// Prune the windows outside the region of interest and ground plane band before any block is computed,
+				// only the part of the level holding the remaining windows is resampled and computed
+				cv::Mat windowMask, blockMask;
+				const cv::Size levelPadding = alignedPadding(padding);
+				const cv::Size levelGridSize = blockGridSize(size, levelPadding);
+				cv::Rect region(0, 0, size.width, size.height);
+				if (constrained()) {
+					BlockGrid levelGrid;
+					levelGrid.padding = levelPadding;
+					levelGrid.origin = cv::Point(0, 0);
+					levelGrid.width = levelGridSize.width;
+					levelGrid.height = levelGridSize.height;
+					const int allowed = levelWindowMask(image.size(), scale, levelGrid, winStride, windowMask);
+					s.windowsPruned = windowMask.rows * windowMask.cols - allowed;
+					if (allowed == 0) {
+						s.blocksSkipped = levelGrid.width * levelGrid.height;
+						continue;
+					}
+					region = windowRegion(size, levelPadding, winStride, windowMask);
+				}
+
+				const cv::Mat levelImage = levelRegion(image, size, region, levelPadding);
+				BlockGrid grid;
+				if (constrained()) {
+					// Window mask of the part, its windows are those of the full level mask
+					grid.padding = levelPadding;
+					grid.origin = region.tl();
+					const cv::Size gridSize = blockGridSize(region.size(), levelPadding);
+					grid.width = gridSize.width;
+					grid.height = gridSize.height;
+					levelWindowMask(image.size(), scale, grid, winStride, windowMask);
+					coveredBlockMask(windowMask, grid, winStride, blockMask);
+				}
+				computeBlockGrid(levelImage, padding, grid, blockMask);
+				grid.origin = region.tl();
+				const int64_t gridDone = cv::getTickCount();
+				const unsigned long windows = scoreLevel(grid, scale, hitThreshold, winStride, levelFound[level], levelWeights[level], windowMask, &s.blockEvaluations);
+				s.gridMs = (gridDone - start) * 1000. / cv::getTickFrequency();
+				s.scoringMs = (cv::getTickCount() - gridDone) * 1000. / cv::getTickFrequency();
+				s.blocksComputed = blockMask.empty() ? grid.width * grid.height : cv::countNonZero(blockMask);
+				s.blocksSkipped = levelGridSize.width * levelGridSize.height - s.blocksComputed;
+				s.windowsEvaluated = windowMask.empty() ? windows : cv::countNonZero(windowMask);
+				s.gridBytes = grid.blocks.total() * grid.blocks.elemSize() + grid.quantised.total() * grid.quantised.elemSize();
+			}
+		});
+
+		for (int level = 0; level < levels; ++level) {
+			found.insert(found.end(), levelFound[level].begin(), levelFound[level].end());
+			foundWeights.insert(foundWeights.end(), levelWeights[level].begin(), levelWeights[level].end());
+		}
+		if (stats) {
+			*stats = BlockGridDetectorStats();
+			stats->levels = levels;
+			for (int level = 0; level < levels; ++level) {
+				stats->blocksComputed += levelStats[level].blocksComputed;
+				stats->windowsEvaluated += levelStats[level].windowsEvaluated;
+				stats->windowsPruned += levelStats[level].windowsPruned;
+				stats->blocksSkipped += levelStats[level].blocksSkipped;
+				stats->blockEvaluations += levelStats[level].blockEvaluations;
+				stats->gridBytes += levelStats[level].gridBytes;
+				stats->gridMs += levelStats[level].gridMs;
+				stats->scoringMs += levelStats[level].scoringMs;
+			}
+		}
+		_hog.groupRectangles(found, foundWeights, (int) finalThreshold, 0.2);
+	}
+};
+
+#endif
@@ -0,0 +1,480 @@
+#ifndef DATASETWALKER_H
+#define DATASETWALKER_H
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <vector>
+#include <string>
+#include <map>
+#include <deque>
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stdint.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <opencv2/core/core.hpp>
+#include "hash.h"
+#include "trace.h"
+#if defined(_WIN32) || defined(_WIN64)
+  #include <direct.h>
+#endif
+
+// A file found by the DatasetWalker
+struct DatasetEntry {
+	std::string path;
+	uint64_t size;
+	int64_t mtime;        // seconds
+};
+
+// Growing list of dataset files, appended by a walk while consumers already
+// read it by index. Entries never move or change once appended.
+class
+DatasetStream{
+private:
+	std::vector<DatasetEntry> _entries;
+	bool _closed;
+	mutable std::mutex _mutex;
+	mutable std::condition_variable _changed;
+
+public:
+	DatasetStream():
+	_closed(false){
+	}
+
+	void append(const std::vector<DatasetEntry>& entries) {
+		if (entries.empty())
+			return;
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_entries.insert(_entries.end(), entries.begin(), entries.end());
+		}
+		_changed.notify_all();
+	}
+
+	// Marks the end of the list
+	void close() {
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_closed = true;
+		}
+		_changed.notify_all();
+	}
+
+	/**
+	 * Path of an entry, waits until the entry is appended or the list is closed
+	 * @return false if the list ended before the entry
+	 */
+	bool get(size_t index, std::string& path) const {
+		std::unique_lock<std::mutex> lock(_mutex);
+		_changed.wait(lock, [this, index] { return index < _entries.size() || _closed; });
+		if (index >= _entries.size())
+			return false;
+		path = _entries[index].path;
+		return true;
+	}
+
+	// Waits until the list is closed, returns the number of entries
+	size_t waitForEnd() const {
+		std::unique_lock<std::mutex> lock(_mutex);
+		_changed.wait(lock, [this] { return _closed; });
+		return _entries.size();
+	}
+
+	bool closed() const {
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _closed;
+	}
+
+	size_t size() const {
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _entries.size();
+	}
+
+	// All paths, waits until the list is closed
+	void paths(std::vector<std::string>& fileNames) const {
+		waitForEnd();
+		std::lock_guard<std::mutex> lock(_mutex);
+		fileNames.reserve(fileNames.size() + _entries.size());
+		for (size_t i = 0; i < _entries.size(); ++i)
+			fileNames.push_back(_entries[i].path);
+	}
+};
+
+// Recursive dataset directory walker. Worker threads list directories in
+// parallel, while the walking thread emits the files in a fixed depth first
+// order (files of a directory sorted by name, then its subdirectories), so
+// the order does not depend on the thread timing and consumers can start on
+// the first files while the rest of the tree is still being listed. Hidden
+// entries and symbolic links to directories are skipped.
+//
+// Every listing is kept in a manifest (relative paths, sizes and mtimes per
+// directory) in the manifest directory. A later walk of the same root only
+// stats the directories and reuses the listing of every directory whose mtime
+// did not change, which on large network shares replaces millions of
+// directory entry and file stats by one stat per directory. Files modified in
+// place keep their old size and mtime in the manifest.
+class
+DatasetWalker{
+private:
+	struct Directory {
+		int64_t mtimeSec, mtimeNsec;
+		std::vector<std::string> subdirectories;    // names, sorted
+		std::vector<DatasetEntry> files;            // sorted by path
+	};
+	typedef std::map<std::string, std::shared_ptr<Directory> > Directories;
+
+	std::vector<std::string> _extensions;
+	std::string _manifestDirectory;
+	unsigned int _threads;
+
+	// State of the current walk
+	std::string _root;
+	Directories _previous;        // from the manifest, read-only during the walk
+	Directories _directories;     // listed so far, by path with trailing '/'
+	std::deque<std::string> _queue;
+	size_t _outstanding;          // directories queued or being listed
+	std::mutex _mutex;
+	std::condition_variable _work;
+	std::condition_variable _listed;
+	std::thread _thread;
+
+	// Counters
+	unsigned long _read, _reused, _skipped, _files;
+
+	static const uint32_t manifestVersion = 1;
+
+	static void directoryTime(const struct stat& s, int64_t& sec, int64_t& nsec) {
+		sec = (int64_t) s.st_mtime;
+#if defined(__linux__)
+		nsec = (int64_t) s.st_mtim.tv_nsec;
+#elif defined(__APPLE__)
+		nsec = (int64_t) s.st_mtimespec.tv_nsec;
+#else
+		nsec = 0;
+#endif
+	}
+
+	bool matchesExtension(const char* name) const {
+		const char* dot = strrchr(name, '.');
+		if (dot == NULL)
+			return false;
+		for (size_t i = 0; i < _extensions.size(); ++i) {
+			if (strcasecmp(dot + 1, _extensions[i].c_str()) == 0)
+				return true;
+		}
+		return false;
+	}
+
+	std::string manifestFilename() const {
+		uint64_t hash = fnv1aHash(_root.data(), _root.size());
+		for (size_t i = 0; i < _extensions.size(); ++i)
+			hash = fnv1aHash(_extensions[i].c_str(), _extensions[i].size() + 1, hash);
+		char name[32];
+		snprintf(name, sizeof(name), "%016llx.manifest", (unsigned long long) hash);
+		return _manifestDirectory + name;
+	}
+
+	// Lists one directory, from the manifest if its mtime did not change
+	void list(const std::string& path, Directory& directory) {
+		PD_TRACE_SCOPE("list directory");
+		struct stat s;
+		if (stat(path.c_str(), &s) != 0) {
+			printf("Error opening directory '%s'!\n", path.c_str());
+			directory.mtimeSec = directory.mtimeNsec = -1;
+			return;
+		}
+		directoryTime(s, directory.mtimeSec, directory.mtimeNsec);
+		Directories::const_iterator previous = _previous.find(path);
+		if (previous != _previous.end() && previous->second->mtimeSec >= 0 && previous->second->mtimeSec == directory.mtimeSec && previous->second->mtimeNsec == directory.mtimeNsec) {
+			directory.subdirectories = previous->second->subdirectories;
+			directory.files = previous->second->files;
+			std::lock_guard<std::mutex> lock(_mutex);
+			++_reused;
+			return;
+		}
+		DIR* dp = opendir(path.c_str());
+		if (dp == NULL) {
+			printf("Error opening directory '%s'!\n", path.c_str());
+			// Not a valid listing, the next run must read the directory again
+			directory.mtimeSec = directory.mtimeNsec = -1;
+			return;
+		}
+		unsigned long skipped = 0;
+		struct dirent* ep;
+		while ((ep = readdir(dp))) {
+			const char* name = ep->d_name;
+			if (name[0] == '.')
+				continue;
+			bool isDirectory = false, isFile = false, known = false;
+#ifdef _DIRENT_HAVE_D_TYPE
+			isDirectory = ep->d_type == DT_DIR;
+			isFile = ep->d_type == DT_REG;
+			known = ep->d_type != DT_UNKNOWN && ep->d_type != DT_LNK;
+#endif
+			const bool matching = matchesExtension(name);
+			// Only matching files need a stat, others only on file systems without d_type and for links
+			struct stat fileStat;
+			memset(&fileStat, 0, sizeof(fileStat));
+			if (!known || (isFile && matching)) {
+				if (stat((path + name).c_str(), &fileStat) != 0)
+					continue;
+				if (!known) {
+					isDirectory = S_ISDIR(fileStat.st_mode);
+#ifdef S_ISLNK
+					// Links to directories are not followed, they could form cycles
+					struct stat linkStat;
+					isDirectory = isDirectory && (lstat((path + name).c_str(), &linkStat) != 0 || !S_ISLNK(linkStat.st_mode));
+#endif
+					isFile = S_ISREG(fileStat.st_mode);
+				}
+			}
+			if (isDirectory) {
+				directory.subdirectories.push_back(name);
+			} else if (isFile && matching) {
+				DatasetEntry entry = {path + name, (uint64_t) fileStat.st_size, (int64_t) fileStat.st_mtime};
+				directory.files.push_back(entry);
+			} else {
+				++skipped;
+			}
+		}
+		(void) closedir(dp);
+		std::sort(directory.subdirectories.begin(), directory.subdirectories.end());
+		std::sort(directory.files.begin(), directory.files.end(), [](const DatasetEntry& a, const DatasetEntry& b) { return a.path < b.path; });
+		std::lock_guard<std::mutex> lock(_mutex);
+		++_read;
+		_skipped += skipped;
+	}
+
+	void workerLoop() {
+		for (;;) {
+			std::string path;
+			{
+				std::unique_lock<std::mutex> lock(_mutex);
+				_work.wait(lock, [this] { return !_queue.empty() || _outstanding == 0; });
+				if (_queue.empty())
+					return;
+				path = _queue.front();
+				_queue.pop_front();
+			}
+			std::shared_ptr<Directory> directory(new Directory());
+			directory->mtimeSec = directory->mtimeNsec = -1;
+			list(path, *directory);
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				_directories[path] = directory;
+				for (size_t i = 0; i < directory->subdirectories.size(); ++i)
+					_queue.push_back(path + directory->subdirectories[i] + '/');
+				_outstanding += directory->subdirectories.size();
+				--_outstanding;
+			}
+			_work.notify_all();
+			_listed.notify_all();
+		}
+	}
+
+	// Appends the files below a directory in depth first order, waiting for the listings
+	void emit(const std::string& path, DatasetStream& stream) {
+		std::shared_ptr<Directory> directory;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_listed.wait(lock, [this, &path] { return _directories.count(path) > 0; });
+			directory = _directories[path];
+			_files += directory->files.size();
+		}
+		stream.append(directory->files);
+		for (size_t i = 0; i < directory->subdirectories.size(); ++i)
+			emit(path + directory->subdirectories[i] + '/', stream);
+	}
+
+	static bool readString(FILE* f, std::string& s) {
+		uint32_t length = 0;
+		if (fread(&length, sizeof(length), 1, f) != 1)
+			return false;
+		s.resize(length);
+		return length == 0 || fread(&s[0], 1, length, f) == length;
+	}
+
+	static bool writeString(FILE* f, const std::string& s) {
+		const uint32_t length = (uint32_t) s.size();
+		return fwrite(&length, sizeof(length), 1, f) == 1 && (length == 0 || fwrite(s.data(), 1, length, f) == length);
+	}
+
+	// Manifest: "PDMF", version, directory count, then per directory its path relative to
+	// the root, mtime, subdirectory names and files (name, size, mtime)
+	void loadManifest() {
+		_previous.clear();
+		FILE* f = fopen(manifestFilename().c_str(), "rb");
+		if (f == NULL)
+			return;
+		char magic[4];
+		uint32_t version = 0;
+		uint64_t count = 0;
+		bool ok = fread(magic, 1, 4, f) == 4 && memcmp(magic, "PDMF", 4) == 0
+			&& fread(&version, sizeof(version), 1, f) == 1 && version == manifestVersion
+			&& fread(&count, sizeof(count), 1, f) == 1;
+		for (uint64_t d = 0; ok && d < count; ++d) {
+			std::string relative;
+			int64_t times[2];
+			uint32_t counts[2];
+			ok = readString(f, relative) && fread(times, sizeof(times), 1, f) == 1 && fread(counts, sizeof(counts), 1, f) == 1;
+			if (!ok)
+				break;
+			std::shared_ptr<Directory> directory(new Directory());
+			directory->mtimeSec = times[0];
+			directory->mtimeNsec = times[1];
+			const std::string path = _root + relative;
+			directory->subdirectories.resize(counts[0]);
+			for (uint32_t i = 0; ok && i < counts[0]; ++i)
+				ok = readString(f, directory->subdirectories[i]);
+			directory->files.resize(counts[1]);
+			for (uint32_t i = 0; ok && i < counts[1]; ++i) {
+				DatasetEntry& entry = directory->files[i];
+				ok = readString(f, entry.path) && fread(&entry.size, sizeof(entry.size), 1, f) == 1 && fread(&entry.mtime, sizeof(entry.mtime), 1, f) == 1;
+				entry.path.insert(0, path);
+			}
+			_previous[path] = directory;
+		}
+		fclose(f);
+		if (!ok) {
+			printf("Ignoring invalid dataset manifest %s\n", manifestFilename().c_str());
+			_previous.clear();
+		}
+	}
+
+	bool saveManifest() {
+#if defined(_WIN32) || defined(_WIN64)
+		_mkdir(_manifestDirectory.c_str());
+#else
+		mkdir(_manifestDirectory.c_str(), 0755);
+#endif
+		// Written to a temporary name and renamed, so an interrupted run never leaves a truncated manifest
+		const std::string fileName = manifestFilename();
+		const std::string tmpName = fileName + ".tmp";
+		FILE* f = fopen(tmpName.c_str(), "wb");
+		if (f == NULL) {
+			printf("Could not open file %s for writing\n", tmpName.c_str());
+			return false;
+		}
+		const uint32_t version = manifestVersion;
+		const uint64_t count = _directories.size();
+		bool ok = fwrite("PDMF", 1, 4, f) == 4 && fwrite(&version, sizeof(version), 1, f) == 1
+			&& fwrite(&count, sizeof(count), 1, f) == 1;
+		for (Directories::const_iterator it = _directories.begin(); ok && it != _directories.end(); ++it) {
+			const Directory& directory = *it->second;
+			const int64_t times[2] = {directory.mtimeSec, directory.mtimeNsec};
+			const uint32_t counts[2] = {(uint32_t) directory.subdirectories.size(), (uint32_t) directory.files.size()};
+			ok = writeString(f, it->first.substr(_root.size())) && fwrite(times, sizeof(times), 1, f) == 1 && fwrite(counts, sizeof(counts), 1, f) == 1;
+			for (size_t i = 0; ok && i < directory.subdirectories.size(); ++i)
+				ok = writeString(f, directory.subdirectories[i]);
+			for (size_t i = 0; ok && i < directory.files.size(); ++i) {
+				const DatasetEntry& entry = directory.files[i];
+				ok = writeString(f, entry.path.substr(it->first.size())) && fwrite(&entry.size, sizeof(entry.size), 1, f) == 1
+					&& fwrite(&entry.mtime, sizeof(entry.mtime), 1, f) == 1;
+			}
+		}
+		if (fclose(f) != 0 || !ok || rename(tmpName.c_str(), fileName.c_str()) != 0) {
+			remove(tmpName.c_str());
+			printf("Error writing dataset manifest %s\n", fileName.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	void walkAndClose(DatasetStream& stream) {
+		walk(stream);
+		stream.close();
+	}
+
+	DatasetWalker(const DatasetWalker&);
+	DatasetWalker& operator=(const DatasetWalker&);
+
+public:
+	/**
+	 * @param validExtensions file extensions to collect, matched case insensitively
+	 * @param manifestDirectory directory of the manifests, created if missing, empty to always list every directory
+	 * @param threads directory listing threads (0 = one per CPU)
+	 */
+	DatasetWalker(const std::vector<std::string>& validExtensions, const std::string& manifestDirectory, unsigned int threads = 0):
+	_extensions(validExtensions), _manifestDirectory(manifestDirectory), _threads(threads),
+	_outstanding(0), _read(0), _reused(0), _skipped(0), _files(0){
+		if (!_manifestDirectory.empty() && _manifestDirectory[_manifestDirectory.size() - 1] != '/')
+			_manifestDirectory += '/';
+		if (_threads == 0) {
+			const int cpus = cv::getNumberOfCPUs();
+			_threads = cpus > 0 ? cpus : 1;
+		}
+	}
+
+	~DatasetWalker() {
+		wait();
+	}
+
+	// Sets the root directory of the next walk
+	void setRoot(const std::string& root) {
+		_root = root;
+		if (!_root.empty() && _root[_root.size() - 1] != '/')
+			_root += '/';
+	}
+
+	/**
+	 * Walks the root directory on the calling thread, appending the files to the stream as they are found
+	 * (the stream is not closed). Updates the manifest if any directory changed.
+	 * @return number of files found
+	 */
+	size_t walk(DatasetStream& stream) {
+		PD_TRACE_SCOPE("walk dataset");
+		const int64 start = cv::getTickCount();
+		_directories.clear();
+		_queue.clear();
+		_read = _reused = _skipped = _files = 0;
+		if (!_manifestDirectory.empty())
+			loadManifest();
+		_queue.push_back(_root);
+		_outstanding = 1;
+		std::vector<std::thread> workers;
+		for (unsigned int w = 0; w < _threads; ++w)
+			workers.push_back(std::thread(&DatasetWalker::workerLoop, this));
+		emit(_root, stream);
+		for (size_t w = 0; w < workers.size(); ++w)
+			workers[w].join();
+		if (!_manifestDirectory.empty() && (_read > 0 || _previous.size() != _directories.size()))
+			saveManifest();
+		printf("Found %lu files in %lu directories of '%s' (%lu listed, %lu from the manifest, %lu other files skipped) in %.2f s\n",
+			_files, (unsigned long) _directories.size(), _root.c_str(), _read, _reused, _skipped, (cv::getTickCount() - start) / cv::getTickFrequency());
+		PD_TRACE_COUNTER("dataset files", _files);
+		_previous.clear();
+		_directories.clear();
+		return _files;
+	}
+
+	// Walks the root directory on a background thread, the stream is closed when the walk is done
+	void start(DatasetStream& stream) {
+		wait();
+		_thread = std::thread(&DatasetWalker::walkAndClose, this, std::ref(stream));
+	}
+
+	// Waits for a walk started by start()
+	void wait() {
+		if (_thread.joinable())
+			_thread.join();
+	}
+
+	/**
+	 * Lists all files below a directory
+	 * @param root directory to walk recursively
+	 * @param fileNames receives the paths in walk order
+	 */
+	void list(const std::string& root, std::vector<std::string>& fileNames) {
+		setRoot(root);
+		DatasetStream stream;
+		walk(stream);
+		stream.close();
+		stream.paths(fileNames);
+	}
+};
+
+#endif
@@ -0,0 +1,337 @@
+#ifndef DETECTIONSERVICE_H
+#define DETECTIONSERVICE_H
+
+#if !defined(_WIN32) && !defined(_WIN64)
+
+#include <stdio.h>
+#include <signal.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <atomic>
+#include <algorithm>
+#include <cstring>
+#include <stdint.h>
+#include <opencv2/opencv.hpp>
+#include "detectormodel.h"
+#include "blockgriddetector.h"
+
+// Wire format of the detection service, all integers little endian.
+//
+// Request:  uint8 type, uint32 length, length bytes payload
+//           type 0: payload is an image path readable by the service
+//           type 1: payload is an encoded image (JPEG, PNG, ...)
+// Reply:    uint32 count, count x DetectionRecord
+//           count 0xFFFFFFFF signals an invalid request or undecodable image
+//
+// A connection may send any number of requests, replies come in order.
+enum { DETECTION_REQUEST_PATH = 0, DETECTION_REQUEST_IMAGE = 1 };
+static const uint32_t detectionReplyError = 0xFFFFFFFFu;
+// Largest accepted request payload
+static const uint32_t detectionMaxPayload = 64u << 20;
+
+#pragma pack(push, 1)
+struct DetectionRecord {
+	int16_t x, y, width, height;
+	float score;
+};
+#pragma pack(pop)
+
+struct DetectionServiceParams {
+	std::string socketPath;
+	// Detection worker threads, 0 = one per CPU core
+	unsigned int workers;
+	// Print the latency percentiles every n requests, 0 = only at shutdown
+	unsigned int reportInterval;
+	cv::Size winStride;
+	cv::Size padding;
+	double scale0;
+
+	DetectionServiceParams():
+	socketPath("/tmp/pd.sock"), workers(0), reportInterval(1000),
+	winStride(8, 8), padding(8, 8), scale0(1.05){
+	}
+};
+
+// Long-running detector: loads a model once and answers detection requests
+// over a Unix domain socket. Every connection gets a reader thread that
+// queues its requests; each idle worker of the pool takes the oldest
+// request off the queue right away and fulfils it with its detections.
+// Requests share no work (decoding, pyramid and block grids depend on the
+// image), so grouping them into batches for one worker would only queue
+// them behind each other while other workers sit idle.
+class
+DetectionService{
+private:
+	struct Job {
+		uint8_t type;
+		std::vector<uchar> payload;
+		int64_t receivedTicks;
+		std::promise<std::vector<DetectionRecord> > reply;
+		bool failed;
+	};
+
+	DetectionServiceParams _params;
+	cv::HOGDescriptor _hog;
+	BlockGridDetector* _detector;
+	double _hitThreshold;
+
+	std::deque<Job*> _queue;
+	std::mutex _queueMutex;
+	std::condition_variable _queueChanged;
+
+	bool _shutdown; // no more requests will be queued, guarded by _queueMutex
+
+	// Latencies since the last report
+	std::mutex _statsMutex;
+	std::vector<double> _latenciesMs;
+	std::vector<double> _queueDelaysMs;
+	unsigned long _requests;
+
+	std::mutex _connectionsMutex;
+	std::condition_variable _connectionClosed;
+	std::vector<int> _connectionFds;
+
+	static std::atomic<bool>& stopFlag() {
+		static std::atomic<bool> flag(false);
+		return flag;
+	}
+
+	static void onSignal(int) {
+		stopFlag() = true;
+	}
+
+	static double ticksToMs(int64_t ticks) {
+		return ticks * 1000. / cv::getTickFrequency();
+	}
+
+	static bool readFully(int fd, void* buffer, size_t length) {
+		char* p = (char*) buffer;
+		while (length > 0) {
+			ssize_t n = read(fd, p, length);
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) return false;
+			p += n;
+			length -= n;
+		}
+		return true;
+	}
+
+	static bool writeFully(int fd, const void* buffer, size_t length) {
+		const char* p = (const char*) buffer;
+		while (length > 0) {
+			ssize_t n = send(fd, p, length, MSG_NOSIGNAL);
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) return false;
+			p += n;
+			length -= n;
+		}
+		return true;
+	}
+
+	static double percentile(std::vector<double> values, double p) {
+		if (values.empty()) return 0.;
+		const size_t idx = std::min(values.size() - 1, (size_t) (p * values.size()));
+		std::nth_element(values.begin(), values.begin() + idx, values.end());
+		return values[idx];
+	}
+
+	void detect(Job& job, std::vector<DetectionRecord>& records) const {
+		cv::Mat image;
+		if (job.type == DETECTION_REQUEST_PATH) {
+			image = cv::imread(std::string(job.payload.begin(), job.payload.end()), cv::IMREAD_COLOR);
+		} else {
+			image = cv::imdecode(job.payload, cv::IMREAD_COLOR);
+		}
+		if (image.empty()) {
+			job.failed = true;
+			return;
+		}
+		std::vector<cv::Rect> found;
+		std::vector<double> weights;
+		_detector->detectMultiScale(image, found, weights, _hitThreshold, _params.winStride, _params.padding, _params.scale0);
+		records.resize(found.size());
+		for (size_t i = 0; i < found.size(); ++i) {
+			DetectionRecord& r = records[i];
+			r.x = (int16_t) found[i].x;
+			r.y = (int16_t) found[i].y;
+			r.width = (int16_t) found[i].width;
+			r.height = (int16_t) found[i].height;
+			r.score = i < weights.size() ? (float) weights[i] : 0.f;
+		}
+	}
+
+	void workerLoop() {
+		for (;;) {
+			Job* job;
+			{
+				std::unique_lock<std::mutex> lock(_queueMutex);
+				while (!_shutdown && _queue.empty())
+					_queueChanged.wait(lock);
+				if (_queue.empty())
+					return;
+				job = _queue.front();
+				_queue.pop_front();
+			}
+			{
+				// Before replying, a job is gone as soon as its connection has the reply
+				std::lock_guard<std::mutex> lock(_statsMutex);
+				_queueDelaysMs.push_back(ticksToMs(cv::getTickCount() - job->receivedTicks));
+			}
+			std::vector<DetectionRecord> records;
+			detect(*job, records);
+			job->reply.set_value(records);
+		}
+	}
+
+	void connectionLoop(int fd) {
+		for (;;) {
+			uint8_t type;
+			uint32_t length;
+			if (!readFully(fd, &type, sizeof(type)) || !readFully(fd, &length, sizeof(length)))
+				break;
+			if (length > detectionMaxPayload || (type != DETECTION_REQUEST_PATH && type != DETECTION_REQUEST_IMAGE)) {
+				writeFully(fd, &detectionReplyError, sizeof(detectionReplyError));
+				break;
+			}
+			Job job;
+			job.type = type;
+			job.failed = false;
+			job.payload.resize(length);
+			if (length > 0 && !readFully(fd, &job.payload[0], length))
+				break;
+			job.receivedTicks = cv::getTickCount();
+			std::future<std::vector<DetectionRecord> > result = job.reply.get_future();
+			{
+				std::lock_guard<std::mutex> lock(_queueMutex);
+				_queue.push_back(&job);
+			}
+			_queueChanged.notify_one();
+
+			const std::vector<DetectionRecord> records = result.get();
+			const uint32_t count = job.failed ? detectionReplyError : (uint32_t) records.size();
+			bool ok = writeFully(fd, &count, sizeof(count));
+			if (ok && !records.empty())
+				ok = writeFully(fd, &records[0], records.size() * sizeof(DetectionRecord));
+			recordLatency(ticksToMs(cv::getTickCount() - job.receivedTicks));
+			if (!ok)
+				break;
+		}
+		std::lock_guard<std::mutex> lock(_connectionsMutex);
+		_connectionFds.erase(std::find(_connectionFds.begin(), _connectionFds.end(), fd));
+		close(fd);
+		_connectionClosed.notify_all();
+	}
+
+	void recordLatency(double latencyMs) {
+		std::lock_guard<std::mutex> lock(_statsMutex);
+		_latenciesMs.push_back(latencyMs);
+		++_requests;
+		if (_params.reportInterval > 0 && _latenciesMs.size() >= _params.reportInterval)
+			printStatisticsLocked();
+	}
+
+	// Report the percentiles of the requests since the last report, requires _statsMutex
+	void printStatisticsLocked() {
+		printf("Served %lu requests, last %lu: latency p50 %.2f ms p99 %.2f ms, queue delay p50 %.2f ms p99 %.2f ms\n",
+			_requests, (unsigned long) _latenciesMs.size(),
+			percentile(_latenciesMs, 0.5), percentile(_latenciesMs, 0.99),
+			percentile(_queueDelaysMs, 0.5), percentile(_queueDelaysMs, 0.99));
+		fflush(stdout);
+		_latenciesMs.clear();
+		_queueDelaysMs.clear();
+	}
+
+public:
+	DetectionService(const DetectorModel& model, const DetectionServiceParams& params = DetectionServiceParams()):
+	_params(params), _shutdown(false), _requests(0){
+		model.configure(_hog);
+		_detector = new BlockGridDetector(_hog);
+		_hitThreshold = model.getThreshold();
+		if (_params.workers == 0)
+			_params.workers = std::max(1, cv::getNumberOfCPUs());
+	}
+
+	~DetectionService() {
+		delete _detector;
+	}
+
+	// Serve until SIGINT or SIGTERM, returns false if the socket can not be set up
+	bool run() {
+		int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (listenFd < 0) {
+			perror("socket");
+			return false;
+		}
+		struct sockaddr_un address;
+		memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		strncpy(address.sun_path, _params.socketPath.c_str(), sizeof(address.sun_path) - 1);
+		unlink(_params.socketPath.c_str());
+		if (bind(listenFd, (struct sockaddr*) &address, sizeof(address)) != 0 || listen(listenFd, 64) != 0) {
+			perror("bind");
+			close(listenFd);
+			return false;
+		}
+
+		stopFlag() = false;
+		_shutdown = false;
+		signal(SIGINT, onSignal);
+		signal(SIGTERM, onSignal);
+		// The detection runs on our own pool, avoid oversubscription by OpenCV's internal threads
+		cv::setNumThreads(1);
+
+		std::vector<std::thread> workers;
+		for (unsigned int w = 0; w < _params.workers; ++w)
+			workers.push_back(std::thread(&DetectionService::workerLoop, this));
+		printf("Detection service listening on %s with %u workers\n", _params.socketPath.c_str(), _params.workers);
+		fflush(stdout);
+
+		while (!stopFlag()) {
+			struct pollfd pfd = {listenFd, POLLIN, 0};
+			if (poll(&pfd, 1, 200) <= 0)
+				continue;
+			int fd = accept(listenFd, NULL, NULL);
+			if (fd < 0)
+				continue;
+			std::lock_guard<std::mutex> lock(_connectionsMutex);
+			_connectionFds.push_back(fd);
+			std::thread(&DetectionService::connectionLoop, this, fd).detach();
+		}
+
+		printf("\nShutting down detection service\n");
+		close(listenFd);
+		unlink(_params.socketPath.c_str());
+		{
+			// Unblock readers waiting for the next request, pending requests are still answered
+			std::unique_lock<std::mutex> lock(_connectionsMutex);
+			for (size_t c = 0; c < _connectionFds.size(); ++c)
+				shutdown(_connectionFds[c], SHUT_RD);
+			_connectionClosed.wait(lock, [this] { return _connectionFds.empty(); });
+		}
+		{
+			std::lock_guard<std::mutex> lock(_queueMutex);
+			_shutdown = true;
+		}
+		_queueChanged.notify_all();
+		for (size_t w = 0; w < workers.size(); ++w)
+			workers[w].join();
+
+		std::lock_guard<std::mutex> lock(_statsMutex);
+		printStatisticsLocked();
+		return true;
+	}
+};
+
+#endif
+
+#endif
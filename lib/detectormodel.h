@@ -0,0 +1,243 @@
+#ifndef DETECTORMODEL_H
+#define DETECTORMODEL_H
+
+#include <stdio.h>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstring>
+#include <stdint.h>
+#include <opencv2/opencv.hpp>
+#include "mappedfile.h"
+#include "hash.h"
+
+// Versioned binary file of a trained linear HOG detector. Layout:
+//
+//   DetectorModelHeader
+//   float weights[dimension]    at weightsOffset, 64 byte aligned
+//
+// A window is a detection if  weights * x - bias > threshold.
+// The checksum is the FNV-1a hash of the weights, so a truncated or
+// corrupted file is rejected at load time.
+struct DetectorModelHeader {
+	char magic[4];          // "PDDM"
+	uint32_t version;
+	// HOG geometry
+	int32_t winWidth, winHeight;
+	int32_t blockWidth, blockHeight;
+	int32_t blockStrideX, blockStrideY;
+	int32_t cellWidth, cellHeight;
+	int32_t nbins;
+	int32_t derivAperture;
+	int32_t histogramNormType;
+	int32_t gammaCorrection;
+	int32_t nlevels;
+	double winSigma;
+	double L2HysThreshold;
+	// Linear classifier
+	uint32_t dimension;
+	float bias;
+	float threshold;
+	uint32_t reserved;
+	uint64_t weightsOffset;
+	uint64_t checksum;
+};
+
+static const char detectorModelMagic[4] = {'P', 'D', 'D', 'M'};
+static const uint32_t detectorModelVersion = 1;
+
+// Memory mapped detector model, the weights are used in place.
+class
+DetectorModel{
+private:
+	MappedFile _mapping;
+	const DetectorModelHeader* _header;
+
+public:
+	DetectorModel():
+	_header(NULL){
+	}
+
+	// Map a model file and check header, size and checksum.
+	bool open(const std::string& fileName){
+		_header = NULL;
+		if(!_mapping.open(fileName)){
+			printf("Could not open detector model %s\n", fileName.c_str());
+			return false;
+		}
+		const DetectorModelHeader* header = (const DetectorModelHeader*) _mapping.data();
+		if(_mapping.size() < sizeof(DetectorModelHeader)
+			|| memcmp(header->magic, detectorModelMagic, sizeof(header->magic)) != 0
+			|| header->version != detectorModelVersion
+			|| header->weightsOffset + (uint64_t) header->dimension * sizeof(float) > _mapping.size()){
+			printf("File %s is not a valid detector model\n", fileName.c_str());
+			_mapping.close();
+			return false;
+		}
+		if(fnv1aHash(_mapping.data() + header->weightsOffset, header->dimension * sizeof(float)) != header->checksum){
+			printf("Detector model %s is corrupted, checksum mismatch\n", fileName.c_str());
+			_mapping.close();
+			return false;
+		}
+		_header = header;
+		return true;
+	}
+
+	bool isOpen() const { return _header != NULL; }
+	const DetectorModelHeader& getHeader() const { return *_header; }
+	uint32_t getDimension() const { return _header->dimension; }
+	float getBias() const { return _header->bias; }
+	float getThreshold() const { return _header->threshold; }
+	// Zero-copy access to the weights
+	const float* getWeights() const { return (const float*) (_mapping.data() + _header->weightsOffset); }
+
+	// Set up a HOG descriptor with the stored geometry and detector (weights with -bias appended as rho).
+	void configure(cv::HOGDescriptor& hog) const {
+		hog.winSize = cv::Size(_header->winWidth, _header->winHeight);
+		hog.blockSize = cv::Size(_header->blockWidth, _header->blockHeight);
+		hog.blockStride = cv::Size(_header->blockStrideX, _header->blockStrideY);
+		hog.cellSize = cv::Size(_header->cellWidth, _header->cellHeight);
+		hog.nbins = _header->nbins;
+		hog.derivAperture = _header->derivAperture;
+		hog.histogramNormType = _header->histogramNormType;
+		hog.gammaCorrection = _header->gammaCorrection != 0;
+		hog.nlevels = _header->nlevels;
+		hog.winSigma = _header->winSigma;
+		hog.L2HysThreshold = _header->L2HysThreshold;
+		std::vector<float> detector(getWeights(), getWeights() + getDimension());
+		detector.push_back(-getBias());
+		hog.setSVMDetector(detector);
+	}
+
+	/**
+	 * Write a detector model file
+	 * @param fileName model file
+	 * @param hog HOG descriptor providing the geometry
+	 * @param weights linear weights, one per descriptor component
+	 * @param bias offset of the decision function weights * x - bias
+	 * @param threshold detection threshold on the decision value
+	 */
+	static bool save(const std::string& fileName, const cv::HOGDescriptor& hog, const std::vector<float>& weights, float bias, float threshold){
+		DetectorModelHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, detectorModelMagic, sizeof(header.magic));
+		header.version = detectorModelVersion;
+		header.winWidth = hog.winSize.width;
+		header.winHeight = hog.winSize.height;
+		header.blockWidth = hog.blockSize.width;
+		header.blockHeight = hog.blockSize.height;
+		header.blockStrideX = hog.blockStride.width;
+		header.blockStrideY = hog.blockStride.height;
+		header.cellWidth = hog.cellSize.width;
+		header.cellHeight = hog.cellSize.height;
+		header.nbins = hog.nbins;
+		header.derivAperture = hog.derivAperture;
+		header.histogramNormType = hog.histogramNormType;
+		header.gammaCorrection = hog.gammaCorrection;
+		header.nlevels = hog.nlevels;
+		header.winSigma = hog.winSigma;
+		header.L2HysThreshold = hog.L2HysThreshold;
+		header.dimension = (uint32_t) weights.size();
+		header.bias = bias;
+		header.threshold = threshold;
+		header.weightsOffset = (sizeof(DetectorModelHeader) + 63) / 64 * 64;
+		header.checksum = fnv1aHash(weights.empty() ? NULL : &weights[0], weights.size() * sizeof(float));
+
+		FILE* f = fopen(fileName.c_str(), "wb");
+		if(f == NULL){
+			printf("Could not open file %s for writing\n", fileName.c_str());
+			return false;
+		}
+		std::vector<char> padding(header.weightsOffset - sizeof(header), 0);
+		bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+		ok = ok && (padding.empty() || fwrite(&padding[0], 1, padding.size(), f) == padding.size());
+		ok = ok && (weights.empty() || fwrite(&weights[0], sizeof(float), weights.size(), f) == weights.size());
+		ok = (fclose(f) == 0) && ok;
+		if(!ok) printf("Error writing detector model %s\n", fileName.c_str());
+		return ok;
+	}
+
+	// Export as OpenCV HOG YAML/XML (hog.load compatible). Unlike the files hog.save wrote before the
+	// binary model, svmDetector has -bias appended as rho and the threshold is stored as extra node.
+	bool exportYAML(const std::string& fileName) const {
+		cv::HOGDescriptor hog;
+		configure(hog);
+		cv::FileStorage fs(fileName, cv::FileStorage::WRITE);
+		if(!fs.isOpened()){
+			printf("Could not open file %s for writing\n", fileName.c_str());
+			return false;
+		}
+		hog.write(fs, cv::FileStorage::getDefaultObjectName(fileName));
+		fs << "detectionThreshold" << getThreshold();
+		return true;
+	}
+
+	// Export the weights as descriptor vector text file, space separated, with -bias appended as in svmDetector
+	bool exportText(const std::string& fileName) const {
+		std::fstream File;
+		File.open(fileName.c_str(), std::ios::out);
+		if(!File.good() || !File.is_open()){
+			printf("Could not open file %s for writing\n", fileName.c_str());
+			return false;
+		}
+		for(uint32_t feature = 0; feature < getDimension(); ++feature){
+			File << getWeights()[feature] << " ";
+		}
+		File << -getBias() << std::endl;
+		return File.good();
+	}
+
+	/**
+	 * Convert an OpenCV HOG YAML/XML file (e.g. from hog.save) to a binary model
+	 * @param bias used if svmDetector has no rho appended
+	 * @param threshold used if the file has no detectionThreshold node
+	 */
+	static bool importYAML(const std::string& yamlFileName, float bias, float threshold, const std::string& fileName){
+		cv::HOGDescriptor hog;
+		if(!hog.load(yamlFileName)){
+			printf("Could not load HOG descriptor from %s\n", yamlFileName.c_str());
+			return false;
+		}
+		std::vector<float> weights = hog.svmDetector;
+		if(weights.size() == hog.getDescriptorSize() + 1){
+			bias = -weights.back();
+			weights.pop_back();
+		}else{
+			printf("Warning: Detector in %s has no bias component, using bias %g\n", yamlFileName.c_str(), bias);
+		}
+		cv::FileStorage fs(yamlFileName, cv::FileStorage::READ);
+		if(fs.isOpened() && !fs["detectionThreshold"].empty())
+			threshold = (float) fs["detectionThreshold"];
+		return save(fileName, hog, weights, bias, threshold);
+	}
+
+	/**
+	 * Convert a descriptor vector text file to a binary model, the geometry comes from hog
+	 * @param bias used if the vector has no -bias appended
+	 * @param threshold detection threshold of the model
+	 */
+	static bool importText(const std::string& textFileName, const cv::HOGDescriptor& hog, float bias, float threshold, const std::string& fileName){
+		std::ifstream File(textFileName.c_str());
+		if(!File.is_open()){
+			printf("Could not open file %s for reading\n", textFileName.c_str());
+			return false;
+		}
+		std::vector<float> weights;
+		float weight;
+		while(File >> weight)
+			weights.push_back(weight);
+		if(weights.size() == hog.getDescriptorSize() + 1){
+			bias = -weights.back();
+			weights.pop_back();
+		}else if(weights.size() == hog.getDescriptorSize()){
+			printf("Warning: Descriptor vector in %s has no bias component, using bias %g\n", textFileName.c_str(), bias);
+		}
+		if(weights.size() != hog.getDescriptorSize()){
+			printf("Descriptor vector in %s has %lu components, expected %lu\n", textFileName.c_str(), (unsigned long) weights.size(), (unsigned long) hog.getDescriptorSize());
+			return false;
+		}
+		return save(fileName, hog, weights, bias, threshold);
+	}
+};
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef DETECTORSET_H
+#define DETECTORSET_H
+
+#include <stdio.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <stdint.h>
+#include <opencv2/opencv.hpp>
+#include "blockgriddetector.h"
+
+// Detections and cost of one model of a DetectorSet
+struct DetectorSetResult {
+	std::string name;
+	std::vector<cv::Rect> found;
+	std::vector<double> foundWeights;
+	unsigned long windowsEvaluated;
+	double scoringMs;     // summed over levels, levels run in parallel
+};
+
+// Several linear HOG detectors evaluated on one shared pyramid. The models
+// may differ in window size and weights (e.g. 48x96 and 64x128, day and
+// night variants) but must have the same block geometry, normalisation and
+// gradient settings. Every pyramid level is resized and its block grid is
+// computed once, then each model scores its weight slices over that grid.
+// A model only scans the levels its window fits into, so its detections are
+// those of its own BlockGridDetector::detectMultiScale. Region of interest
+// and ground plane constraints of the models are not applied.
+class
+DetectorSet{
+private:
+	struct Member {
+		std::string name;
+		BlockGridDetector* detector;
+		double hitThreshold;
+	};
+
+	std::vector<Member> _members;
+
+	DetectorSet(const DetectorSet&);
+	DetectorSet& operator=(const DetectorSet&);
+
+public:
+	DetectorSet() {
+	}
+
+	~DetectorSet() {
+		for (size_t m = 0; m < _members.size(); ++m)
+			delete _members[m].detector;
+	}
+
+	/**
+	 * Adds a model
+	 * @param name reported with the results
+	 * @param hog geometry and detector (svmDetector, optionally with rho appended)
+	 * @param hitThreshold detection threshold of the model
+	 * @return false if its block grid differs from the models already added
+	 */
+	bool add(const std::string& name, const cv::HOGDescriptor& hog, double hitThreshold) {
+		BlockGridDetector* detector = new BlockGridDetector(hog);
+		if (!_members.empty() && !_members[0].detector->sharesBlockGrid(*detector)) {
+			printf("Error: Detector %s does not share the block geometry of %s!\n", name.c_str(), _members[0].name.c_str());
+			delete detector;
+			return false;
+		}
+		Member member = {name, detector, hitThreshold};
+		_members.push_back(member);
+		return true;
+	}
+
+	size_t size() const { return _members.size(); }
+
+	/**
+	 * Runs all models on an image
+	 * @param results receives one result per model, in the order added
+	 * @param winStride window stride, a multiple of the block stride
+	 * @param gridMs optional, receives the time spent on the shared pyramid and block grids summed over levels
+	 */
+	void detectMultiScale(const cv::Mat& image, std::vector<DetectorSetResult>& results, cv::Size winStride = cv::Size(8, 8),
+		cv::Size padding = cv::Size(0, 0), double scale0 = 1.05, double finalThreshold = 2.0, double* gridMs = NULL) const {
+		const int models = (int) _members.size();
+		results.assign(models, DetectorSetResult());
+		if (models == 0)
+			return;
+		for (int m = 0; m < models; ++m)
+			results[m].name = _members[m].name;
+
+		// The pyramid of the smallest window has every level of the larger ones
+		int smallest = 0;
+		for (int m = 1; m < models; ++m) {
+			if (_members[m].detector->getDescriptor().winSize.area() < _members[smallest].detector->getDescriptor().winSize.area())
+				smallest = m;
+		}
+		const std::vector<double> scales = _members[smallest].detector->levelScales(image.size(), scale0);
+		const int levels = (int) scales.size();
+		// Per level and model
+		std::vector<std::vector<cv::Rect> > levelFound(levels * models);
+		std::vector<std::vector<double> > levelWeights(levels * models);
+		std::vector<unsigned long> levelWindows(levels * models, 0);
+		std::vector<double> levelScoringMs(levels * models, 0.);
+		std::vector<double> levelGridMs(levels, 0.);
+
+		cv::parallel_for_(cv::Range(0, levels), [&](const cv::Range& range) {
+			for (int level = range.start; level < range.end; ++level) {
+				const double scale = scales[level];
+				const cv::Size size(cvRound(image.cols / scale), cvRound(image.rows / scale));
+				int64_t start = cv::getTickCount();
+				cv::Mat levelImage = image;
+				if (size != image.size())
+					cv::resize(image, levelImage, size, 0, 0, cv::INTER_LINEAR);
+				BlockGrid grid;
+				_members[smallest].detector->computeBlockGrid(levelImage, padding, grid);
+				int64_t done = cv::getTickCount();
+				levelGridMs[level] = (done - start) * 1000. / cv::getTickFrequency();
+
+				for (int m = 0; m < models; ++m) {
+					const cv::Size winSize = _members[m].detector->getDescriptor().winSize;
+					if (level > 0 && (size.width < winSize.width || size.height < winSize.height))
+						continue;
+					start = done;
+					const int i = level * models + m;
+					levelWindows[i] = _members[m].detector->scoreLevel(grid, scale, _members[m].hitThreshold, winStride, levelFound[i], levelWeights[i]);
+					done = cv::getTickCount();
+					levelScoringMs[i] = (done - start) * 1000. / cv::getTickFrequency();
+				}
+			}
+		});
+
+		if (gridMs)
+			*gridMs = 0.;
+		for (int level = 0; level < levels; ++level) {
+			if (gridMs)
+				*gridMs += levelGridMs[level];
+			for (int m = 0; m < models; ++m) {
+				const int i = level * models + m;
+				DetectorSetResult& result = results[m];
+				result.found.insert(result.found.end(), levelFound[i].begin(), levelFound[i].end());
+				result.foundWeights.insert(result.foundWeights.end(), levelWeights[i].begin(), levelWeights[i].end());
+				result.windowsEvaluated += levelWindows[i];
+				result.scoringMs += levelScoringMs[i];
+			}
+		}
+		for (int m = 0; m < models; ++m)
+			_members[m].detector->getDescriptor().groupRectangles(results[m].found, results[m].foundWeights, (int) finalThreshold, 0.2);
+	}
+};
+
+#endif
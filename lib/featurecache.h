@@ -0,0 +1,271 @@
+#ifndef FEATURECACHE_H
+#define FEATURECACHE_H
+
+#include <stdio.h>
+#include <vector>
+#include <string>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <algorithm>
+#include <sstream>
+#include <cstring>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <opencv2/opencv.hpp>
+#include "hash.h"
+#if defined(_WIN32) || defined(_WIN64)
+  #include <direct.h>
+#endif
+
+// Persistent cache of HOG feature vectors. Entries are addressed by the hash
+// of the image file content combined with every HOG parameter that affects
+// the result, so changed images or parameters never return stale features
+// and renamed or copied images still hit.
+//
+// Each entry is stored as raw float file in the cache directory; the index
+// with sizes and last use is kept in memory and written back on flush().
+// Once the total size exceeds the cap the least recently used entries are
+// evicted. All methods are thread-safe.
+class
+FeatureCache{
+private:
+	struct Entry {
+		uint64_t bytes;
+		uint64_t lastUse;
+	};
+
+	std::string _directory;
+	uint64_t _maxBytes;
+	uint64_t _parameterHash;
+	std::map<uint64_t, Entry> _entries;
+	uint64_t _totalBytes;
+	uint64_t _useCounter;
+	bool _dirty;
+	mutable std::mutex _mutex;
+
+	// Counters
+	unsigned long _hits, _misses, _inserts, _evictions;
+
+	static const uint32_t indexVersion = 1;
+
+	std::string entryFilename(uint64_t key) const {
+		char name[32];
+		snprintf(name, sizeof(name), "%016llx.hog", (unsigned long long) key);
+		return _directory + name;
+	}
+
+	std::string indexFilename() const {
+		return _directory + "index.dat";
+	}
+
+	void loadIndex() {
+		FILE* f = fopen(indexFilename().c_str(), "rb");
+		if (f == NULL)
+			return;
+		char magic[4];
+		uint32_t version = 0;
+		uint64_t count = 0;
+		if (fread(magic, 1, 4, f) == 4 && memcmp(magic, "PDFC", 4) == 0
+			&& fread(&version, sizeof(version), 1, f) == 1 && version == indexVersion
+			&& fread(&count, sizeof(count), 1, f) == 1) {
+			for (uint64_t i = 0; i < count; ++i) {
+				uint64_t record[3]; // key, bytes, last use
+				if (fread(record, sizeof(record), 1, f) != 1)
+					break;
+				Entry entry = {record[1], record[2]};
+				_entries[record[0]] = entry;
+				_totalBytes += entry.bytes;
+				_useCounter = std::max(_useCounter, entry.lastUse + 1);
+			}
+		} else {
+			printf("Ignoring invalid feature cache index %s\n", indexFilename().c_str());
+		}
+		fclose(f);
+	}
+
+	// Remove least recently used entries once the cache exceeds its cap, requires the lock.
+	// Evicts down to 90% of the cap so that not every following insert has to evict again.
+	void evict() {
+		if (_totalBytes <= _maxBytes)
+			return;
+		std::vector<std::pair<uint64_t, uint64_t> > byLastUse; // last use, key
+		byLastUse.reserve(_entries.size());
+		for (std::map<uint64_t, Entry>::const_iterator it = _entries.begin(); it != _entries.end(); ++it)
+			byLastUse.push_back(std::make_pair(it->second.lastUse, it->first));
+		std::sort(byLastUse.begin(), byLastUse.end());
+		const uint64_t target = _maxBytes / 10 * 9;
+		for (size_t i = 0; i < byLastUse.size() && _totalBytes > target; ++i) {
+			std::map<uint64_t, Entry>::iterator it = _entries.find(byLastUse[i].second);
+			remove(entryFilename(it->first).c_str());
+			_totalBytes -= it->second.bytes;
+			_entries.erase(it);
+			++_evictions;
+		}
+		_dirty = true;
+	}
+
+	FeatureCache(const FeatureCache&);
+	FeatureCache& operator=(const FeatureCache&);
+
+public:
+	/**
+	 * Opens (or creates) the cache in a directory
+	 * @param directory cache directory, created if missing
+	 * @param maxBytes size cap of all cached feature vectors
+	 * @param hog HOG descriptor the features are computed with
+	 * @param winStride window stride used for hog.compute
+	 * @param padding padding used for hog.compute
+	 */
+	FeatureCache(const std::string& directory, uint64_t maxBytes, const cv::HOGDescriptor& hog, const cv::Size& winStride, const cv::Size& padding):
+	_directory(directory), _maxBytes(maxBytes), _totalBytes(0), _useCounter(0), _dirty(false),
+	_hits(0), _misses(0), _inserts(0), _evictions(0){
+		if (!_directory.empty() && _directory[_directory.size() - 1] != '/')
+			_directory += '/';
+#if defined(_WIN32) || defined(_WIN64)
+		_mkdir(_directory.c_str());
+#else
+		mkdir(_directory.c_str(), 0755);
+#endif
+		std::ostringstream parameters;
+		parameters << hog.winSize.width << "x" << hog.winSize.height << " " << hog.blockSize.width << "x" << hog.blockSize.height
+			<< " " << hog.blockStride.width << "x" << hog.blockStride.height << " " << hog.cellSize.width << "x" << hog.cellSize.height
+			<< " " << hog.nbins << " " << hog.derivAperture << " " << hog.winSigma << " " << hog.histogramNormType
+			<< " " << hog.L2HysThreshold << " " << hog.gammaCorrection << " " << hog.nlevels << " " << hog.signedGradient
+			<< " " << winStride.width << "x" << winStride.height << " " << padding.width << "x" << padding.height;
+		const std::string parameterString = parameters.str();
+		_parameterHash = fnv1aHash(parameterString.data(), parameterString.size());
+		loadIndex();
+		evict();
+	}
+
+	~FeatureCache() {
+		flush();
+	}
+
+	// Cache key of an image given its encoded file content
+	uint64_t key(const std::vector<unsigned char>& fileContent) const {
+		uint64_t hash = fnv1aHash(&_parameterHash, sizeof(_parameterHash));
+		return fnv1aHash(fileContent.empty() ? NULL : &fileContent[0], fileContent.size(), hash);
+	}
+
+	/**
+	 * Look up a feature vector
+	 * @return true on a cache hit, featureVector then holds the cached features
+	 */
+	bool lookup(uint64_t key, std::vector<float>& featureVector) {
+		uint64_t bytes = 0;
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			std::map<uint64_t, Entry>::iterator it = _entries.find(key);
+			if (it == _entries.end()) {
+				++_misses;
+				return false;
+			}
+			it->second.lastUse = _useCounter++;
+			bytes = it->second.bytes;
+			_dirty = true;
+		}
+		featureVector.resize(bytes / sizeof(float));
+		FILE* f = fopen(entryFilename(key).c_str(), "rb");
+		const bool ok = f != NULL && (featureVector.empty() || fread(&featureVector[0], 1, bytes, f) == bytes);
+		if (f != NULL)
+			fclose(f);
+
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (!ok) {
+			// Entry file vanished or is truncated, forget it
+			std::map<uint64_t, Entry>::iterator it = _entries.find(key);
+			if (it != _entries.end()) {
+				_totalBytes -= it->second.bytes;
+				_entries.erase(it);
+			}
+			featureVector.clear();
+			++_misses;
+			return false;
+		}
+		++_hits;
+		return true;
+	}
+
+	// Add a feature vector to the cache, evicting old entries if necessary
+	void insert(uint64_t key, const std::vector<float>& featureVector) {
+		const uint64_t bytes = featureVector.size() * sizeof(float);
+		if (bytes == 0 || bytes > _maxBytes)
+			return;
+		// Write to a temporary name first so concurrent readers never see a partial entry
+		std::ostringstream tmpName;
+		tmpName << entryFilename(key) << "." << std::this_thread::get_id() << ".tmp";
+		FILE* f = fopen(tmpName.str().c_str(), "wb");
+		if (f == NULL)
+			return;
+		const bool ok = fwrite(&featureVector[0], 1, bytes, f) == bytes;
+		if (fclose(f) != 0 || !ok || rename(tmpName.str().c_str(), entryFilename(key).c_str()) != 0) {
+			remove(tmpName.str().c_str());
+			return;
+		}
+
+		std::lock_guard<std::mutex> lock(_mutex);
+		std::map<uint64_t, Entry>::iterator it = _entries.find(key);
+		if (it != _entries.end())
+			_totalBytes -= it->second.bytes;
+		Entry entry = {bytes, _useCounter++};
+		_entries[key] = entry;
+		_totalBytes += bytes;
+		++_inserts;
+		_dirty = true;
+		evict();
+	}
+
+	// Write the index back to disk
+	void flush() {
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (!_dirty)
+			return;
+		const std::string tmpName = indexFilename() + ".tmp";
+		FILE* f = fopen(tmpName.c_str(), "wb");
+		if (f == NULL) {
+			printf("Could not open file %s for writing\n", tmpName.c_str());
+			return;
+		}
+		const uint32_t version = indexVersion;
+		const uint64_t count = _entries.size();
+		bool ok = fwrite("PDFC", 1, 4, f) == 4 && fwrite(&version, sizeof(version), 1, f) == 1 && fwrite(&count, sizeof(count), 1, f) == 1;
+		for (std::map<uint64_t, Entry>::const_iterator it = _entries.begin(); ok && it != _entries.end(); ++it) {
+			const uint64_t record[3] = {it->first, it->second.bytes, it->second.lastUse};
+			ok = fwrite(record, sizeof(record), 1, f) == 1;
+		}
+		ok = (fclose(f) == 0) && ok;
+		if (ok && rename(tmpName.c_str(), indexFilename().c_str()) == 0) {
+			_dirty = false;
+		} else {
+			printf("Error writing feature cache index %s\n", indexFilename().c_str());
+			remove(tmpName.c_str());
+		}
+	}
+
+	void printStatistics() {
+		std::lock_guard<std::mutex> lock(_mutex);
+		const unsigned long lookups = _hits + _misses;
+		printf("Feature cache: %lu hits, %lu misses (%.1f%% hit rate), %lu inserts, %lu evictions, %lu entries, %.1f of %.1f MB\n",
+			_hits, _misses, lookups ? 100. * _hits / lookups : 0., _inserts, _evictions, (unsigned long) _entries.size(),
+			_totalBytes / 1048576., _maxBytes / 1048576.);
+	}
+
+	unsigned long getHits() const {
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _hits;
+	}
+
+	unsigned long getMisses() const {
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _misses;
+	}
+
+	unsigned long getEvictions() const {
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _evictions;
+	}
+};
+
+#endif
@@ -0,0 +1,279 @@
+#ifndef FEATURESTORE_H
+#define FEATURESTORE_H
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <opencv2/opencv.hpp>
+#include "mappedfile.h"
+#include "trace.h"
+
+// Binary store for labelled feature vectors, replacing the SVMlight text
+// format for the training features. Layout (little endian):
+//
+//   FeatureStoreHeader
+//   float labels[count]                   at labelsOffset
+//   float features[count][dimension]      at dataOffset, row-major
+//
+// Both arrays are 64 byte aligned so the file can be mmap'ed and used in
+// place without any parsing or copying. Every write of a store gets a new
+// generation, so an image database referencing its rows can tell whether
+// the store was rewritten since.
+struct FeatureStoreHeader {
+	char magic[4];          // "PDFS"
+	uint32_t version;
+	uint32_t dimension;     // floats per feature vector
+	uint32_t count;         // number of stored vectors
+	uint64_t labelsOffset;
+	uint64_t dataOffset;
+	// HOG parameters the features were computed with
+	int32_t winWidth, winHeight;
+	int32_t blockWidth, blockHeight;
+	int32_t blockStrideX, blockStrideY;
+	int32_t cellWidth, cellHeight;
+	int32_t nbins;
+	int32_t winStrideX, winStrideY;
+	int32_t paddingX, paddingY;
+	uint32_t reserved[2];
+	uint32_t generation;    // nonzero id of this write of the store, 0 in stores written before
+};
+
+static const char featureStoreMagic[4] = {'P', 'D', 'F', 'S'};
+static const uint32_t featureStoreVersion = 1;
+static const uint64_t featureStoreAlignment = 64;
+
+static inline bool seekFeatureStore(FILE* file, uint64_t offset) {
+#if defined(_WIN32) || defined(_WIN64)
+	return _fseeki64(file, (__int64) offset, SEEK_SET) == 0;
+#else
+	return fseeko(file, (off_t) offset, SEEK_SET) == 0;
+#endif
+}
+
+static inline uint64_t alignFeatureStoreOffset(uint64_t offset) {
+	return (offset + featureStoreAlignment - 1) / featureStoreAlignment * featureStoreAlignment;
+}
+
+// Nonzero id for a newly written store
+static inline uint32_t newFeatureStoreGeneration() {
+	const uint64_t ticks = (uint64_t) cv::getTickCount();
+	const uint32_t generation = (uint32_t) (ticks ^ (ticks >> 32));
+	return generation != 0 ? generation : 1;
+}
+
+// Fills the HOG related fields of a store header
+static inline void setFeatureStoreHogParameters(FeatureStoreHeader& header, const cv::HOGDescriptor& hog, const cv::Size& winStride, const cv::Size& padding) {
+	header.winWidth = hog.winSize.width;
+	header.winHeight = hog.winSize.height;
+	header.blockWidth = hog.blockSize.width;
+	header.blockHeight = hog.blockSize.height;
+	header.blockStrideX = hog.blockStride.width;
+	header.blockStrideY = hog.blockStride.height;
+	header.cellWidth = hog.cellSize.width;
+	header.cellHeight = hog.cellSize.height;
+	header.nbins = hog.nbins;
+	header.winStrideX = winStride.width;
+	header.winStrideY = winStride.height;
+	header.paddingX = padding.width;
+	header.paddingY = padding.height;
+}
+
+// Streams feature vectors into a new store. The label array is sized for
+// the announced capacity, so vectors can be appended without knowing the
+// final count in advance (e.g. when some images fail to load). The store is
+// written under a temporary name and replaces an existing file on close,
+// so the old store can still be read while the new one is written.
+class
+FeatureStoreWriter{
+private:
+	FILE* _file;
+	FeatureStoreHeader _header;
+	std::vector<float> _labels;
+	uint32_t _capacity;
+	std::string _fileName;
+
+	FeatureStoreWriter(const FeatureStoreWriter&);
+	FeatureStoreWriter& operator=(const FeatureStoreWriter&);
+
+public:
+	FeatureStoreWriter():
+	_file(NULL), _capacity(0){
+	}
+
+	~FeatureStoreWriter(){
+		close();
+	}
+
+	// Create the store file for at most capacity vectors of the given HOG descriptor.
+	bool open(const std::string& fileName, const cv::HOGDescriptor& hog, const cv::Size& winStride, const cv::Size& padding, uint32_t capacity){
+		close();
+		_fileName = fileName;
+		const std::string tmpName = fileName + ".tmp";
+		_file = fopen(tmpName.c_str(), "wb");
+		if(_file == NULL){
+			printf("Could not open file %s for writing\n", tmpName.c_str());
+			return false;
+		}
+		memset(&_header, 0, sizeof(_header));
+		memcpy(_header.magic, featureStoreMagic, sizeof(_header.magic));
+		_header.version = featureStoreVersion;
+		_header.generation = newFeatureStoreGeneration();
+		_header.dimension = (uint32_t) hog.getDescriptorSize();
+		_header.count = 0;
+		_header.labelsOffset = alignFeatureStoreOffset(sizeof(FeatureStoreHeader));
+		_header.dataOffset = alignFeatureStoreOffset(_header.labelsOffset + (uint64_t) capacity * sizeof(float));
+		setFeatureStoreHogParameters(_header, hog, winStride, padding);
+		_capacity = capacity;
+		_labels.clear();
+		_labels.reserve(capacity);
+		// Rows are appended sequentially starting at the data offset
+		return seekFeatureStore(_file, _header.dataOffset);
+	}
+
+	// Append one feature vector, must match the store dimension.
+	bool append(float label, const std::vector<float>& featureVector){
+		if(_file == NULL || featureVector.size() != _header.dimension || _labels.size() >= _capacity){
+			return false;
+		}
+		if(fwrite(&featureVector[0], sizeof(float), featureVector.size(), _file) != featureVector.size()){
+			printf("Error writing feature vector to %s\n", _fileName.c_str());
+			return false;
+		}
+		_labels.push_back(label);
+		return true;
+	}
+
+	// Write labels and the final header and replace the store file, returns false on I/O errors.
+	bool close(){
+		if(_file == NULL) return true;
+		_header.count = (uint32_t) _labels.size();
+		bool ok = seekFeatureStore(_file, _header.labelsOffset);
+		if(ok && !_labels.empty())
+			ok = fwrite(&_labels[0], sizeof(float), _labels.size(), _file) == _labels.size();
+		ok = ok && seekFeatureStore(_file, 0);
+		ok = ok && fwrite(&_header, sizeof(_header), 1, _file) == 1;
+		ok = (fclose(_file) == 0) && ok;
+		_file = NULL;
+		// Mappings of the old file stay valid after the rename
+		const std::string tmpName = _fileName + ".tmp";
+		if(!ok || rename(tmpName.c_str(), _fileName.c_str()) != 0){
+			remove(tmpName.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	uint32_t getCount() const { return (uint32_t) _labels.size(); }
+	uint32_t getDimension() const { return _header.dimension; }
+	uint32_t getGeneration() const { return _header.generation; }
+};
+
+// Read-only, memory mapped access to a feature store.
+class
+FeatureStore{
+private:
+	MappedFile _mapping;
+	const FeatureStoreHeader* _header;
+
+public:
+	FeatureStore():
+	_header(NULL){
+	}
+
+	FeatureStore(const std::string& fileName):
+	_header(NULL){
+		open(fileName);
+	}
+
+	// Map a store file and validate its header.
+	bool open(const std::string& fileName){
+		_header = NULL;
+		if(!_mapping.open(fileName)){
+			printf("Could not open feature store %s\n", fileName.c_str());
+			return false;
+		}
+		const FeatureStoreHeader* header = (const FeatureStoreHeader*) _mapping.data();
+		if(_mapping.size() < sizeof(FeatureStoreHeader)
+			|| memcmp(header->magic, featureStoreMagic, sizeof(header->magic)) != 0
+			|| header->version != featureStoreVersion
+			|| header->labelsOffset + (uint64_t) header->count * sizeof(float) > header->dataOffset
+			|| header->dataOffset + (uint64_t) header->count * header->dimension * sizeof(float) > _mapping.size()){
+			printf("File %s is not a valid feature store\n", fileName.c_str());
+			_mapping.close();
+			return false;
+		}
+		_header = header;
+		return true;
+	}
+
+	bool isOpen() const { return _header != NULL; }
+	const FeatureStoreHeader& getHeader() const { return *_header; }
+	uint32_t getCount() const { return _header->count; }
+	uint32_t getDimension() const { return _header->dimension; }
+	uint32_t getGeneration() const { return _header->generation; }
+
+	// Zero-copy access into the mapping
+	const float* getLabels() const { return (const float*) (_mapping.data() + _header->labelsOffset); }
+	const float* getFeatures() const { return (const float*) (_mapping.data() + _header->dataOffset); }
+	float getLabel(uint32_t idx) const { return getLabels()[idx]; }
+	const float* getRow(uint32_t idx) const { return getFeatures() + (size_t) idx * _header->dimension; }
+
+	// Matrix header (count x dimension) over the mapped features, no data is copied.
+	cv::Mat getFeatureMatrix() const {
+		return cv::Mat(_header->count, _header->dimension, CV_32FC1, (void*) getFeatures());
+	}
+
+	// Check that the store was computed with the given HOG parameters
+	bool matches(const cv::HOGDescriptor& hog, const cv::Size& winStride, const cv::Size& padding) const {
+		FeatureStoreHeader expected;
+		setFeatureStoreHogParameters(expected, hog, winStride, padding);
+		return memcmp(&expected.winWidth, &_header->winWidth, (const char*) &expected.reserved - (const char*) &expected.winWidth) == 0;
+	}
+
+	// Export the store in SVMlight text format, one "<label> idx:val ..." line per vector.
+	bool exportSvmlight(const std::string& fileName, const std::string& comment = std::string()) const {
+		PD_TRACE_SCOPE("FeatureStore::exportSvmlight");
+		std::fstream File;
+		File.open(fileName.c_str(), std::ios::out);
+		if(!File.good() || !File.is_open()){
+			printf("Could not open file %s for writing\n", fileName.c_str());
+			return false;
+		}
+		if(!comment.empty())
+			File << "# " << comment << std::endl;
+		for(uint32_t sample = 0; sample < getCount(); ++sample){
+			const float* row = getRow(sample);
+			File << (getLabel(sample) > 0 ? "+1" : "-1");
+			for(uint32_t feature = 0; feature < getDimension(); ++feature){
+				File << " " << (feature + 1) << ":" << row[feature];
+			}
+			File << std::endl;
+		}
+		File.flush();
+		return File.good();
+	}
+};
+
+/**
+ * Feeds all vectors of a feature store to a trainer as training examples,
+ * straight from the mapping without any text parsing
+ * @param fileName feature store file
+ * @param trainer any trainer with reserve_examples, add_example and getExampleCount (SVMlight, LinearSVM)
+ * @return false if the store could not be opened
+ */
+template <class Trainer>
+static bool readFeatureStore(const std::string& fileName, Trainer& trainer) {
+	PD_TRACE_SCOPE("readFeatureStore");
+	FeatureStore store;
+	if(!store.open(fileName))
+		return false;
+	trainer.reserve_examples(trainer.getExampleCount() + store.getCount());
+	for(uint32_t doc = 0; doc < store.getCount(); ++doc)
+		trainer.add_example(store.getLabel(doc), store.getRow(doc), store.getDimension());
+	return true;
+}
+
+#endif
@@ -0,0 +1,253 @@
+#ifndef HARDNEGATIVEMINER_H
+#define HARDNEGATIVEMINER_H
+
+#include <stdio.h>
+#include <vector>
+#include <string>
+#include <atomic>
+#include <algorithm>
+#include <stdint.h>
+#include <limits>
+#include <opencv2/opencv.hpp>
+#include "orderedpipeline.h"
+#include "blockgriddetector.h"
+#include "trace.h"
+
+// Limits and settings of one mining round
+struct HardNegativeMiningParams {
+	// Windows scoring above -margin are mined, i.e. every negative window
+	// that still costs hinge loss for margin = 1, only false positives for 0
+	double margin;
+	// Stop the round after this many mined windows (0 = unlimited)
+	unsigned int maxMined;
+	// Stop the round after this many seconds (0 = unlimited)
+	double maxSeconds;
+	// Pyramid scale factor and maximum number of levels, as in detectMultiScale
+	double scale0;
+	int nlevels;
+	cv::Size winStride;
+	// Worker threads, 0 = one per CPU core
+	unsigned int threads;
+
+	HardNegativeMiningParams():
+	margin(1.0), maxMined(10000), maxSeconds(600.), scale0(1.05), nlevels(64), winStride(8, 8), threads(0){
+	}
+};
+
+// Statistics of one mining round
+struct HardNegativeMiningStats {
+	unsigned long imagesScanned;
+	unsigned long windowsEvaluated;
+	unsigned long windowsMined;
+	double seconds;
+	bool limitReached;
+};
+
+// A window scoring above the margin
+struct MinedWindow {
+	float score;
+	int level;
+	cv::Point window;                           // column and row in the window grid of the level
+	std::vector<float> descriptor;
+};
+
+// Windows mined from one image, by descending score
+struct MinedWindows {
+	bool scanned;                               // false if the image was skipped or not read
+	std::vector<MinedWindow> windows;
+};
+
+// Scans full negative images with the current linear detector and collects
+// the descriptors of the windows scoring above the margin, for bootstrapping
+// the next training round. Every image is decoded once and the normalised
+// block grid of each pyramid level is computed once by the BlockGridDetector
+// and shared by all overlapping windows: the windows are scored on the grid
+// and the mined descriptors are gathered from its blocks, nothing is
+// recomputed. Requires the window stride to be a multiple of the block stride.
+//
+// An image keeps only its highest scoring windows, at most as many as the
+// round may still mine, and only those get a descriptor; the levels of an
+// image are no longer scanned once the budget is used up.
+//
+// The images are processed in parallel but collected in input order, so a
+// round stopped by the count limit always yields the same windows: the
+// budget only shrinks, so an image always keeps at least the windows it
+// contributes when it is collected.
+class
+HardNegativeMiner : public OrderedPipeline<MinedWindows>{
+private:
+	const cv::HOGDescriptor& _hog;
+	const std::vector<float>& _detector;
+	BlockGridDetector _engine;
+	HardNegativeMiningParams _params;
+	const std::vector<std::string>* _images;
+	std::vector<std::vector<float> >* _mined;
+	std::atomic<bool> _stop;
+	std::atomic<size_t> _remaining;             // windows the round may still mine
+	std::atomic<unsigned long> _windowsEvaluated;
+	int64_t _startTicks;
+	HardNegativeMiningStats _stats;
+
+	// Geometry of hog with the detector and its bias as rho, scored as w * x - bias
+	static cv::HOGDescriptor detectorDescriptor(const cv::HOGDescriptor& hog, const std::vector<float>& detector, float bias) {
+		cv::HOGDescriptor descriptor;
+		hog.copyTo(descriptor);
+		descriptor.svmDetector = detector;
+		descriptor.svmDetector.push_back(-bias);
+		return descriptor;
+	}
+
+	double elapsedSeconds() const {
+		return (cv::getTickCount() - _startTicks) / cv::getTickFrequency();
+	}
+
+	// Higher score first, ties in scan order so the selection does not depend on timing
+	static bool before(const MinedWindow& a, const MinedWindow& b) {
+		if (a.score != b.score) return a.score > b.score;
+		if (a.level != b.level) return a.level < b.level;
+		if (a.window.y != b.window.y) return a.window.y < b.window.y;
+		return a.window.x < b.window.x;
+	}
+
+	/**
+	 * Scores the windows of a level and merges those above the margin into the best windows of the image
+	 * @param budget most windows to keep
+	 * @param mined best windows of the image, by descending score
+	 */
+	void scanLevel(const cv::Mat& level, int levelIdx, size_t budget, std::vector<MinedWindow>& mined) {
+		const cv::Size stride = _params.winStride;
+		BlockGrid grid;
+		cv::Mat scores;
+		_engine.computeBlockGrid(level, cv::Size(0, 0), grid);
+		_engine.scoreWindows(grid, stride, scores);
+		// Only windows that can still enter the kept set become candidates
+		const float threshold = mined.size() < budget ? (float) -_params.margin : std::max((float) -_params.margin, mined.back().score);
+		std::vector<MinedWindow> candidates;
+		for (int wy = 0; wy < scores.rows && !_stop; ++wy) {
+			const float* row = scores.ptr<float>(wy);
+			for (int wx = 0; wx < scores.cols; ++wx) {
+				if (row[wx] > threshold) {
+					candidates.push_back(MinedWindow());
+					candidates.back().score = row[wx];
+					candidates.back().level = levelIdx;
+					candidates.back().window = cv::Point(wx, wy);
+				}
+			}
+			_windowsEvaluated += scores.cols;
+		}
+		if (candidates.size() > budget) {
+			std::nth_element(candidates.begin(), candidates.begin() + budget, candidates.end(), before);
+			candidates.resize(budget);
+		}
+		const int dimension = (int) _detector.size();
+		for (size_t c = 0; c < candidates.size(); ++c) {
+			candidates[c].descriptor.resize(dimension);
+			_engine.windowDescriptor(grid, stride, candidates[c].window, &candidates[c].descriptor[0]);
+			mined.push_back(MinedWindow());
+			std::swap(mined.back(), candidates[c]);
+		}
+		std::sort(mined.begin(), mined.end(), before);
+		if (mined.size() > budget)
+			mined.resize(budget);
+	}
+
+protected:
+	void process(size_t item, MinedWindows& mined) {
+		mined.scanned = false;
+		mined.windows.clear();
+		if (_stop || _remaining == 0)
+			return;
+		if (_params.maxSeconds > 0 && elapsedSeconds() > _params.maxSeconds) {
+			_stop = true;
+			return;
+		}
+		PD_TRACE_SCOPE("mining image");
+		const std::string& imageFilename = (*_images)[item];
+		cv::Mat image;
+		{
+			PD_TRACE_SCOPE("decode");
+			image = cv::imread(imageFilename, cv::IMREAD_GRAYSCALE);
+		}
+		if (image.empty()) {
+			printf("Error: Negative image '%s' could not be read, skipped!\n", imageFilename.c_str());
+			return;
+		}
+		double scale = 1.;
+		for (int levelIdx = 0; levelIdx < _params.nlevels && !_stop; ++levelIdx, scale *= _params.scale0) {
+			// Images collected before this one may have used up the budget meanwhile
+			const size_t budget = _remaining;
+			if (budget == 0)
+				break;
+			const cv::Size levelSize(cvRound(image.cols / scale), cvRound(image.rows / scale));
+			if (levelSize.width < _hog.winSize.width || levelSize.height < _hog.winSize.height)
+				break;
+			if (levelIdx == 0) {
+				scanLevel(image, levelIdx, budget, mined.windows);
+			} else {
+				cv::Mat level;
+				cv::resize(image, level, levelSize, 0, 0, cv::INTER_LINEAR);
+				scanLevel(level, levelIdx, budget, mined.windows);
+			}
+			mined.scanned = true;
+		}
+	}
+
+	void consume(size_t item, MinedWindows& mined) {
+		const bool countLimited = _params.maxMined > 0;
+		if (countLimited && _mined->size() >= _params.maxMined)
+			return;
+		if (mined.scanned)
+			++_stats.imagesScanned;
+		for (size_t window = 0; window < mined.windows.size(); ++window) {
+			if (countLimited && _mined->size() >= _params.maxMined)
+				break;
+			_mined->push_back(std::vector<float>());
+			_mined->back().swap(mined.windows[window].descriptor);
+		}
+		mined.windows.clear();
+		if (countLimited) {
+			_remaining = _params.maxMined - _mined->size();
+			if (_remaining == 0)
+				_stop = true;
+		}
+	}
+
+public:
+	HardNegativeMiner(const cv::HOGDescriptor& hog, const std::vector<float>& detector, float bias, const HardNegativeMiningParams& params = HardNegativeMiningParams()):
+	_hog(hog), _detector(detector), _engine(detectorDescriptor(hog, detector, bias)), _params(params), _images(NULL), _mined(NULL), _startTicks(0){
+	}
+
+	/**
+	 * Mines one round over the negative images
+	 * @param negImages full-size images not containing any pedestrian
+	 * @param mined receives the descriptors of the mined windows
+	 * @return statistics of the round
+	 */
+	HardNegativeMiningStats mine(const std::vector<std::string>& negImages, std::vector<std::vector<float> >& mined) {
+		_images = &negImages;
+		_mined = &mined;
+		_stop = false;
+		_remaining = _params.maxMined > 0 ? (size_t) _params.maxMined : std::numeric_limits<size_t>::max();
+		_windowsEvaluated = 0;
+		_stats = HardNegativeMiningStats();
+		_startTicks = cv::getTickCount();
+		mined.clear();
+		if (_detector.size() != _hog.getDescriptorSize()) {
+			printf("Error: Detector size %lu does not match HOG descriptor size %lu!\n", (unsigned long) _detector.size(), (unsigned long) _hog.getDescriptorSize());
+			return _stats;
+		}
+		if (!_engine.alignedStride(_params.winStride)) {
+			printf("Error: Mining window stride %dx%d is not a multiple of the block stride %dx%d!\n", _params.winStride.width, _params.winStride.height,
+				_hog.blockStride.width, _hog.blockStride.height);
+			return _stats;
+		}
+		run(negImages.size(), _params.threads);
+		_stats.windowsEvaluated = _windowsEvaluated;
+		_stats.windowsMined = mined.size();
+		_stats.limitReached = _stop;
+		_stats.seconds = elapsedSeconds();
+		return _stats;
+	}
+};
+
+#endif
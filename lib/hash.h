@@ -0,0 +1,17 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 64 bit FNV-1a hash, used for content hashes and file checksums
+static inline uint64_t fnv1aHash(const void* data, size_t length, uint64_t hash = 14695981039346656037ULL) {
+	const unsigned char* bytes = (const unsigned char*) data;
+	for (size_t i = 0; i < length; ++i) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+#endif
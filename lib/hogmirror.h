@@ -0,0 +1,81 @@
+#ifndef HOGMIRROR_H
+#define HOGMIRROR_H
+
+#include <stdio.h>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// Derives the HOG descriptor of the horizontally mirrored window from the
+// descriptor of the window itself, by permuting its components instead of
+// flipping the image and computing the descriptor again.
+//
+// OpenCV orders the blocks of a window column-major, the cells of a block
+// column-major and the orientation bins have their centres at
+// (b + 0.5) * 180 / nbins degrees (360 for signed gradients). Mirroring
+// maps block column bx to nbx - 1 - bx, cell column cx to ncx - 1 - cx and
+// the gradient angle a to 180 - a, i.e. bin b to nbins - 1 - b for
+// unsigned gradients and to nbins / 2 - 1 - b (mod nbins) for signed ones.
+// Block normalisation is invariant under the permutation. Only the
+// Gaussian block window weights are not exactly symmetric (centred half a
+// pixel off), so the result deviates slightly from the descriptor of the
+// flipped image when winSigma weighting is on.
+class
+HogMirror{
+private:
+	std::vector<int> _source;      // index of the original component of every mirrored component
+
+public:
+	bool empty() const { return _source.empty(); }
+
+	/**
+	 * Builds the permutation for a HOG geometry
+	 * @return false if the block grid of the window is not symmetric or signed bins can not be mirrored
+	 */
+	bool init(const cv::HOGDescriptor& hog) {
+		_source.clear();
+		const cv::Size cells(hog.blockSize.width / hog.cellSize.width, hog.blockSize.height / hog.cellSize.height);
+		if ((hog.winSize.width - hog.blockSize.width) % hog.blockStride.width != 0 || hog.blockSize.width % hog.cellSize.width != 0
+			|| (hog.signedGradient && hog.nbins % 2 != 0)) {
+			printf("Error: HOG geometry %dx%d / block %dx%d / stride %dx%d / %d bins can not be mirrored by permutation!\n",
+				hog.winSize.width, hog.winSize.height, hog.blockSize.width, hog.blockSize.height, hog.blockStride.width, hog.blockStride.height, hog.nbins);
+			return false;
+		}
+		const int blocksX = (hog.winSize.width - hog.blockSize.width) / hog.blockStride.width + 1;
+		const int blocksY = (hog.winSize.height - hog.blockSize.height) / hog.blockStride.height + 1;
+		const int nbins = hog.nbins;
+		const int blockHistogramSize = cells.width * cells.height * nbins;
+		_source.resize((size_t) blocksX * blocksY * blockHistogramSize);
+		for (int bx = 0; bx < blocksX; ++bx)
+			for (int by = 0; by < blocksY; ++by)
+				for (int cx = 0; cx < cells.width; ++cx)
+					for (int cy = 0; cy < cells.height; ++cy)
+						for (int b = 0; b < nbins; ++b) {
+							const int mirroredBin = hog.signedGradient ? (nbins / 2 - 1 - b + nbins) % nbins : nbins - 1 - b;
+							const int target = ((bx * blocksY + by) * cells.width + cx) * cells.height * nbins + cy * nbins + b;
+							const int source = (((blocksX - 1 - bx) * blocksY + by) * cells.width + cells.width - 1 - cx) * cells.height * nbins + cy * nbins + mirroredBin;
+							_source[target] = source;
+						}
+		if (_source.size() != hog.getDescriptorSize()) {
+			printf("Error: HOG mirror permutation has %lu components, the descriptor %lu!\n", (unsigned long) _source.size(), (unsigned long) hog.getDescriptorSize());
+			_source.clear();
+			return false;
+		}
+		return true;
+	}
+
+	/**
+	 * @param descriptor descriptor of one window
+	 * @param mirrored receives the descriptor of the mirrored window
+	 */
+	void apply(const std::vector<float>& descriptor, std::vector<float>& mirrored) const {
+		mirrored.resize(_source.size());
+		if (descriptor.size() != _source.size()) {
+			mirrored.clear();
+			return;
+		}
+		for (size_t i = 0; i < _source.size(); ++i)
+			mirrored[i] = descriptor[_source[i]];
+	}
+};
+
+#endif
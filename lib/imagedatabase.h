@@ -1,107 +1,288 @@
 #ifndef IMAGEDATABASE_H
 #define IMAGEDATABASE_H
 
-#include "common.h"
+#include <stdio.h>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
 #include <iostream>
-using namespace std;
+#include <iomanip>
+#include <cstring>
+#include <stdint.h>
+#include <opencv2/opencv.hpp>
+#include "mappedfile.h"
 
 // Stores the datasets used for training and testing the Support
-// Vector Machine class. Contains basically a list of image filenames
-// together with their true or predicted labels.
+// Vector Machine class: image filenames together with their true or
+// predicted labels, an optional bounding box of the sample within the
+// image and the row of its cached feature vector in a feature store. The
+// rows are only valid for the feature store generation in the header.
+//
+// Binary layout (little endian), mmap'ed and used in place:
+//
+//   ImageDatabaseHeader
+//   ImageRecord records[count]            at recordsOffset
+//   char strings[stringsSize]             at stringsOffset, zero terminated paths
+//
+// The records have a fixed size, so opening is O(1) whatever the size of
+// the database and any record can be accessed without touching the others.
+struct ImageDatabaseHeader {
+	char magic[4];          // "PDDB"
+	uint32_t version;
+	uint32_t recordSize;    // sizeof(ImageRecord)
+	uint32_t featureGeneration; // generation of the feature store the feature rows refer to, 0 for none
+	uint64_t count;
+	uint64_t positives;
+	uint64_t negatives;
+	uint64_t recordsOffset;
+	uint64_t stringsOffset;
+	uint64_t stringsSize;
+};
+
+struct ImageRecord {
+	float label;
+	uint32_t pathLength;
+	uint64_t pathOffset;                  // in the string table
+	int32_t x, y, width, height;          // bounding box of the sample, width 0 for the whole image
+	int64_t featureRow;                   // row of the cached feature vector in the feature store, -1 if none
+};
+
+static const char imageDatabaseMagic[4] = {'P', 'D', 'D', 'B'};
+static const uint32_t imageDatabaseVersion = 1;
+static const uint64_t imageDatabaseAlignment = 64;
+
+static inline uint64_t alignImageDatabaseOffset(uint64_t offset) {
+	return (offset + imageDatabaseAlignment - 1) / imageDatabaseAlignment * imageDatabaseAlignment;
+}
+
+// Collects records in memory and writes them as binary database.
 class
-ImageDatabase{
+ImageDatabaseWriter{
 private:
-	std::vector<std::string> _filenames;
-	std::vector<float> _labels;
-	int _positivesCount;
-	int _negativesCount;
-	std::string _dbFilename;
+	std::vector<ImageRecord> _records;
+	std::vector<char> _strings;
+	uint64_t _positives;
+	uint64_t _negatives;
+	uint32_t _featureGeneration;
 
 public:
-	// Create a new database.
-	ImageDatabase():
-	_negativesCount(0), _positivesCount(0){
+	ImageDatabaseWriter():
+	_positives(0), _negatives(0), _featureGeneration(0){
 	}
 
-	//ImageDatabase(const char* dbFilename);
-	ImageDatabase(const char* dbFilename):
-	_negativesCount(0), _positivesCount(0){
-		load(dbFilename);
+	// Generation of the feature store the feature rows of the records refer to
+	void setFeatureGeneration(uint32_t generation){
+		_featureGeneration = generation;
 	}
 
-	ImageDatabase(const vector<float>& labels, const vector<string>& filenames):
-	_negativesCount(0), _positivesCount(0){
-		_labels = labels;
-		_filenames = filenames;
-
-		for(vector<float>::iterator i = _labels.begin(); i != _labels.end(); i++){
-			if(*i > 0) _positivesCount++;
-			else if(*i < 0) _negativesCount++;
+	/**
+	 * Append a record
+	 * @param label +1 / -1, 0 for unlabeled
+	 * @param path image file
+	 * @param boundingBox sample region within the image, empty for the whole image
+	 * @param featureRow row of the cached feature vector in the feature store, -1 if none
+	 */
+	void add(float label, const std::string& path, const cv::Rect& boundingBox = cv::Rect(), int64_t featureRow = -1){
+		ImageRecord record;
+		memset(&record, 0, sizeof(record));
+		record.label = label;
+		record.pathLength = (uint32_t) path.size();
+		record.pathOffset = _strings.size();
+		if(boundingBox.area() > 0){
+			record.x = boundingBox.x;
+			record.y = boundingBox.y;
+			record.width = boundingBox.width;
+			record.height = boundingBox.height;
 		}
+		record.featureRow = featureRow;
+		_records.push_back(record);
+		_strings.insert(_strings.end(), path.begin(), path.end());
+		_strings.push_back('\0');
+		if(label > 0) _positives++;
+		else if(label < 0) _negatives++;
 	}
-	// Load a database from file.
-	void load(const char *dbFilename){
-		_dbFilename = string(dbFilename);
 
-		_negativesCount = 0;
-		_positivesCount = 0;
+	void clear(){
+		_records.clear();
+		_strings.clear();
+		_positives = _negatives = 0;
+		_featureGeneration = 0;
+	}
 
-		ifstream f(dbFilename);
+	size_t getSize() const { return _records.size(); }
+
+	/**
+	 * Import a text database: an optional first line with the number of items, then one
+	 * "label filename [x y width height]" line per image
+	 * @return false if the file can not be read or a line is malformed
+	 */
+	bool importText(const std::string& fileName){
+		std::ifstream f(fileName.c_str());
 		if(!f.is_open()){
-			printf("Could not open file %s for reading", dbFilename);
+			printf("Could not open file %s for reading\n", fileName.c_str());
+			return false;
+		}
+		std::string line;
+		for(unsigned long lineNumber = 1; std::getline(f, line); ++lineNumber){
+			std::istringstream fields(line);
+			float label;
+			std::string path;
+			if(!(fields >> label)) continue; // Empty line
+			if(!(fields >> path)){
+				if(lineNumber == 1) continue; // Item count of the old text format
+				printf("Error: Line %lu of %s has no filename!\n", lineNumber, fileName.c_str());
+				return false;
+			}
+			cv::Rect boundingBox;
+			fields >> boundingBox.x >> boundingBox.y >> boundingBox.width >> boundingBox.height;
+			add(label, path, fields ? boundingBox : cv::Rect());
 		}
+		return true;
+	}
 
-		int nItems;
-		f >> nItems;
+	// Write the database, replacing an existing file only once it is complete
+	bool save(const std::string& fileName) const {
+		ImageDatabaseHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, imageDatabaseMagic, sizeof(header.magic));
+		header.version = imageDatabaseVersion;
+		header.recordSize = sizeof(ImageRecord);
+		header.featureGeneration = _featureGeneration;
+		header.count = _records.size();
+		header.positives = _positives;
+		header.negatives = _negatives;
+		header.recordsOffset = alignImageDatabaseOffset(sizeof(ImageDatabaseHeader));
+		header.stringsOffset = alignImageDatabaseOffset(header.recordsOffset + _records.size() * sizeof(ImageRecord));
+		header.stringsSize = _strings.size();
 
-		assert(nItems > 0);
-		_labels.resize(nItems);
-		_filenames.resize(nItems);
+		// Mappings of the old file stay valid after the rename
+		const std::string tmpName = fileName + ".tmp";
+		FILE* f = fopen(tmpName.c_str(), "wb");
+		if(f == NULL){
+			printf("Could not open file %s for writing\n", tmpName.c_str());
+			return false;
+		}
+		const std::vector<char> padding(imageDatabaseAlignment, 0);
+		const size_t headerPadding = header.recordsOffset - sizeof(header);
+		const size_t recordsPadding = header.stringsOffset - header.recordsOffset - _records.size() * sizeof(ImageRecord);
+		bool ok = fwrite(&header, sizeof(header), 1, f) == 1
+			&& fwrite(&padding[0], 1, headerPadding, f) == headerPadding
+			&& (_records.empty() || fwrite(&_records[0], sizeof(ImageRecord), _records.size(), f) == _records.size())
+			&& fwrite(&padding[0], 1, recordsPadding, f) == recordsPadding
+			&& (_strings.empty() || fwrite(&_strings[0], 1, _strings.size(), f) == _strings.size());
+		ok = (fclose(f) == 0) && ok;
+		if(!ok || rename(tmpName.c_str(), fileName.c_str()) != 0){
+			remove(tmpName.c_str());
+			printf("Error writing image database %s\n", fileName.c_str());
+			return false;
+		}
+		return true;
+	}
+};
 
-		for(int i = 0; i < nItems; i++){
-			f >> _labels[i] >> _filenames[i];
+// Read-only, memory mapped access to a binary image database. Paths are
+// returned as pointers into the mapping, no strings are materialised.
+class
+ImageDatabase{
+private:
+	MappedFile _mapping;
+	const ImageDatabaseHeader* _header;
+	const ImageRecord* _records;
+	const char* _strings;
+	std::string _dbFilename;
 
-			if(_labels[i] < 0) _negativesCount++;
-			else if(_labels[i] > 0) _positivesCount++;
-		}
+	static const char* emptyString() { return ""; }
+
+public:
+	ImageDatabase():
+	_header(NULL), _records(NULL), _strings(NULL){
 	}
 
-	// Save database to a file
-	void save(const char* dbFilename){
-		ofstream f(dbFilename);
-		if(!f.is_open()) {
-			printf("Could not open file %s for writing", dbFilename);
-		}
+	ImageDatabase(const std::string& dbFilename):
+	_header(NULL), _records(NULL), _strings(NULL){
+		load(dbFilename);
+	}
 
-		f << _labels.size() << "\n";
-		for(int i = 0; i < _labels.size(); i++){
-			f << _labels[i] << " " << _filenames[i] << "\n";
+	// Map a database file and validate its header, does not read the records
+	bool load(const std::string& dbFilename){
+		_header = NULL;
+		_records = NULL;
+		_strings = NULL;
+		_dbFilename = dbFilename;
+		if(!_mapping.open(dbFilename)){
+			printf("Could not open image database %s\n", dbFilename.c_str());
+			return false;
 		}
+		const ImageDatabaseHeader* header = (const ImageDatabaseHeader*) _mapping.data();
+		if(_mapping.size() < sizeof(ImageDatabaseHeader)
+			|| memcmp(header->magic, imageDatabaseMagic, sizeof(header->magic)) != 0
+			|| header->version != imageDatabaseVersion
+			|| header->recordSize != sizeof(ImageRecord)
+			|| header->recordsOffset + header->count * sizeof(ImageRecord) > header->stringsOffset
+			|| header->stringsOffset + header->stringsSize > _mapping.size()){
+			printf("File %s is not a valid image database\n", dbFilename.c_str());
+			_mapping.close();
+			return false;
+		}
+		_header = header;
+		_records = (const ImageRecord*) (_mapping.data() + header->recordsOffset);
+		_strings = (const char*) (_mapping.data() + header->stringsOffset);
+		return true;
 	}
 
+	bool isOpen() const { return _header != NULL; }
+
 	// Accessors
-	const int getLabel(int idx) const { return _labels[idx]; }
-	const std::vector<float>& getLabels() const { return _labels; }
-	const std::string getFilename(int idx) const { return _filenames[idx]; }
-	const std::vector<std::string>& getFilenames() const { return _filenames; }
+	const ImageRecord& getRecord(size_t idx) const { return _records[idx]; }
+	float getLabel(size_t idx) const { return _records[idx].label; }
+	// Zero terminated path in the mapping, empty if the record is corrupt
+	const char* getPath(size_t idx) const {
+		const ImageRecord& record = _records[idx];
+		if(record.pathOffset + record.pathLength >= _header->stringsSize || _strings[record.pathOffset + record.pathLength] != '\0')
+			return emptyString();
+		return _strings + record.pathOffset;
+	}
+	std::string getFilename(size_t idx) const { return getPath(idx); }
+	bool hasBoundingBox(size_t idx) const { return _records[idx].width > 0 && _records[idx].height > 0; }
+	cv::Rect getBoundingBox(size_t idx) const {
+		const ImageRecord& record = _records[idx];
+		return hasBoundingBox(idx) ? cv::Rect(record.x, record.y, record.width, record.height) : cv::Rect();
+	}
+	int64_t getFeatureRow(size_t idx) const { return _records[idx].featureRow; }
+	uint32_t getFeatureGeneration() const { return _header->featureGeneration; }
+
+	/**
+	 * Record indices in a random order, e.g. to iterate over the samples shuffled
+	 * @param order receives a permutation of 0..size-1
+	 * @param seed seed of the permutation, the same seed gives the same order
+	 */
+	void shuffledOrder(std::vector<uint32_t>& order, uint64_t seed) const {
+		order.resize(getSize());
+		for(size_t i = 0; i < order.size(); ++i)
+			order[i] = (uint32_t) i;
+		cv::RNG rng(seed);
+		for(size_t i = order.size(); i > 1; --i)
+			std::swap(order[i - 1], order[rng.uniform(0, (int) i)]);
+	}
 
 	// Info about the database
-	int getPositivesCount() const { return _positivesCount; }
-	int getNegativesCount() const { return _negativesCount; }
-	int getUnlabeledCount() const { return _labels.size() - _positivesCount - _negativesCount; }
-	int getSize() const { return _labels.size(); }
+	size_t getPositivesCount() const { return _header ? _header->positives : 0; }
+	size_t getNegativesCount() const { return _header ? _header->negatives : 0; }
+	size_t getUnlabeledCount() const { return getSize() - getPositivesCount() - getNegativesCount(); }
+	size_t getSize() const { return _header ? _header->count : 0; }
 	std::string getDatabaseFilename() const { return _dbFilename; }
 };
 
 // Prints information about the dataset
-std::ostream&
+inline std::ostream&
 operator<<(std::ostream& s, const ImageDatabase& db){
 	s << "DATABASE INFO\n"
-	  << setw(20) << "Original filename:" << " " << db.getDatabaseFilename() << "\n"
-	  << setw(20) << "Positives:" << setw(5) << right << db.getPositivesCount() << "\n"
-	  << setw(20) << "Negaties:"   << setw(5) << right << db.getNegativesCount() << "\n"
-	  << setw(20) << "Unlabeled:"  << setw(5) << right << db.getUnlabeledCount() << "\n"
-	  << setw(20) << "Total:"      << setw(5) << right << db.getSize() << "\n";
+	  << std::setw(20) << "Original filename:" << " " << db.getDatabaseFilename() << "\n"
+	  << std::setw(20) << "Positives:" << std::setw(8) << std::right << db.getPositivesCount() << "\n"
+	  << std::setw(20) << "Negatives:" << std::setw(8) << std::right << db.getNegativesCount() << "\n"
+	  << std::setw(20) << "Unlabeled:" << std::setw(8) << std::right << db.getUnlabeledCount() << "\n"
+	  << std::setw(20) << "Total:"     << std::setw(8) << std::right << db.getSize() << "\n";
 
 	return s;
 }
@@ -0,0 +1,253 @@
+#ifndef LINEARSVM_H
+#define LINEARSVM_H
+
+#include <stdio.h>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <algorithm>
+#include <cmath>
+#include <opencv2/core/core.hpp>
+#include "simd.h"
+#include "trace.h"
+
+// Dense linear SVM trained with dual coordinate descent (Hsieh et al.,
+// "A Dual Coordinate Descent Method for Large-scale Linear SVM", the
+// LIBLINEAR L1-loss solver). The examples are kept as one contiguous
+// row-major float matrix, which suits the fully dense HOG vectors much
+// better than sparse SVMlight word lists.
+//
+// Provides the same interface as the SVMlight wrapper so it can be used
+// as TRAINHOG_SVM_TO_TRAIN. The decision function is w*x - b, identical to
+// SVMlight, i.e. w goes to HOGDescriptor::setSVMDetector and b is the
+// detection threshold.
+class
+LinearSVM{
+private:
+	std::vector<float> _features; // row-major, _count x _dimension
+	std::vector<float> _labels;
+	long _dimension;
+	long _count;
+	std::vector<float> _weights;
+	float _bias;
+
+	LinearSVM():
+	_dimension(0), _count(0), _bias(0.f),
+	svm_c(0.01), eps(0.1), maxIterations(1000), biasTerm(1.f), seed(0x12345678){
+	}
+
+public:
+	// The HOG paper uses a soft classifier (C = 0.01), same as the SVMlight setup
+	double svm_c;
+	// Stopping tolerance on the projected gradient
+	double eps;
+	// Maximum number of passes over the training set
+	int maxIterations;
+	// Value of the constant feature appended to learn the bias
+	float biasTerm;
+	// Seed of the coordinate permutations, fixed for reproducible models
+	unsigned int seed;
+
+	static LinearSVM* getInstance() {
+		static LinearSVM theInstance;
+		return &theInstance;
+	}
+
+	/**
+	 * Makes room for at least count training examples
+	 * @param count number of examples expected in total
+	 */
+	void reserve_examples(long count) {
+		_labels.reserve(count);
+		if (_dimension > 0)
+			_features.reserve(count * _dimension);
+	}
+
+	/**
+	 * Appends a single dense training example
+	 * @param label target value (+1 / -1)
+	 * @param features feature vector components
+	 * @param dimension number of components, all examples must have the same dimension
+	 */
+	void add_example(double label, const float* features, long dimension) {
+		if (_count == 0) {
+			_dimension = dimension;
+			_features.reserve(_labels.capacity() * _dimension);
+		}
+		if (dimension != _dimension) {
+			printf("Error: Example dimension %ld does not match %ld, example skipped!\n", dimension, _dimension);
+			return;
+		}
+		_features.insert(_features.end(), features, features + dimension);
+		_labels.push_back(label > 0 ? 1.f : -1.f);
+		++_count;
+	}
+
+	inline void add_example(double label, const std::vector<float>& featureVector) {
+		add_example(label, &featureVector[0], featureVector.size());
+	}
+
+	/**
+	 * Dual coordinate descent on
+	 * min_a 0.5 a'Qa - e'a, 0 <= a_i <= C, Q_ij = y_i y_j [x_i, B][x_j, B]
+	 * with the primal weights w = sum a_i y_i [x_i, B] maintained incrementally,
+	 * plus the shrinking heuristic of LIBLINEAR.
+	 */
+	void train() {
+		PD_TRACE_SCOPE("LinearSVM::train");
+		const int n = (int) _count;
+		const int d = (int) _dimension;
+		const float C = (float) svm_c;
+		const float B = biasTerm;
+		_weights.assign(d, 0.f);
+		float wBias = 0.f;
+		if (n == 0) {
+			printf("Error: No training examples!\n");
+			return;
+		}
+
+		std::vector<float> alpha(n, 0.f);
+		std::vector<float> QD(n);
+		std::vector<int> index(n);
+		for (int i = 0; i < n; ++i) {
+			const float* x = &_features[(size_t) i * d];
+			QD[i] = dotProduct(x, x, d) + B * B;
+			index[i] = i;
+		}
+
+		cv::RNG rng(seed);
+		int activeSize = n;
+		float PGmaxOld = HUGE_VALF;
+		float PGminOld = -HUGE_VALF;
+		int iteration = 0;
+		for (; iteration < maxIterations; ++iteration) {
+			float PGmaxNew = -HUGE_VALF;
+			float PGminNew = HUGE_VALF;
+
+			for (int i = 0; i < activeSize; ++i)
+				std::swap(index[i], index[i + rng.uniform(0, activeSize - i)]);
+
+			for (int s = 0; s < activeSize; ++s) {
+				const int i = index[s];
+				const float y = _labels[i];
+				const float* x = &_features[(size_t) i * d];
+				const float G = y * (dotProduct(&_weights[0], x, d) + wBias * B) - 1.f;
+
+				float PG = 0.f;
+				if (alpha[i] == 0.f) {
+					if (G > PGmaxOld) {
+						// Shrink, the variable is likely to stay at the lower bound
+						--activeSize;
+						std::swap(index[s], index[activeSize]);
+						--s;
+						continue;
+					} else if (G < 0.f) {
+						PG = G;
+					}
+				} else if (alpha[i] == C) {
+					if (G < PGminOld) {
+						--activeSize;
+						std::swap(index[s], index[activeSize]);
+						--s;
+						continue;
+					} else if (G > 0.f) {
+						PG = G;
+					}
+				} else {
+					PG = G;
+				}
+
+				PGmaxNew = std::max(PGmaxNew, PG);
+				PGminNew = std::min(PGminNew, PG);
+
+				if (std::fabs(PG) > 1.0e-12f) {
+					const float alphaOld = alpha[i];
+					alpha[i] = std::min(std::max(alpha[i] - G / QD[i], 0.f), C);
+					const float delta = (alpha[i] - alphaOld) * y;
+					addScaled(&_weights[0], x, delta, d);
+					wBias += delta * B;
+				}
+			}
+
+			if (PGmaxNew - PGminNew <= eps) {
+				if (activeSize == n) {
+					break;
+				}
+				// Converged on the active set, verify on the whole set
+				activeSize = n;
+				PGmaxOld = HUGE_VALF;
+				PGminOld = -HUGE_VALF;
+				continue;
+			}
+			PGmaxOld = PGmaxNew > 0.f ? PGmaxNew : HUGE_VALF;
+			PGminOld = PGminNew < 0.f ? PGminNew : -HUGE_VALF;
+		}
+
+		int supportVectors = 0;
+		for (int i = 0; i < n; ++i)
+			if (alpha[i] > 0.f) ++supportVectors;
+		printf("Dual coordinate descent finished after %d iterations, %d support vectors\n", iteration, supportVectors);
+		if (iteration == maxIterations)
+			printf("Warning: Reached the maximum number of iterations, the model may not be optimal\n");
+
+		// Decision function w*x + wBias*B is stored as w*x - b
+		_bias = -wBias * B;
+	}
+
+	/**
+	 * Writes the model in a simple text format: dimension and bias in the first line, the weights in the second
+	 * @param _modelFileName model file
+	 */
+	void saveModelToFile(const std::string _modelFileName) {
+		std::fstream File;
+		File.open(_modelFileName.c_str(), std::ios::out);
+		if (!File.good() || !File.is_open()) {
+			printf("Error opening file '%s'!\n", _modelFileName.c_str());
+			return;
+		}
+		File << _weights.size() << " " << _bias << std::endl;
+		for (size_t feature = 0; feature < _weights.size(); ++feature) {
+			File << _weights[feature] << " ";
+		}
+		File << std::endl;
+	}
+
+	void loadModelFromFile(const std::string _modelFileName) {
+		std::fstream File;
+		File.open(_modelFileName.c_str(), std::ios::in);
+		size_t dimension = 0;
+		File >> dimension >> _bias;
+		_weights.resize(dimension);
+		for (size_t feature = 0; feature < dimension; ++feature) {
+			File >> _weights[feature];
+		}
+		if (!File.good()) {
+			printf("Error reading model file '%s'!\n", _modelFileName.c_str());
+		}
+	}
+
+	/**
+	 * Returns the primal weight vector, which is directly maintained by the solver
+	 * @param singleDetectorVector resulting single detector vector for use in openCV HOG
+	 * @param singleDetectorVectorIndices dummy vector for this implementation
+	 */
+	void getSingleDetectingVector(std::vector<float>& singleDetectorVector, std::vector<unsigned int>& singleDetectorVectorIndices) {
+		singleDetectorVector = _weights;
+	}
+
+	/**
+	 * Return model detection threshold / bias
+	 * @return detection threshold / bias
+	 */
+	float getThreshold() const {
+		return _bias;
+	}
+
+	const char* getSVMName() const {
+		return "LinearSVM (dual coordinate descent)";
+	}
+
+	long getExampleCount() const { return _count; }
+};
+
+#endif
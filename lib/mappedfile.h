@@ -0,0 +1,90 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <string>
+#include <vector>
+#include <cstdio>
+
+#if defined(_WIN32) || defined(_WIN64)
+  #define MAPPEDFILE_NO_MMAP
+#else
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <fcntl.h>
+  #include <unistd.h>
+#endif
+
+// Read-only view of a whole file. Uses mmap where available so the file
+// contents are paged in lazily and shared with the page cache, otherwise
+// falls back to reading the file into memory.
+class
+MappedFile{
+private:
+	const unsigned char* _data;
+	size_t _size;
+#ifdef MAPPEDFILE_NO_MMAP
+	std::vector<unsigned char> _buffer;
+#endif
+
+	// Not copyable, the mapping is owned
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+public:
+	MappedFile():
+	_data(NULL), _size(0){
+	}
+
+	~MappedFile(){
+		close();
+	}
+
+	// Map the file, returns false if it can not be opened or is empty.
+	bool open(const std::string& fileName){
+		close();
+#ifdef MAPPEDFILE_NO_MMAP
+		FILE* f = fopen(fileName.c_str(), "rb");
+		if(f == NULL) return false;
+		fseek(f, 0, SEEK_END);
+		long length = ftell(f);
+		fseek(f, 0, SEEK_SET);
+		if(length > 0){
+			_buffer.resize(length);
+			if(fread(&_buffer[0], 1, length, f) == (size_t) length){
+				_data = &_buffer[0];
+				_size = length;
+			}
+		}
+		fclose(f);
+#else
+		int fd = ::open(fileName.c_str(), O_RDONLY);
+		if(fd < 0) return false;
+		struct stat s;
+		if(fstat(fd, &s) == 0 && s.st_size > 0){
+			void* p = mmap(NULL, s.st_size, PROT_READ, MAP_SHARED, fd, 0);
+			if(p != MAP_FAILED){
+				_data = (const unsigned char*) p;
+				_size = s.st_size;
+			}
+		}
+		::close(fd); // The mapping stays valid after closing the descriptor
+#endif
+		return _data != NULL;
+	}
+
+	void close(){
+#ifdef MAPPEDFILE_NO_MMAP
+		_buffer.clear();
+#else
+		if(_data != NULL) munmap((void*) _data, _size);
+#endif
+		_data = NULL;
+		_size = 0;
+	}
+
+	bool isOpen() const { return _data != NULL; }
+	const unsigned char* data() const { return _data; }
+	size_t size() const { return _size; }
+};
+
+#endif
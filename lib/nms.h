@@ -0,0 +1,293 @@
+#ifndef NMS_H
+#define NMS_H
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+#include <opencv2/opencv.hpp>
+#include "simd.h"
+
+// Score aware non-maximum suppression of raw detection windows, for
+// detectMultiScale called with finalThreshold 0 (no grouping).
+//
+// Greedy IoU suppression visits the candidates by descending score and
+// keeps a candidate unless it overlaps an already kept box by more than the
+// IoU threshold. Kept boxes are bucketed in a uniform grid, so a candidate
+// is only compared with the kept boxes in the cells it touches, four or
+// eight at a time with SSE / AVX, instead of with every other candidate.
+//
+// Mean-shift grouping (Dalal) finds the modes of the score weighted
+// density of the windows in (x, y, log scale) and returns one box per mode.
+
+namespace nms_detail {
+
+// Kept boxes of one grid cell, structure of arrays for the vectorised test
+struct Cell {
+	std::vector<float> x1, y1, x2, y2, area;
+};
+
+/**
+ * Tests a box against the boxes of a cell
+ * @return true if the intersection over union with any box exceeds iouThreshold
+ */
+static inline bool overlapsAny(const Cell& cell, float bx1, float by1, float bx2, float by2, float iouThreshold) {
+	const int n = (int) cell.x1.size();
+	const float barea = (bx2 - bx1) * (by2 - by1);
+	// iou > t  <=>  inter * (1 + t) > t * (area a + area b)
+	const float t1 = 1.f + iouThreshold;
+	int i = 0;
+#if defined(__AVX__)
+	const __m256 vx1 = _mm256_set1_ps(bx1), vy1 = _mm256_set1_ps(by1), vx2 = _mm256_set1_ps(bx2), vy2 = _mm256_set1_ps(by2);
+	const __m256 varea = _mm256_set1_ps(barea), vt = _mm256_set1_ps(iouThreshold), vt1 = _mm256_set1_ps(t1), zero = _mm256_setzero_ps();
+	for (; i + 8 <= n; i += 8) {
+		const __m256 w = _mm256_max_ps(_mm256_sub_ps(_mm256_min_ps(vx2, _mm256_loadu_ps(&cell.x2[i])), _mm256_max_ps(vx1, _mm256_loadu_ps(&cell.x1[i]))), zero);
+		const __m256 h = _mm256_max_ps(_mm256_sub_ps(_mm256_min_ps(vy2, _mm256_loadu_ps(&cell.y2[i])), _mm256_max_ps(vy1, _mm256_loadu_ps(&cell.y1[i]))), zero);
+		const __m256 inter = _mm256_mul_ps(_mm256_mul_ps(w, h), vt1);
+		const __m256 limit = _mm256_mul_ps(_mm256_add_ps(varea, _mm256_loadu_ps(&cell.area[i])), vt);
+		if (_mm256_movemask_ps(_mm256_cmp_ps(inter, limit, _CMP_GT_OQ)))
+			return true;
+	}
+#elif defined(SIMD_USE_SSE)
+	const __m128 vx1 = _mm_set1_ps(bx1), vy1 = _mm_set1_ps(by1), vx2 = _mm_set1_ps(bx2), vy2 = _mm_set1_ps(by2);
+	const __m128 varea = _mm_set1_ps(barea), vt = _mm_set1_ps(iouThreshold), vt1 = _mm_set1_ps(t1), zero = _mm_setzero_ps();
+	for (; i + 4 <= n; i += 4) {
+		const __m128 w = _mm_max_ps(_mm_sub_ps(_mm_min_ps(vx2, _mm_loadu_ps(&cell.x2[i])), _mm_max_ps(vx1, _mm_loadu_ps(&cell.x1[i]))), zero);
+		const __m128 h = _mm_max_ps(_mm_sub_ps(_mm_min_ps(vy2, _mm_loadu_ps(&cell.y2[i])), _mm_max_ps(vy1, _mm_loadu_ps(&cell.y1[i]))), zero);
+		const __m128 inter = _mm_mul_ps(_mm_mul_ps(w, h), vt1);
+		const __m128 limit = _mm_mul_ps(_mm_add_ps(varea, _mm_loadu_ps(&cell.area[i])), vt);
+		if (_mm_movemask_ps(_mm_cmpgt_ps(inter, limit)))
+			return true;
+	}
+#endif
+	for (; i < n; ++i) {
+		const float w = std::max(std::min(bx2, cell.x2[i]) - std::max(bx1, cell.x1[i]), 0.f);
+		const float h = std::max(std::min(by2, cell.y2[i]) - std::max(by1, cell.y1[i]), 0.f);
+		if (w * h * t1 > (barea + cell.area[i]) * iouThreshold)
+			return true;
+	}
+	return false;
+}
+
+// Uniform grid over the bounding box of a set of rectangles
+struct Grid {
+	cv::Rect bounds;
+	int cellSize;
+	int cols, rows;
+
+	Grid(const std::vector<cv::Rect>& boxes) {
+		int x1 = boxes[0].x, y1 = boxes[0].y, x2 = boxes[0].br().x, y2 = boxes[0].br().y;
+		std::vector<int> sizes(boxes.size());
+		for (size_t i = 0; i < boxes.size(); ++i) {
+			x1 = std::min(x1, boxes[i].x);
+			y1 = std::min(y1, boxes[i].y);
+			x2 = std::max(x2, boxes[i].br().x);
+			y2 = std::max(y2, boxes[i].br().y);
+			sizes[i] = std::max(boxes[i].width, boxes[i].height);
+		}
+		// Typical boxes span about two cells per axis
+		std::nth_element(sizes.begin(), sizes.begin() + sizes.size() / 2, sizes.end());
+		cellSize = std::max(sizes[sizes.size() / 2] / 2, 8);
+		bounds = cv::Rect(x1, y1, x2 - x1 + 1, y2 - y1 + 1);
+		cols = bounds.width / cellSize + 1;
+		rows = bounds.height / cellSize + 1;
+	}
+
+	// Cells touched by a box, clipped to the grid
+	cv::Rect cells(const cv::Rect& box) const {
+		const int cx1 = std::max(box.x - bounds.x, 0) / cellSize;
+		const int cy1 = std::max(box.y - bounds.y, 0) / cellSize;
+		const int cx2 = std::min(std::max(box.br().x - bounds.x, -1) / cellSize, cols - 1);
+		const int cy2 = std::min(std::max(box.br().y - bounds.y, -1) / cellSize, rows - 1);
+		return cv::Rect(cx1, cy1, std::max(cx2 - cx1 + 1, 0), std::max(cy2 - cy1 + 1, 0));
+	}
+};
+
+// Candidate indices by descending score, equal scores by ascending index.
+// LSD radix sort on the bits of the double scores, six passes of 11 bits,
+// several times faster than a comparison sort for thousands of candidates.
+// Passes whose digit is the same for every candidate (typically the sign
+// and exponent of scores in a narrow range) are skipped.
+static inline void sortByScore(const std::vector<double>& scores, std::vector<int>& order) {
+	const size_t n = scores.size();
+	std::vector<uint64_t> keys(n), keysTmp(n);
+	std::vector<int> orderTmp(n);
+	order.resize(n);
+	for (size_t i = 0; i < n; ++i) {
+		uint64_t bits;
+		memcpy(&bits, &scores[i], sizeof(bits));
+		// Order preserving map of the double bits, inverted for descending order
+		bits = (bits & 0x8000000000000000ull) ? ~bits : (bits | 0x8000000000000000ull);
+		keys[i] = ~bits;
+		order[i] = (int) i;
+	}
+	for (int shift = 0; shift < 64; shift += 11) {
+		size_t counts[2048 + 1] = {0};
+		for (size_t i = 0; i < n; ++i)
+			++counts[((keys[i] >> shift) & 2047) + 1];
+		if (n > 0 && counts[((keys[0] >> shift) & 2047) + 1] == n)
+			continue;
+		for (int b = 0; b < 2048; ++b)
+			counts[b + 1] += counts[b];
+		for (size_t i = 0; i < n; ++i) {
+			const size_t position = counts[(keys[i] >> shift) & 2047]++;
+			keysTmp[position] = keys[i];
+			orderTmp[position] = order[i];
+		}
+		keys.swap(keysTmp);
+		order.swap(orderTmp);
+	}
+}
+
+}
+
+/**
+ * Greedy IoU non-maximum suppression
+ * @param boxes candidate windows
+ * @param scores decision values of the candidates
+ * @param iouThreshold a candidate overlapping a better kept box by more than this is suppressed
+ * @param keep receives the indices of the kept candidates, by descending score
+ */
+static inline void nonMaximumSuppression(const std::vector<cv::Rect>& boxes, const std::vector<double>& scores, double iouThreshold, std::vector<int>& keep) {
+	keep.clear();
+	if (boxes.empty())
+		return;
+	std::vector<int> order;
+	nms_detail::sortByScore(scores, order);
+	const nms_detail::Grid grid(boxes);
+	std::vector<nms_detail::Cell> cells(grid.cols * grid.rows);
+	const float threshold = (float) iouThreshold;
+	for (size_t k = 0; k < order.size(); ++k) {
+		const cv::Rect& box = boxes[order[k]];
+		const float x1 = (float) box.x, y1 = (float) box.y, x2 = (float) box.br().x, y2 = (float) box.br().y;
+		const cv::Rect touched = grid.cells(box);
+		bool suppressed = false;
+		for (int cy = touched.y; cy < touched.br().y && !suppressed; ++cy)
+			for (int cx = touched.x; cx < touched.br().x && !suppressed; ++cx)
+				suppressed = nms_detail::overlapsAny(cells[cy * grid.cols + cx], x1, y1, x2, y2, threshold);
+		if (suppressed)
+			continue;
+		keep.push_back(order[k]);
+		for (int cy = touched.y; cy < touched.br().y; ++cy) {
+			for (int cx = touched.x; cx < touched.br().x; ++cx) {
+				nms_detail::Cell& cell = cells[cy * grid.cols + cx];
+				cell.x1.push_back(x1);
+				cell.y1.push_back(y1);
+				cell.x2.push_back(x2);
+				cell.y2.push_back(y2);
+				cell.area.push_back((x2 - x1) * (y2 - y1));
+			}
+		}
+	}
+}
+
+/**
+ * Greedy IoU non-maximum suppression in place
+ * @param boxes candidate windows, replaced by the kept ones
+ * @param scores decision values, replaced by those of the kept boxes
+ */
+static inline void nonMaximumSuppression(std::vector<cv::Rect>& boxes, std::vector<double>& scores, double iouThreshold) {
+	std::vector<int> keep;
+	nonMaximumSuppression(boxes, scores, iouThreshold, keep);
+	std::vector<cv::Rect> keptBoxes(keep.size());
+	std::vector<double> keptScores(keep.size());
+	for (size_t i = 0; i < keep.size(); ++i) {
+		keptBoxes[i] = boxes[keep[i]];
+		keptScores[i] = scores[keep[i]];
+	}
+	boxes.swap(keptBoxes);
+	scores.swap(keptScores);
+}
+
+/**
+ * Mean-shift grouping of detection windows in (x, y, log scale), weighted by score above hitThreshold
+ * @param boxes candidate windows, replaced by one box per mode
+ * @param scores decision values, replaced by the best score of the windows converging to each mode
+ * @param hitThreshold scores are weighted by their margin above this value
+ * @param sigmaX horizontal bandwidth relative to the window width
+ * @param sigmaY vertical bandwidth relative to the window height
+ * @param sigmaScale bandwidth in log scale
+ */
+static inline void meanShiftGrouping(std::vector<cv::Rect>& boxes, std::vector<double>& scores, double hitThreshold,
+	double sigmaX = 0.15, double sigmaY = 0.15, double sigmaScale = std::log(1.3)) {
+	const int n = (int) boxes.size();
+	if (n == 0)
+		return;
+	// Points: window centre and log height, with the aspect ratio of the first window
+	std::vector<cv::Point3d> points(n);
+	std::vector<double> weights(n);
+	for (int i = 0; i < n; ++i) {
+		points[i] = cv::Point3d(boxes[i].x + boxes[i].width * 0.5, boxes[i].y + boxes[i].height * 0.5, std::log((double) boxes[i].height));
+		weights[i] = std::max(scores[i] - hitThreshold, 1e-3);
+	}
+	const double aspect = (double) boxes[0].width / boxes[0].height;
+
+	// Neighbours within 3 sigma are found through the grid of the candidates
+	const nms_detail::Grid grid(boxes);
+	std::vector<std::vector<int> > cells(grid.cols * grid.rows);
+	for (int i = 0; i < n; ++i) {
+		const int cx = std::min((int) (points[i].x - grid.bounds.x) / grid.cellSize, grid.cols - 1);
+		const int cy = std::min((int) (points[i].y - grid.bounds.y) / grid.cellSize, grid.rows - 1);
+		cells[cy * grid.cols + cx].push_back(i);
+	}
+
+	std::vector<cv::Point3d> modes;
+	std::vector<double> modeScores;
+	for (int i = 0; i < n; ++i) {
+		cv::Point3d y = points[i];
+		for (int iteration = 0; iteration < 20; ++iteration) {
+			const double height = std::exp(y.z);
+			const double sx = sigmaX * height * aspect, sy = sigmaY * height;
+			const cv::Rect touched = grid.cells(cv::Rect(cvFloor(y.x - 3 * sx), cvFloor(y.y - 3 * sy), cvCeil(6 * sx), cvCeil(6 * sy)));
+			cv::Point3d sum(0, 0, 0);
+			double total = 0.;
+			for (int cy = touched.y; cy < touched.br().y; ++cy) {
+				for (int cx = touched.x; cx < touched.br().x; ++cx) {
+					const std::vector<int>& cell = cells[cy * grid.cols + cx];
+					for (size_t k = 0; k < cell.size(); ++k) {
+						const cv::Point3d& p = points[cell[k]];
+						const double dx = (p.x - y.x) / sx, dy = (p.y - y.y) / sy, ds = (p.z - y.z) / sigmaScale;
+						const double d2 = dx * dx + dy * dy + ds * ds;
+						if (d2 > 9.)
+							continue;
+						const double w = weights[cell[k]] * std::exp(-0.5 * d2);
+						sum += p * w;
+						total += w;
+					}
+				}
+			}
+			if (total <= 0.)
+				break;
+			const cv::Point3d next = sum * (1. / total);
+			const cv::Point3d step = next - y;
+			y = next;
+			if (std::fabs(step.x) < 0.5 && std::fabs(step.y) < 0.5 && std::fabs(step.z) < 0.01)
+				break;
+		}
+		// Merge with an existing mode closer than one bandwidth
+		const double height = std::exp(y.z);
+		size_t m = 0;
+		for (; m < modes.size(); ++m) {
+			if (std::fabs(modes[m].x - y.x) < sigmaX * height * aspect && std::fabs(modes[m].y - y.y) < sigmaY * height
+				&& std::fabs(modes[m].z - y.z) < sigmaScale)
+				break;
+		}
+		if (m == modes.size()) {
+			modes.push_back(y);
+			modeScores.push_back(scores[i]);
+		} else {
+			modeScores[m] = std::max(modeScores[m], scores[i]);
+		}
+	}
+
+	boxes.resize(modes.size());
+	scores.swap(modeScores);
+	for (size_t m = 0; m < modes.size(); ++m) {
+		const double height = std::exp(modes[m].z);
+		const double width = height * aspect;
+		boxes[m] = cv::Rect(cvRound(modes[m].x - width * 0.5), cvRound(modes[m].y - height * 0.5), cvRound(width), cvRound(height));
+	}
+}
+
+#endif
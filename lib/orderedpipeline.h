@@ -0,0 +1,130 @@
+#ifndef ORDEREDPIPELINE_H
+#define ORDEREDPIPELINE_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+#include <limits>
+#include <opencv2/core/core.hpp>
+
+// Runs an indexed workload on a pool of worker threads while handing the
+// results to a single consumer strictly in index order. Workers claim items
+// in ascending order and may run at most "window" items ahead of the
+// consumer, which bounds memory and gives backpressure when consuming is
+// the slower stage. The consumer runs on the thread calling run(), so it
+// can own non thread-safe resources like output streams or the trainer.
+template <typename Result>
+class OrderedPipeline {
+public:
+	virtual ~OrderedPipeline() {}
+
+	// Process itemCount items using workerCount threads (0 = one per CPU).
+	void run(size_t itemCount, unsigned int workerCount = 0) {
+		if (workerCount == 0)
+			workerCount = defaultWorkerCount();
+		_window = 4 * workerCount;
+		_slots.assign(_window, Slot());
+		_itemCount = itemCount;
+		_endItem = std::numeric_limits<size_t>::max();
+		_nextItem = 0;
+		_consumed = 0;
+
+		std::vector<std::thread> workers;
+		for (unsigned int w = 0; w < workerCount; ++w)
+			workers.push_back(std::thread(&OrderedPipeline::workerLoop, this));
+
+		for (size_t item = 0; item < itemCount; ++item) {
+			Slot& slot = _slots[item % _window];
+			{
+				std::unique_lock<std::mutex> lock(_mutex);
+				_resultReady.wait(lock, [this, &slot, item] { return slot.ready || item >= _endItem; });
+				if (!slot.ready)
+					break;
+			}
+			consume(item, slot.result);
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				slot.ready = false;
+				++_consumed;
+			}
+			_slotFree.notify_all();
+		}
+
+		for (size_t w = 0; w < workers.size(); ++w)
+			workers[w].join();
+	}
+
+	// Process items of an input whose length is only known once it ended, e.g. a
+	// file list that is still being discovered, see available().
+	void runUntilEnd(unsigned int workerCount = 0) {
+		run(std::numeric_limits<size_t>::max(), workerCount);
+	}
+
+	static unsigned int defaultWorkerCount() {
+		int cpus = cv::getNumberOfCPUs();
+		return cpus > 0 ? cpus : 1;
+	}
+
+protected:
+	// Called concurrently from the worker threads, must be thread-safe.
+	virtual void process(size_t item, Result& result) = 0;
+	// Called from the thread running run(), in ascending item order.
+	virtual void consume(size_t item, Result& result) = 0;
+	// Called from the worker threads before process(), may block until the item
+	// exists. Returns false if the input ended before the item; all later items
+	// must then be unavailable as well.
+	virtual bool available(size_t item) { return true; }
+
+private:
+	struct Slot {
+		Result result;
+		bool ready;
+		Slot() : ready(false) {}
+	};
+
+	void workerLoop() {
+		for (;;) {
+			const size_t item = _nextItem.fetch_add(1);
+			if (item >= _itemCount)
+				return;
+			{
+				// Do not run further ahead than the reorder window allows
+				std::unique_lock<std::mutex> lock(_mutex);
+				_slotFree.wait(lock, [this, item] { return item < _consumed + _window || item >= _endItem; });
+				if (item >= _endItem)
+					return;
+			}
+			if (!available(item)) {
+				{
+					std::lock_guard<std::mutex> lock(_mutex);
+					_endItem = std::min(_endItem, item);
+				}
+				_resultReady.notify_all();
+				_slotFree.notify_all();
+				return;
+			}
+			Slot& slot = _slots[item % _window];
+			process(item, slot.result);
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				slot.ready = true;
+			}
+			_resultReady.notify_all();
+		}
+	}
+
+	std::vector<Slot> _slots;
+	size_t _window;
+	size_t _itemCount;
+	size_t _endItem;       // first unavailable item, guarded by _mutex
+	std::atomic<size_t> _nextItem;
+	size_t _consumed;
+	std::mutex _mutex;
+	std::condition_variable _resultReady;
+	std::condition_variable _slotFree;
+};
+
+#endif
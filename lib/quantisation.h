@@ -0,0 +1,184 @@
+#ifndef QUANTISATION_H
+#define QUANTISATION_H
+
+#include <stdio.h>
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+#include <opencv2/opencv.hpp>
+
+// Integer kernels for the quantised scoring path. AVX2 or SSSE3 / SSE4.1
+// are used when enabled at compile time, with a plain C++ fallback.
+#if defined(__AVX2__)
+  #include <immintrin.h>
+#elif defined(__SSE4_1__)
+  #include <smmintrin.h>
+#endif
+
+// Sum of a[i] * b[i], i = 0..n-1, for unsigned 7 bit features and signed 8 bit weights.
+// The features are limited to 7 bits so the pairwise maddubs sums can not saturate.
+static inline int32_t dotU8S8(const uint8_t* a, const int8_t* b, int n) {
+	int i = 0;
+	int32_t sum = 0;
+#if defined(__AVX2__)
+	const __m256i ones = _mm256_set1_epi16(1);
+	__m256i acc = _mm256_setzero_si256();
+	for (; i + 32 <= n; i += 32) {
+		const __m256i pairs = _mm256_maddubs_epi16(_mm256_loadu_si256((const __m256i*) (a + i)), _mm256_loadu_si256((const __m256i*) (b + i)));
+		acc = _mm256_add_epi32(acc, _mm256_madd_epi16(pairs, ones));
+	}
+	__m128i acc128 = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+	if (i + 16 <= n) {
+		const __m128i pairs = _mm_maddubs_epi16(_mm_loadu_si128((const __m128i*) (a + i)), _mm_loadu_si128((const __m128i*) (b + i)));
+		acc128 = _mm_add_epi32(acc128, _mm_madd_epi16(pairs, _mm_set1_epi16(1)));
+		i += 16;
+	}
+	acc128 = _mm_add_epi32(acc128, _mm_shuffle_epi32(acc128, _MM_SHUFFLE(1, 0, 3, 2)));
+	acc128 = _mm_add_epi32(acc128, _mm_shuffle_epi32(acc128, _MM_SHUFFLE(2, 3, 0, 1)));
+	sum = _mm_cvtsi128_si32(acc128);
+#elif defined(__SSE4_1__)
+	const __m128i ones = _mm_set1_epi16(1);
+	__m128i acc = _mm_setzero_si128();
+	for (; i + 16 <= n; i += 16) {
+		const __m128i pairs = _mm_maddubs_epi16(_mm_loadu_si128((const __m128i*) (a + i)), _mm_loadu_si128((const __m128i*) (b + i)));
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(pairs, ones));
+	}
+	acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+	acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+	sum = _mm_cvtsi128_si32(acc);
+#endif
+	for (; i < n; ++i)
+		sum += (int32_t) a[i] * b[i];
+	return sum;
+}
+
+// Sum of a[i] * b[i], i = 0..n-1, for unsigned 8 bit features and signed 16 bit weights
+static inline int32_t dotU8S16(const uint8_t* a, const int16_t* b, int n) {
+	int i = 0;
+	int32_t sum = 0;
+#if defined(__AVX2__)
+	__m256i acc = _mm256_setzero_si256();
+	for (; i + 16 <= n; i += 16) {
+		const __m256i features = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) (a + i)));
+		acc = _mm256_add_epi32(acc, _mm256_madd_epi16(features, _mm256_loadu_si256((const __m256i*) (b + i))));
+	}
+	__m128i acc128 = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+	acc128 = _mm_add_epi32(acc128, _mm_shuffle_epi32(acc128, _MM_SHUFFLE(1, 0, 3, 2)));
+	acc128 = _mm_add_epi32(acc128, _mm_shuffle_epi32(acc128, _MM_SHUFFLE(2, 3, 0, 1)));
+	sum = _mm_cvtsi128_si32(acc128);
+#elif defined(__SSE4_1__)
+	__m128i acc = _mm_setzero_si128();
+	for (; i + 8 <= n; i += 8) {
+		const __m128i features = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*) (a + i)));
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(features, _mm_loadu_si128((const __m128i*) (b + i))));
+	}
+	acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+	acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+	sum = _mm_cvtsi128_si32(acc);
+#endif
+	for (; i < n; ++i)
+		sum += (int32_t) a[i] * b[i];
+	return sum;
+}
+
+// Scale of the quantised block features: 0..127 for 0..2 * L2HysThreshold.
+// After clipping and renormalisation larger components are rare, they saturate.
+static inline float quantisedFeatureScale(double L2HysThreshold) {
+	return (float) (127. / (2. * L2HysThreshold));
+}
+
+/**
+ * Quantises normalised HOG blocks
+ * @param blocks one block per row, CV_32F
+ * @param L2HysThreshold clipping threshold of the block normalisation
+ * @param quantised receives the blocks as CV_8U
+ */
+static inline void quantiseBlocks(const cv::Mat& blocks, double L2HysThreshold, cv::Mat& quantised) {
+	const float scale = quantisedFeatureScale(L2HysThreshold);
+	quantised.create(blocks.rows, blocks.cols, CV_8U);
+	for (int g = 0; g < blocks.rows; ++g) {
+		const float* x = blocks.ptr<float>(g);
+		uint8_t* q = quantised.ptr<uint8_t>(g);
+		for (int i = 0; i < blocks.cols; ++i)
+			q[i] = (uint8_t) std::min(std::max(cvRound(x[i] * scale), 0), 127);
+	}
+}
+
+// Inverse of quantiseBlocks, up to the quantisation error
+static inline void dequantiseBlocks(const cv::Mat& quantised, double L2HysThreshold, cv::Mat& blocks) {
+	quantised.convertTo(blocks, CV_32F, 1. / quantisedFeatureScale(L2HysThreshold));
+}
+
+// Fixed point version of the per block weights of a linear HOG detector,
+// scored against blocks quantised by quantiseBlocks. The weights are
+// calibrated on the detector itself: the largest magnitude maps to the
+// largest int8 / int16 value, so no calibration images are needed.
+class
+QuantisedWeights{
+private:
+	int _bits;
+	float _featureScale;
+	float _weightScale;
+	cv::Mat _weights;      // one row per block of the window, CV_8S or CV_16S
+
+public:
+	QuantisedWeights():
+	_bits(0), _featureScale(0.f), _weightScale(0.f){
+	}
+
+	bool empty() const { return _bits == 0; }
+	int getBits() const { return _bits; }
+	float getWeightScale() const { return _weightScale; }
+	const cv::Mat& getWeights() const { return _weights; }
+
+	/**
+	 * Calibrates the fixed point scale and quantises the weights
+	 * @param blockWeights one row of weights per block of the window (K x blockHistogramSize, CV_32F)
+	 * @param L2HysThreshold clipping threshold of the block normalisation
+	 * @param bits 8 or 16 bit weights, 0 disables quantisation
+	 */
+	bool calibrate(const cv::Mat& blockWeights, double L2HysThreshold, int bits) {
+		_weights.release();
+		_bits = 0;
+		if (bits == 0)
+			return true;
+		if (bits != 8 && bits != 16) {
+			printf("Error: Quantised weights must have 8 or 16 bits, not %d!\n", bits);
+			return false;
+		}
+		const double maxWeight = cv::norm(blockWeights, cv::NORM_INF);
+		if (maxWeight <= 0.) {
+			printf("Error: Can not quantise an all zero detector!\n");
+			return false;
+		}
+		_bits = bits;
+		_featureScale = quantisedFeatureScale(L2HysThreshold);
+		_weightScale = (float) ((bits == 8 ? 127. : 32767.) / maxWeight);
+		blockWeights.convertTo(_weights, bits == 8 ? CV_8S : CV_16S, _weightScale);
+		return true;
+	}
+
+	/**
+	 * Dot products of every weight row with every quantised block
+	 * @param quantised quantised blocks (G x blockHistogramSize, CV_8U)
+	 * @param responses receives K x G, CV_32F, in the scale of the float detector
+	 */
+	void blockResponses(const cv::Mat& quantised, cv::Mat& responses) const {
+		const int blocks = _weights.rows;
+		const int n = _weights.cols;
+		responses.create(blocks, quantised.rows, CV_32F);
+		const float scale = 1.f / (_featureScale * _weightScale);
+		for (int g = 0; g < quantised.rows; ++g) {
+			const uint8_t* x = quantised.ptr<uint8_t>(g);
+			if (_bits == 8) {
+				for (int k = 0; k < blocks; ++k)
+					responses.ptr<float>(k)[g] = dotU8S8(x, _weights.ptr<int8_t>(k), n) * scale;
+			} else {
+				for (int k = 0; k < blocks; ++k)
+					responses.ptr<float>(k)[g] = dotU8S16(x, _weights.ptr<int16_t>(k), n) * scale;
+			}
+		}
+	}
+};
+
+#endif
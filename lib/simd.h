@@ -0,0 +1,68 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+// Vectorised float kernels for the dense linear SVM code paths. The widest
+// instruction set enabled at compile time is used (AVX / SSE), with a plain
+// C++ fallback for everything else.
+#if defined(__AVX__)
+  #include <immintrin.h>
+#elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+  #include <xmmintrin.h>
+  #define SIMD_USE_SSE
+#endif
+
+// Sum of a[i] * b[i], i = 0..n-1
+static inline float dotProduct(const float* a, const float* b, int n) {
+	int i = 0;
+	float sum = 0.f;
+#if defined(__AVX__)
+	__m256 acc0 = _mm256_setzero_ps();
+	__m256 acc1 = _mm256_setzero_ps();
+	for (; i + 16 <= n; i += 16) {
+  #if defined(__FMA__)
+		acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+		acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+  #else
+		acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+		acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8)));
+  #endif
+	}
+	acc0 = _mm256_add_ps(acc0, acc1);
+	__m128 acc = _mm_add_ps(_mm256_castps256_ps128(acc0), _mm256_extractf128_ps(acc0, 1));
+	acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+	acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+	sum = _mm_cvtss_f32(acc);
+#elif defined(SIMD_USE_SSE)
+	__m128 acc0 = _mm_setzero_ps();
+	__m128 acc1 = _mm_setzero_ps();
+	for (; i + 8 <= n; i += 8) {
+		acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+		acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+	}
+	__m128 acc = _mm_add_ps(acc0, acc1);
+	acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+	acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+	sum = _mm_cvtss_f32(acc);
+#endif
+	for (; i < n; ++i)
+		sum += a[i] * b[i];
+	return sum;
+}
+
+// y[i] += s * x[i], i = 0..n-1
+static inline void addScaled(float* y, const float* x, float s, int n) {
+	int i = 0;
+#if defined(__AVX__)
+	const __m256 scale = _mm256_set1_ps(s);
+	for (; i + 8 <= n; i += 8)
+		_mm256_storeu_ps(y + i, _mm256_add_ps(_mm256_loadu_ps(y + i), _mm256_mul_ps(scale, _mm256_loadu_ps(x + i))));
+#elif defined(SIMD_USE_SSE)
+	const __m128 scale = _mm_set1_ps(s);
+	for (; i + 4 <= n; i += 4)
+		_mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i), _mm_mul_ps(scale, _mm_loadu_ps(x + i))));
+#endif
+	for (; i < n; ++i)
+		y[i] += s * x[i];
+}
+
+#endif
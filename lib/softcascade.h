@@ -0,0 +1,267 @@
+#ifndef SOFTCASCADE_H
+#define SOFTCASCADE_H
+
+#include <stdio.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+#include <opencv2/opencv.hpp>
+#include "simd.h"
+
+// Training outcome of a soft cascade, measured on the training features
+struct SoftCascadeTrainingStats {
+	unsigned long positives;           // positives detected by the full detector
+	unsigned long positivesRejected;   // of these, rejected by the trace
+	unsigned long negatives;
+	unsigned long negativesRejected;
+	double averageBlocksNegatives;     // blocks evaluated per negative before rejection or acceptance
+};
+
+// Soft cascade over the blocks of a linear HOG detector: the block sum
+// sum_k w_k * x_k of the decision value rho + sum_k w_k * x_k is accumulated
+// block by block in order of discriminative power, and a window is
+// abandoned as soon as its partial sum after t blocks falls below the
+// rejection trace value trace[t]. The trace is learnt by direct backward
+// pruning: it is the minimum partial sum of the training positives the full
+// detector accepts (block sum >= sumThreshold = hitThreshold - rho), after
+// dropping the missRate fraction of positives with the lowest partial sums.
+// It is valid for any detection with hitThreshold - rho >= sumThreshold.
+//
+// File layout: SoftCascadeHeader, int32 order[blocks], float trace[blocks].
+struct SoftCascadeHeader {
+	char magic[4];          // "PDSC"
+	uint32_t version;
+	uint32_t blocks;
+	uint32_t blockHistogramSize;
+	float sumThreshold;     // block sum threshold (hitThreshold - rho) the trace was trained for
+	float missRate;
+};
+
+static const char softCascadeMagic[4] = {'P', 'D', 'S', 'C'};
+static const uint32_t softCascadeVersion = 1;
+
+class
+SoftCascade{
+private:
+	std::vector<int> _order;      // block indices (descriptor order) by descending discriminative power
+	std::vector<float> _trace;    // minimum partial sum after each block of _order
+	int _blockHistogramSize;
+	float _sumThreshold;
+	float _missRate;
+
+public:
+	SoftCascade():
+	_blockHistogramSize(0), _sumThreshold(0.f), _missRate(0.f){
+	}
+
+	bool empty() const { return _order.empty(); }
+	int getBlockCount() const { return (int) _order.size(); }
+	int getBlockHistogramSize() const { return _blockHistogramSize; }
+	const std::vector<int>& getOrder() const { return _order; }
+	const std::vector<float>& getTrace() const { return _trace; }
+	float getSumThreshold() const { return _sumThreshold; }
+
+	// True if the trace may be used for a detector with this threshold and rho
+	bool validFor(double hitThreshold, float rho) const {
+		return !empty() && hitThreshold - rho >= _sumThreshold - 1e-6;
+	}
+
+	/**
+	 * Learns block order and rejection trace
+	 * @param weights one row of block weights per block, in descriptor order (K x blockHistogramSize, CV_32F)
+	 * @param rho constant term of the decision value
+	 * @param features training feature vectors, count x (K * blockHistogramSize), row-major
+	 * @param labels > 0 for positives
+	 * @param count number of training vectors
+	 * @param hitThreshold detection threshold of the detector
+	 * @param missRate fraction of the detected training positives the trace may reject
+	 * @param stats optional training outcome
+	 */
+	bool train(const cv::Mat& weights, float rho, const float* features, const float* labels, size_t count,
+		double hitThreshold, double missRate, SoftCascadeTrainingStats* stats = NULL) {
+		const int blocks = weights.rows;
+		const int blockSize = weights.cols;
+		const int dimension = blocks * blockSize;
+
+		// Per block contributions of every example
+		std::vector<float> contributions(count * blocks);
+		std::vector<size_t> positives, negatives;
+		for (size_t i = 0; i < count; ++i) {
+			const float* x = features + i * dimension;
+			float* c = &contributions[i * blocks];
+			float score = rho;
+			for (int k = 0; k < blocks; ++k) {
+				c[k] = dotProduct(weights.ptr<float>(k), x + k * blockSize, blockSize);
+				score += c[k];
+			}
+			if (labels[i] > 0) {
+				if (score >= hitThreshold)
+					positives.push_back(i);
+			} else {
+				negatives.push_back(i);
+			}
+		}
+		if (positives.empty()) {
+			printf("Error: No training positive is detected at threshold %g, can not train a soft cascade!\n", hitThreshold);
+			return false;
+		}
+
+		// Discriminative power: separation of the block contribution on positives and negatives
+		std::vector<std::pair<double, int> > power(blocks);
+		for (int k = 0; k < blocks; ++k) {
+			double posMean = 0., posSq = 0., negMean = 0., negSq = 0.;
+			for (size_t p = 0; p < positives.size(); ++p) {
+				const double c = contributions[positives[p] * blocks + k];
+				posMean += c;
+				posSq += c * c;
+			}
+			posMean /= positives.size();
+			double variance = posSq / positives.size() - posMean * posMean;
+			if (!negatives.empty()) {
+				for (size_t i = 0; i < negatives.size(); ++i) {
+					const double c = contributions[negatives[i] * blocks + k];
+					negMean += c;
+					negSq += c * c;
+				}
+				negMean /= negatives.size();
+				variance = 0.5 * (variance + negSq / negatives.size() - negMean * negMean);
+			}
+			power[k] = std::make_pair(-(posMean - negMean) / std::sqrt(std::max(variance, 1e-12)), k);
+		}
+		std::sort(power.begin(), power.end());
+		_order.resize(blocks);
+		for (int k = 0; k < blocks; ++k)
+			_order[k] = power[k].second;
+
+		// Partial sums of the detected positives in cascade order
+		const size_t n = positives.size();
+		std::vector<float> partial(n * blocks);
+		std::vector<double> mean(blocks, 0.), deviation(blocks, 0.);
+		for (size_t p = 0; p < n; ++p) {
+			const float* c = &contributions[positives[p] * blocks];
+			float sum = 0.f;
+			for (int t = 0; t < blocks; ++t) {
+				sum += c[_order[t]];
+				partial[p * blocks + t] = sum;
+				mean[t] += sum;
+				deviation[t] += (double) sum * sum;
+			}
+		}
+		for (int t = 0; t < blocks; ++t) {
+			mean[t] /= n;
+			deviation[t] = std::sqrt(std::max(deviation[t] / n - mean[t] * mean[t], 1e-12));
+		}
+		// Drop the positives whose trajectory dips lowest relative to the others
+		std::vector<std::pair<double, size_t> > lowest(n);
+		for (size_t p = 0; p < n; ++p) {
+			double z = 1e30;
+			for (int t = 0; t < blocks; ++t)
+				z = std::min(z, (partial[p * blocks + t] - mean[t]) / deviation[t]);
+			lowest[p] = std::make_pair(z, p);
+		}
+		std::sort(lowest.begin(), lowest.end());
+		const size_t dropped = std::min((size_t) (std::max(missRate, 0.) * n), n - 1);
+		_trace.assign(blocks, 1e30f);
+		for (size_t i = dropped; i < n; ++i) {
+			const float* s = &partial[lowest[i].second * blocks];
+			for (int t = 0; t < blocks; ++t)
+				_trace[t] = std::min(_trace[t], s[t]);
+		}
+		_blockHistogramSize = blockSize;
+		_sumThreshold = (float) (hitThreshold - rho);
+		_missRate = (float) missRate;
+
+		if (stats) {
+			*stats = SoftCascadeTrainingStats();
+			stats->positives = n;
+			for (size_t p = 0; p < n; ++p)
+				stats->positivesRejected += evaluatedBlocks(&contributions[positives[p] * blocks]) < 0;
+			stats->negatives = negatives.size();
+			unsigned long blocksEvaluated = 0;
+			for (size_t i = 0; i < negatives.size(); ++i) {
+				const int evaluated = evaluatedBlocks(&contributions[negatives[i] * blocks]);
+				stats->negativesRejected += evaluated < 0;
+				blocksEvaluated += evaluated < 0 ? -evaluated : blocks;
+			}
+			stats->averageBlocksNegatives = negatives.empty() ? 0. : (double) blocksEvaluated / negatives.size();
+		}
+		return true;
+	}
+
+	// Runs the trace on per block contributions, returns -(blocks evaluated) if rejected, else the block count
+	int evaluatedBlocks(const float* contributions) const {
+		float sum = 0.f;
+		for (int t = 0; t < (int) _order.size(); ++t) {
+			sum += contributions[_order[t]];
+			if (sum < _trace[t])
+				return -(t + 1);
+		}
+		return (int) _order.size();
+	}
+
+	bool save(const std::string& fileName) const {
+		SoftCascadeHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, softCascadeMagic, sizeof(header.magic));
+		header.version = softCascadeVersion;
+		header.blocks = (uint32_t) _order.size();
+		header.blockHistogramSize = _blockHistogramSize;
+		header.sumThreshold = _sumThreshold;
+		header.missRate = _missRate;
+		FILE* f = fopen(fileName.c_str(), "wb");
+		if (f == NULL) {
+			printf("Could not open file %s for writing\n", fileName.c_str());
+			return false;
+		}
+		std::vector<int32_t> order(_order.begin(), _order.end());
+		bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+		ok = ok && (order.empty() || fwrite(&order[0], sizeof(int32_t), order.size(), f) == order.size());
+		ok = ok && (_trace.empty() || fwrite(&_trace[0], sizeof(float), _trace.size(), f) == _trace.size());
+		ok = (fclose(f) == 0) && ok;
+		if (!ok) printf("Error writing soft cascade %s\n", fileName.c_str());
+		return ok;
+	}
+
+	bool load(const std::string& fileName) {
+		FILE* f = fopen(fileName.c_str(), "rb");
+		if (f == NULL) {
+			printf("Could not open soft cascade %s\n", fileName.c_str());
+			return false;
+		}
+		SoftCascadeHeader header;
+		bool ok = fread(&header, sizeof(header), 1, f) == 1
+			&& memcmp(header.magic, softCascadeMagic, sizeof(header.magic)) == 0
+			&& header.version == softCascadeVersion && header.blocks > 0;
+		std::vector<int32_t> order;
+		if (ok) {
+			order.resize(header.blocks);
+			_trace.resize(header.blocks);
+			ok = fread(&order[0], sizeof(int32_t), order.size(), f) == order.size()
+				&& fread(&_trace[0], sizeof(float), _trace.size(), f) == _trace.size();
+		}
+		fclose(f);
+		// The order must be a permutation of the blocks, a repeated block would skip another one
+		std::vector<bool> seen(ok ? header.blocks : 0, false);
+		for (size_t t = 0; ok && t < order.size(); ++t) {
+			ok = order[t] >= 0 && order[t] < (int32_t) header.blocks && !seen[order[t]];
+			if (ok)
+				seen[order[t]] = true;
+		}
+		if (!ok) {
+			printf("File %s is not a valid soft cascade\n", fileName.c_str());
+			_order.clear();
+			_trace.clear();
+			return false;
+		}
+		_order.assign(order.begin(), order.end());
+		_blockHistogramSize = header.blockHistogramSize;
+		_sumThreshold = header.sumThreshold;
+		_missRate = header.missRate;
+		return true;
+	}
+};
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+// Bounded lock-free single producer / single consumer ring buffer. push()
+// blocks while the queue is full, which gives backpressure to the producing
+// stage; pop() blocks while it is empty until the producer closes the queue.
+// Exactly one thread may push and one thread may pop. A blocked side first
+// yields for a few rounds, which keeps the hand-over latency low while the
+// pipeline is busy, then sleeps with growing intervals so that an idle or
+// stalled queue does not keep a core spinning.
+template <typename T>
+class SpscQueue {
+public:
+	explicit SpscQueue(size_t capacity = 8):
+	_ring(roundUpPow2(capacity + 1)), _mask(_ring.size() - 1), _head(0), _tail(0), _closed(false){
+	}
+
+	// Returns false if the item could not be queued without waiting
+	bool tryPush(const T& item) {
+		const size_t tail = _tail.load(std::memory_order_relaxed);
+		const size_t next = (tail + 1) & _mask;
+		if (next == _head.load(std::memory_order_acquire))
+			return false;
+		_ring[tail] = item;
+		_tail.store(next, std::memory_order_release);
+		return true;
+	}
+
+	void push(const T& item) {
+		for (unsigned int spins = 0; !tryPush(item); ++spins)
+			backoff(spins);
+	}
+
+	bool tryPop(T& item) {
+		const size_t head = _head.load(std::memory_order_relaxed);
+		if (head == _tail.load(std::memory_order_acquire))
+			return false;
+		item = _ring[head];
+		_head.store((head + 1) & _mask, std::memory_order_release);
+		return true;
+	}
+
+	// Returns false once the queue is closed and drained
+	bool pop(T& item) {
+		for (unsigned int spins = 0;; ++spins) {
+			if (tryPop(item))
+				return true;
+			if (_closed.load(std::memory_order_acquire))
+				return tryPop(item);
+			backoff(spins);
+		}
+	}
+
+	// Called by the producer after its last push
+	void close() {
+		_closed.store(true, std::memory_order_release);
+	}
+
+private:
+	// Yielding rounds before a waiting side starts to sleep
+	static const unsigned int yieldSpins = 64;
+	// Longest sleep between two polls of a waiting side
+	static const unsigned int maxSleepUs = 1000;
+
+	static void backoff(unsigned int spins) {
+		if (spins < yieldSpins) {
+			std::this_thread::yield();
+			return;
+		}
+		const unsigned int shift = std::min(spins - yieldSpins, 10u);
+		std::this_thread::sleep_for(std::chrono::microseconds(std::min(1u << shift, maxSleepUs)));
+	}
+
+	static size_t roundUpPow2(size_t n) {
+		size_t p = 2;
+		while (p < n) p <<= 1;
+		return p;
+	}
+
+	std::vector<T> _ring;
+	const size_t _mask;
+	// Producer and consumer indices on separate cache lines, padded rather
+	// than alignas(64) since C++11 new does not honour extended alignment
+	char _pad0[64];
+	std::atomic<size_t> _head;
+	char _pad1[64 - sizeof(std::atomic<size_t>)];
+	std::atomic<size_t> _tail;
+	char _pad2[64 - sizeof(std::atomic<size_t>)];
+	std::atomic<bool> _closed;
+};
+
+#endif
@@ -0,0 +1,220 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// Scoped stage timing, compiled in with -DPD_TRACING (CMake option
+// PD_TRACING) and compiled out completely otherwise:
+//
+//   PD_TRACE_SCOPE("hog.compute");          span until the end of the scope
+//   PD_TRACE_COUNTER("samples", count);     counter sample
+//   PD_TRACE_START("trace.json");           at exit: write a Chrome trace and print a summary table
+//
+// Spans nest and carry the id of their thread. Every thread appends to its
+// own buffer without locking; the buffers are only read at exit, after the
+// worker threads are joined. The Chrome trace JSON opens in chrome://tracing
+// or https://ui.perfetto.dev.
+
+#ifdef PD_TRACING
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <string>
+#include <map>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <stdint.h>
+
+struct TraceEvent {
+	const char* name;     // string literal
+	int64_t start;        // ns since the start of the trace
+	int64_t duration;     // ns, < 0 for counters
+	double value;         // counter value
+	int depth;            // nesting level of spans on the thread
+};
+
+class
+Tracer{
+public:
+	struct ThreadBuffer {
+		int thread;
+		int depth;
+		std::vector<TraceEvent> events;
+	};
+
+private:
+	std::chrono::steady_clock::time_point _origin;
+	std::mutex _mutex;
+	std::vector<ThreadBuffer*> _buffers;
+	std::string _fileName;
+
+	Tracer():
+	_origin(std::chrono::steady_clock::now()){
+	}
+
+	static void dumpAtExit() {
+		Tracer& tracer = instance();
+		tracer.printSummary();
+		if (!tracer._fileName.empty())
+			tracer.writeChromeTrace(tracer._fileName);
+	}
+
+public:
+	static Tracer& instance() {
+		static Tracer* theInstance = new Tracer(); // Never destroyed, threads may still trace during exit
+		return *theInstance;
+	}
+
+	// Buffer of the calling thread, registered on first use
+	ThreadBuffer& buffer() {
+		static thread_local ThreadBuffer* threadBuffer = NULL;
+		if (threadBuffer == NULL) {
+			std::lock_guard<std::mutex> lock(_mutex);
+			threadBuffer = new ThreadBuffer();
+			threadBuffer->thread = (int) _buffers.size();
+			threadBuffer->depth = 0;
+			threadBuffer->events.reserve(4096);
+			_buffers.push_back(threadBuffer);
+		}
+		return *threadBuffer;
+	}
+
+	int64_t now() const {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _origin).count();
+	}
+
+	void counter(const char* name, double value) {
+		ThreadBuffer& b = buffer();
+		TraceEvent event = {name, now(), -1, value, b.depth};
+		b.events.push_back(event);
+	}
+
+	/**
+	 * Writes the trace and prints the summary when the program exits
+	 * @param fileName Chrome trace JSON file, empty for the summary only
+	 */
+	void start(const std::string& fileName) {
+		_fileName = fileName;
+		atexit(&Tracer::dumpAtExit);
+	}
+
+	bool writeChromeTrace(const std::string& fileName) {
+		FILE* f = fopen(fileName.c_str(), "w");
+		if (f == NULL) {
+			printf("Could not open file %s for writing\n", fileName.c_str());
+			return false;
+		}
+		std::lock_guard<std::mutex> lock(_mutex);
+		fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+		bool first = true;
+		for (size_t t = 0; t < _buffers.size(); ++t) {
+			const std::vector<TraceEvent>& events = _buffers[t]->events;
+			for (size_t i = 0; i < events.size(); ++i) {
+				const TraceEvent& e = events[i];
+				if (e.duration >= 0) {
+					fprintf(f, "%s{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+						first ? "" : ",\n", e.name, _buffers[t]->thread, e.start / 1000., e.duration / 1000.);
+				} else {
+					fprintf(f, "%s{\"name\": \"%s\", \"ph\": \"C\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"args\": {\"value\": %.17g}}",
+						first ? "" : ",\n", e.name, _buffers[t]->thread, e.start / 1000., e.value);
+				}
+				first = false;
+			}
+		}
+		fprintf(f, "\n]}\n");
+		const bool ok = fclose(f) == 0;
+		if (ok) {
+			printf("Trace written to '%s'\n", fileName.c_str());
+		} else {
+			printf("Error writing trace %s\n", fileName.c_str());
+		}
+		return ok;
+	}
+
+	// Per span name: calls, threads, total, mean and maximum time, by descending total, and the counter maxima
+	void printSummary() {
+		struct Summary {
+			unsigned long calls;
+			double totalMs, maxMs;
+			int depth;
+			std::vector<int> threads;
+			double maxValue;
+		};
+		std::map<std::string, Summary> spans, counters;
+		std::lock_guard<std::mutex> lock(_mutex);
+		for (size_t t = 0; t < _buffers.size(); ++t) {
+			const std::vector<TraceEvent>& events = _buffers[t]->events;
+			for (size_t i = 0; i < events.size(); ++i) {
+				const TraceEvent& e = events[i];
+				std::map<std::string, Summary>& table = e.duration >= 0 ? spans : counters;
+				std::map<std::string, Summary>::iterator it = table.find(e.name);
+				if (it == table.end()) {
+					Summary s = {0, 0., 0., e.depth, std::vector<int>(), e.value};
+					it = table.insert(std::make_pair(std::string(e.name), s)).first;
+				}
+				Summary& s = it->second;
+				++s.calls;
+				s.totalMs += std::max<int64_t>(e.duration, 0) / 1e6;
+				s.maxMs = std::max(s.maxMs, e.duration / 1e6);
+				s.depth = std::min(s.depth, e.depth);
+				s.maxValue = std::max(s.maxValue, e.value);
+				if (std::find(s.threads.begin(), s.threads.end(), _buffers[t]->thread) == s.threads.end())
+					s.threads.push_back(_buffers[t]->thread);
+			}
+		}
+		std::vector<std::pair<double, std::string> > order;
+		for (std::map<std::string, Summary>::const_iterator it = spans.begin(); it != spans.end(); ++it)
+			order.push_back(std::make_pair(-it->second.totalMs, it->first));
+		std::sort(order.begin(), order.end());
+		printf("\n%-40s %10s %8s %12s %12s %12s\n", "Span", "calls", "threads", "total ms", "mean ms", "max ms");
+		for (size_t i = 0; i < order.size(); ++i) {
+			const Summary& s = spans[order[i].second];
+			printf("%-40s %10lu %8lu %12.2f %12.4f %12.4f\n", (std::string(2 * s.depth, ' ') + order[i].second).c_str(),
+				s.calls, (unsigned long) s.threads.size(), s.totalMs, s.totalMs / s.calls, s.maxMs);
+		}
+		for (std::map<std::string, Summary>::const_iterator it = counters.begin(); it != counters.end(); ++it)
+			printf("%-40s %10lu samples, maximum %g\n", it->first.c_str(), it->second.calls, it->second.maxValue);
+	}
+};
+
+// Records a span from construction to destruction
+class
+TraceScope{
+private:
+	const char* _name;
+	Tracer::ThreadBuffer& _buffer;
+	int64_t _start;
+
+	TraceScope(const TraceScope&);
+	TraceScope& operator=(const TraceScope&);
+
+public:
+	explicit TraceScope(const char* name):
+	_name(name), _buffer(Tracer::instance().buffer()){
+		++_buffer.depth;
+		_start = Tracer::instance().now();
+	}
+
+	~TraceScope() {
+		const int64_t end = Tracer::instance().now();
+		--_buffer.depth;
+		TraceEvent event = {_name, _start, end - _start, 0., _buffer.depth};
+		_buffer.events.push_back(event);
+	}
+};
+
+#define PD_TRACE_CONCAT_(a, b) a##b
+#define PD_TRACE_CONCAT(a, b) PD_TRACE_CONCAT_(a, b)
+#define PD_TRACE_SCOPE(name) TraceScope PD_TRACE_CONCAT(traceScope, __LINE__)(name)
+#define PD_TRACE_COUNTER(name, value) Tracer::instance().counter(name, (double) (value))
+#define PD_TRACE_START(fileName) Tracer::instance().start(fileName)
+
+#else
+
+#define PD_TRACE_SCOPE(name) do {} while (0)
+#define PD_TRACE_COUNTER(name, value) do {} while (0)
+#define PD_TRACE_START(fileName) do {} while (0)
+
+#endif
+
+#endif
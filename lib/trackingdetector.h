@@ -0,0 +1,190 @@
+#ifndef TRACKINGDETECTOR_H
+#define TRACKINGDETECTOR_H
+
+#include <stdio.h>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <opencv2/opencv.hpp>
+#include "blockgriddetector.h"
+
+struct TrackingDetectorParams {
+	// A full frame scan every keyframeInterval frames, 1 scans every frame
+	int keyframeInterval;
+	// Search region around a track, as fraction of its size added on every side
+	double searchMargin;
+	// Pyramid levels searched around the scale of a track, on each side
+	int scaleSteps;
+	double scale0;
+	// A track whose best score is below hitThreshold + uncertaintyMargin forces a full scan on the next frame
+	double uncertaintyMargin;
+	// Minimum overlap (intersection over union) of a track with its position in the previous frame
+	double minOverlap;
+	double hitThreshold;
+	cv::Size winStride;
+	cv::Size padding;
+
+	TrackingDetectorParams():
+	keyframeInterval(10), searchMargin(0.25), scaleSteps(1), scale0(1.05), uncertaintyMargin(0.25), minOverlap(0.3),
+	hitThreshold(0.), winStride(8, 8), padding(8, 8){
+	}
+};
+
+struct TrackingDetectorStats {
+	unsigned long frames;
+	unsigned long keyframes;
+	unsigned long forcedKeyframes;   // full scans before the interval because a track was lost or uncertain
+	unsigned long regionsSearched;
+};
+
+// Detection on consecutive video frames which scans the full frame only on
+// keyframes. In between, each detection of the previous frame is followed by
+// evaluating the detector in a small region around it at a narrow band of
+// scales, which is a fraction of the windows of a full pyramid. A full scan
+// is forced as soon as a track is lost or its score gets close to the
+// threshold. New pedestrians are picked up on the next keyframe.
+class
+TrackingDetector{
+private:
+	struct Track {
+		cv::Rect rect;
+		double score;
+	};
+
+	const BlockGridDetector& _detector;
+	TrackingDetectorParams _params;
+	std::vector<Track> _tracks;
+	int _framesSinceKeyframe;
+	bool _forceKeyframe;
+	TrackingDetectorStats _stats;
+
+	static double overlap(const cv::Rect& a, const cv::Rect& b) {
+		const double intersection = (a & b).area();
+		return intersection > 0 ? intersection / (a.area() + b.area() - intersection) : 0.;
+	}
+
+	/**
+	 * Searches the best window around a track
+	 * @param frame current frame
+	 * @param track track of the previous frame, updated on success
+	 * @return false if no window in the search region scores above the threshold
+	 */
+	bool follow(const cv::Mat& frame, Track& track) {
+		const cv::Size winSize = _detector.getDescriptor().winSize;
+		const int marginX = cvRound(track.rect.width * _params.searchMargin);
+		const int marginY = cvRound(track.rect.height * _params.searchMargin);
+		const cv::Rect region = cv::Rect(track.rect.x - marginX, track.rect.y - marginY,
+			track.rect.width + 2 * marginX, track.rect.height + 2 * marginY) & cv::Rect(0, 0, frame.cols, frame.rows);
+		if (region.area() == 0)
+			return false;
+		++_stats.regionsSearched;
+		const cv::Mat crop = frame(region);
+		const double trackScale = (double) track.rect.height / winSize.height;
+
+		bool found = false;
+		Track best = track;
+		best.score = -1e30;
+		std::vector<cv::Point> hits;
+		std::vector<double> weights;
+		cv::Mat scaled;
+		double previousScale = 0.;
+		for (int step = -_params.scaleSteps; step <= _params.scaleSteps; ++step) {
+			// The pyramid does not upsample, scales below 1 are clamped
+			const double scale = std::max(1., trackScale * std::pow(_params.scale0, step));
+			if (scale == previousScale)
+				continue;
+			previousScale = scale;
+			const cv::Size scaledSize(cvRound(crop.cols / scale), cvRound(crop.rows / scale));
+			if (scaledSize.width < winSize.width || scaledSize.height < winSize.height)
+				continue;
+			if (scaledSize == crop.size()) {
+				scaled = crop;
+			} else {
+				cv::resize(crop, scaled, scaledSize, 0, 0, cv::INTER_LINEAR);
+			}
+			_detector.detect(scaled, hits, weights, _params.hitThreshold, _params.winStride, _params.padding);
+			for (size_t i = 0; i < hits.size(); ++i) {
+				const cv::Rect rect(region.x + cvRound(hits[i].x * scale), region.y + cvRound(hits[i].y * scale),
+					cvRound(winSize.width * scale), cvRound(winSize.height * scale));
+				if (weights[i] > best.score && overlap(rect, track.rect) >= _params.minOverlap) {
+					best.rect = rect;
+					best.score = weights[i];
+					found = true;
+				}
+			}
+		}
+		if (found)
+			track = best;
+		return found;
+	}
+
+public:
+	TrackingDetector(const BlockGridDetector& detector, const TrackingDetectorParams& params = TrackingDetectorParams()):
+	_detector(detector), _params(params){
+		reset();
+	}
+
+	// Forget all tracks, the next frame is a keyframe
+	void reset() {
+		_tracks.clear();
+		_framesSinceKeyframe = 0;
+		_forceKeyframe = true;
+		_stats = TrackingDetectorStats();
+	}
+
+	const TrackingDetectorStats& getStats() const { return _stats; }
+
+	/**
+	 * Detects in the next frame of a sequence
+	 * @param frame current frame
+	 * @param found detections of the frame
+	 * @param foundWeights decision values of the detections
+	 * @return true if the frame was a full scan
+	 */
+	bool detect(const cv::Mat& frame, std::vector<cv::Rect>& found, std::vector<double>& foundWeights) {
+		++_stats.frames;
+		found.clear();
+		foundWeights.clear();
+		const bool keyframe = _forceKeyframe || _framesSinceKeyframe + 1 >= _params.keyframeInterval;
+		if (keyframe) {
+			if (_forceKeyframe && _framesSinceKeyframe + 1 < _params.keyframeInterval && _stats.frames > 1)
+				++_stats.forcedKeyframes;
+			++_stats.keyframes;
+			_framesSinceKeyframe = 0;
+			_forceKeyframe = false;
+			_detector.detectMultiScale(frame, found, foundWeights, _params.hitThreshold, _params.winStride, _params.padding, _params.scale0);
+			_tracks.resize(found.size());
+			for (size_t i = 0; i < found.size(); ++i) {
+				_tracks[i].rect = found[i];
+				_tracks[i].score = foundWeights[i];
+			}
+			return true;
+		}
+
+		++_framesSinceKeyframe;
+		std::vector<Track> tracks;
+		for (size_t t = 0; t < _tracks.size(); ++t) {
+			Track track = _tracks[t];
+			if (!follow(frame, track)) {
+				_forceKeyframe = true;
+				continue;
+			}
+			if (track.score < _params.hitThreshold + _params.uncertaintyMargin)
+				_forceKeyframe = true;
+			// Two tracks converging on the same pedestrian are merged
+			bool duplicate = false;
+			for (size_t k = 0; k < tracks.size() && !duplicate; ++k)
+				duplicate = overlap(tracks[k].rect, track.rect) > 0.5;
+			if (!duplicate)
+				tracks.push_back(track);
+		}
+		_tracks.swap(tracks);
+		for (size_t t = 0; t < _tracks.size(); ++t) {
+			found.push_back(_tracks[t].rect);
+			foundWeights.push_back(_tracks[t].score);
+		}
+		return false;
+	}
+};
+
+#endif
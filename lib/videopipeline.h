@@ -0,0 +1,245 @@
+#ifndef VIDEOPIPELINE_H
+#define VIDEOPIPELINE_H
+
+#include <stdio.h>
+#include <vector>
+#include <string>
+#include <thread>
+#include <algorithm>
+#include <stdint.h>
+#include <opencv2/opencv.hpp>
+#include "spscqueue.h"
+#include "blockgriddetector.h"
+
+struct VideoPipelineParams {
+	// Frames are resized to this size before detection, empty keeps the input size
+	cv::Size frameSize;
+	int interpolation;
+	// Detection worker threads, 0 = one per CPU core
+	unsigned int workers;
+	// Capacity of every inter-stage queue
+	unsigned int queueCapacity;
+	double hitThreshold;
+	cv::Size winStride;
+	cv::Size padding;
+	double scale0;
+	// Text file with one line of detections per frame, empty = none
+	std::string detectionsFile;
+	// Annotated output video, empty = none
+	std::string annotatedVideoFile;
+
+	VideoPipelineParams():
+	frameSize(960, 640), interpolation(cv::INTER_LINEAR), workers(0), queueCapacity(4), hitThreshold(0.),
+	winStride(8, 8), padding(8, 8), scale0(1.05){
+	}
+};
+
+// Headless video detection split into decode, preprocess, detect and sink
+// stages connected by bounded lock-free queues:
+//
+//   decode -> preprocess -> detect worker 0..n-1 -> sink
+//
+// Preprocess hands frame i to worker i % n over a queue per worker and the
+// sink collects from the workers in the same round-robin order, so every
+// queue has a single producer and consumer and the frames leave the
+// pipeline in order without any reordering buffer. A full queue stalls its
+// producer, which bounds the frames in flight.
+class
+VideoPipeline{
+private:
+	struct Frame {
+		long index;
+		cv::Mat image;
+		std::vector<cv::Rect> found;
+		std::vector<double> weights;
+		int64_t decodedTicks;
+	};
+
+	// Busy time and frame count of one stage
+	struct StageStats {
+		const char* name;
+		unsigned long frames;
+		int64_t busyTicks;
+	};
+
+	const BlockGridDetector& _detector;
+	VideoPipelineParams _params;
+
+	static double ticksToMs(int64_t ticks) {
+		return ticks * 1000. / cv::getTickFrequency();
+	}
+
+	static void printStage(const StageStats& stage, double wallSeconds, unsigned int threads) {
+		const double busyMs = ticksToMs(stage.busyTicks);
+		printf("%-12s %8lu frames %9.2f ms/frame %9.1f fps capacity %6.1f%% busy\n", stage.name, stage.frames,
+			stage.frames ? busyMs / stage.frames : 0., busyMs > 0 ? stage.frames * threads * 1000. / busyMs : 0.,
+			wallSeconds > 0 ? busyMs / (wallSeconds * 10. * threads) : 0.);
+	}
+
+	void decodeStage(cv::VideoCapture& capture, SpscQueue<Frame*>& out, StageStats& stats) {
+		for (long index = 0; ; ++index) {
+			const int64_t start = cv::getTickCount();
+			Frame* frame = new Frame();
+			if (!capture.read(frame->image) || frame->image.empty()) {
+				delete frame;
+				break;
+			}
+			frame->index = index;
+			frame->decodedTicks = start;
+			stats.busyTicks += cv::getTickCount() - start;
+			++stats.frames;
+			out.push(frame);
+		}
+		out.close();
+	}
+
+	void preprocessStage(SpscQueue<Frame*>& in, std::vector<SpscQueue<Frame*>*>& out, StageStats& stats) {
+		Frame* frame;
+		for (size_t next = 0; in.pop(frame); next = (next + 1) % out.size()) {
+			const int64_t start = cv::getTickCount();
+			if (!_params.frameSize.empty() && frame->image.size() != _params.frameSize)
+				cv::resize(frame->image, frame->image, _params.frameSize, 0, 0, _params.interpolation);
+			stats.busyTicks += cv::getTickCount() - start;
+			++stats.frames;
+			out[next]->push(frame);
+		}
+		for (size_t w = 0; w < out.size(); ++w)
+			out[w]->close();
+	}
+
+	void detectStage(SpscQueue<Frame*>& in, SpscQueue<Frame*>& out, StageStats& stats) {
+		Frame* frame;
+		while (in.pop(frame)) {
+			const int64_t start = cv::getTickCount();
+			_detector.detectMultiScale(frame->image, frame->found, frame->weights, _params.hitThreshold,
+				_params.winStride, _params.padding, _params.scale0);
+			stats.busyTicks += cv::getTickCount() - start;
+			++stats.frames;
+			out.push(frame);
+		}
+		out.close();
+	}
+
+public:
+	VideoPipeline(const BlockGridDetector& detector, const VideoPipelineParams& params = VideoPipelineParams()):
+	_detector(detector), _params(params){
+		if (_params.workers == 0)
+			_params.workers = std::max(1, cv::getNumberOfCPUs());
+	}
+
+	// Runs the pipeline over a whole video, returns false if input or outputs can not be opened
+	bool run(const std::string& videoFile) {
+		cv::VideoCapture capture(videoFile);
+		if (!capture.isOpened()) {
+			printf("Error: Could not open video '%s'!\n", videoFile.c_str());
+			return false;
+		}
+		FILE* detections = NULL;
+		if (!_params.detectionsFile.empty()) {
+			detections = fopen(_params.detectionsFile.c_str(), "w");
+			if (detections == NULL) {
+				printf("Could not open file %s for writing\n", _params.detectionsFile.c_str());
+				return false;
+			}
+			fprintf(detections, "# frame count x y width height score ...\n");
+		}
+		cv::VideoWriter writer;
+		double fps = capture.get(cv::CAP_PROP_FPS);
+		if (fps <= 0)
+			fps = 25.;
+
+		// The workers run the detection single threaded each, no nested OpenCV threads
+		const int previousThreads = cv::getNumThreads();
+		cv::setNumThreads(1);
+
+		const unsigned int workers = _params.workers;
+		SpscQueue<Frame*> decoded(_params.queueCapacity);
+		std::vector<SpscQueue<Frame*>*> workIn, workOut;
+		for (unsigned int w = 0; w < workers; ++w) {
+			workIn.push_back(new SpscQueue<Frame*>(_params.queueCapacity));
+			workOut.push_back(new SpscQueue<Frame*>(_params.queueCapacity));
+		}
+		StageStats decodeStats = {"decode", 0, 0};
+		StageStats preprocessStats = {"preprocess", 0, 0};
+		StageStats sinkStats = {"sink", 0, 0};
+		std::vector<StageStats> detectStats(workers);
+		for (unsigned int w = 0; w < workers; ++w) {
+			StageStats s = {"detect", 0, 0};
+			detectStats[w] = s;
+		}
+
+		const int64_t startTicks = cv::getTickCount();
+		std::vector<std::thread> threads;
+		threads.push_back(std::thread(&VideoPipeline::decodeStage, this, std::ref(capture), std::ref(decoded), std::ref(decodeStats)));
+		threads.push_back(std::thread(&VideoPipeline::preprocessStage, this, std::ref(decoded), std::ref(workIn), std::ref(preprocessStats)));
+		for (unsigned int w = 0; w < workers; ++w)
+			threads.push_back(std::thread(&VideoPipeline::detectStage, this, std::ref(*workIn[w]), std::ref(*workOut[w]), std::ref(detectStats[w])));
+
+		// Sink on this thread, collecting the frames in order from the workers
+		std::vector<double> latenciesMs;
+		Frame* frame;
+		for (size_t next = 0; workOut[next]->pop(frame); next = (next + 1) % workers) {
+			const int64_t start = cv::getTickCount();
+			if (detections) {
+				fprintf(detections, "%ld %lu", frame->index, (unsigned long) frame->found.size());
+				for (size_t i = 0; i < frame->found.size(); ++i) {
+					const cv::Rect& r = frame->found[i];
+					fprintf(detections, " %d %d %d %d %.4f", r.x, r.y, r.width, r.height, i < frame->weights.size() ? frame->weights[i] : 0.);
+				}
+				fprintf(detections, "\n");
+			}
+			if (!_params.annotatedVideoFile.empty()) {
+				if (!writer.isOpened() && !writer.open(_params.annotatedVideoFile, cv::VideoWriter::fourcc('M', 'J', 'P', 'G'), fps, frame->image.size())) {
+					printf("Error: Could not open video '%s' for writing!\n", _params.annotatedVideoFile.c_str());
+					_params.annotatedVideoFile.clear();
+				}
+				if (writer.isOpened()) {
+					for (size_t i = 0; i < frame->found.size(); ++i)
+						cv::rectangle(frame->image, frame->found[i].tl(), frame->found[i].br(), cv::Scalar(64, 255, 64), 3);
+					writer.write(frame->image);
+				}
+			}
+			const int64_t done = cv::getTickCount();
+			sinkStats.busyTicks += done - start;
+			++sinkStats.frames;
+			latenciesMs.push_back(ticksToMs(done - frame->decodedTicks));
+			delete frame;
+		}
+		for (size_t t = 0; t < threads.size(); ++t)
+			threads[t].join();
+		const double wallSeconds = ticksToMs(cv::getTickCount() - startTicks) / 1000.;
+		for (unsigned int w = 0; w < workers; ++w) {
+			delete workIn[w];
+			delete workOut[w];
+		}
+		if (detections)
+			fclose(detections);
+		writer.release();
+		cv::setNumThreads(previousThreads);
+
+		// Report
+		StageStats detectTotal = {"detect", 0, 0};
+		for (unsigned int w = 0; w < workers; ++w) {
+			detectTotal.frames += detectStats[w].frames;
+			detectTotal.busyTicks += detectStats[w].busyTicks;
+		}
+		printf("Processed %lu frames in %.2f s, %.1f fps end to end with %u detection workers\n",
+			sinkStats.frames, wallSeconds, wallSeconds > 0 ? sinkStats.frames / wallSeconds : 0., workers);
+		printStage(decodeStats, wallSeconds, 1);
+		printStage(preprocessStats, wallSeconds, 1);
+		printStage(detectTotal, wallSeconds, workers);
+		printStage(sinkStats, wallSeconds, 1);
+		if (!latenciesMs.empty()) {
+			std::sort(latenciesMs.begin(), latenciesMs.end());
+			double sum = 0.;
+			for (size_t i = 0; i < latenciesMs.size(); ++i)
+				sum += latenciesMs[i];
+			printf("Frame latency: mean %.2f ms, p50 %.2f ms, p99 %.2f ms, max %.2f ms\n", sum / latenciesMs.size(),
+				latenciesMs[latenciesMs.size() / 2], latenciesMs[std::min(latenciesMs.size() - 1, latenciesMs.size() * 99 / 100)],
+				latenciesMs.back());
+		}
+		return true;
+	}
+};
+
+#endif
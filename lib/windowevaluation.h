@@ -0,0 +1,280 @@
+#ifndef WINDOWEVALUATION_H
+#define WINDOWEVALUATION_H
+
+#include <stdio.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cmath>
+#include <opencv2/opencv.hpp>
+#include "orderedpipeline.h"
+#include "windowpack.h"
+#include "simd.h"
+#include "trace.h"
+
+// One point of a detection error tradeoff curve: windows scoring at least
+// threshold are detections
+struct DetPoint {
+	double threshold;
+	double missRate;      // fraction of positive windows scoring below threshold
+	double fppw;          // false positives per window, fraction of negative windows scoring at least threshold
+};
+
+// Raw decision values of labelled test windows. Scored once, every
+// threshold dependent figure (DET / ROC curve, miss rate at a fixed false
+// positive per window rate, best threshold) is derived from the sorted
+// scores without touching the images again.
+class
+WindowScores{
+private:
+	std::vector<float> _positives;    // ascending once sorted
+	std::vector<float> _negatives;
+	bool _sorted;
+
+	void sort() {
+		if (_sorted)
+			return;
+		std::sort(_positives.begin(), _positives.end());
+		std::sort(_negatives.begin(), _negatives.end());
+		_sorted = true;
+	}
+
+	// Positive windows scoring below threshold
+	size_t misses(double threshold) const {
+		return std::lower_bound(_positives.begin(), _positives.end(), threshold) - _positives.begin();
+	}
+
+	// Negative windows scoring at least threshold
+	size_t falsePositives(double threshold) const {
+		return _negatives.end() - std::lower_bound(_negatives.begin(), _negatives.end(), threshold);
+	}
+
+public:
+	WindowScores():
+	_sorted(true){
+	}
+
+	void add(bool positive, float score) {
+		(positive ? _positives : _negatives).push_back(score);
+		_sorted = false;
+	}
+
+	void clear() {
+		_positives.clear();
+		_negatives.clear();
+		_sorted = true;
+	}
+
+	size_t positives() const { return _positives.size(); }
+	size_t negatives() const { return _negatives.size(); }
+
+	/**
+	 * Full DET curve, one point per distinct score, by descending threshold
+	 * @param curve receives the points
+	 */
+	void detCurve(std::vector<DetPoint>& curve) {
+		sort();
+		curve.clear();
+		std::vector<float> thresholds(_positives);
+		thresholds.insert(thresholds.end(), _negatives.begin(), _negatives.end());
+		std::sort(thresholds.begin(), thresholds.end());
+		thresholds.erase(std::unique(thresholds.begin(), thresholds.end()), thresholds.end());
+		// Sweep both sorted score lists once from the top
+		size_t missed = _positives.size(), accepted = 0;
+		for (size_t i = thresholds.size(); i-- > 0; ) {
+			while (missed > 0 && _positives[missed - 1] >= thresholds[i])
+				--missed;
+			while (accepted < _negatives.size() && _negatives[_negatives.size() - 1 - accepted] >= thresholds[i])
+				++accepted;
+			DetPoint point = {thresholds[i], _positives.empty() ? 0. : (double) missed / _positives.size(),
+				_negatives.empty() ? 0. : (double) accepted / _negatives.size()};
+			curve.push_back(point);
+		}
+	}
+
+	// Miss rate and false positives per window of a threshold
+	DetPoint at(double threshold) {
+		sort();
+		DetPoint point = {threshold, _positives.empty() ? 0. : (double) misses(threshold) / _positives.size(),
+			_negatives.empty() ? 0. : (double) falsePositives(threshold) / _negatives.size()};
+		return point;
+	}
+
+	/**
+	 * Lowest miss rate with at most the given false positives per window
+	 * @param fppw false positives per window
+	 * @return the operating point, with the lowest threshold that keeps to the rate
+	 */
+	DetPoint atFppw(double fppw) {
+		sort();
+		const size_t allowed = (size_t) std::floor(std::max(fppw, 0.) * _negatives.size());
+		// Just above the highest negative that has to be rejected
+		const double threshold = allowed >= _negatives.size() ? -HUGE_VAL
+			: std::nextafter(_negatives[_negatives.size() - 1 - allowed], HUGE_VALF);
+		return at(threshold);
+	}
+
+	/**
+	 * Threshold with the fewest misclassified windows, misses and false positives weighted by the
+	 * inverse of their class size (balanced error)
+	 * @param balancedError optional, receives the mean of miss rate and false positives per window
+	 */
+	DetPoint bestThreshold(double* balancedError = NULL) {
+		std::vector<DetPoint> curve;
+		detCurve(curve);
+		DetPoint best = at(HUGE_VAL);
+		double bestError = 0.5 * (best.missRate + best.fppw);
+		for (size_t i = 0; i < curve.size(); ++i) {
+			const double error = 0.5 * (curve[i].missRate + curve[i].fppw);
+			if (error < bestError) {
+				bestError = error;
+				best = curve[i];
+			}
+		}
+		if (balancedError)
+			*balancedError = bestError;
+		return best;
+	}
+
+	// Area under the ROC curve: probability that a positive window outscores a negative one
+	double rocArea() {
+		sort();
+		if (_positives.empty() || _negatives.empty())
+			return 0.;
+		double wins = 0.;
+		for (size_t i = 0; i < _positives.size(); ++i) {
+			const size_t below = std::lower_bound(_negatives.begin(), _negatives.end(), _positives[i]) - _negatives.begin();
+			const size_t ties = std::upper_bound(_negatives.begin(), _negatives.end(), _positives[i]) - _negatives.begin() - below;
+			wins += below + 0.5 * ties;
+		}
+		return wins / ((double) _positives.size() * _negatives.size());
+	}
+
+	/**
+	 * Writes the DET curve as CSV: threshold, miss rate, false positives per window
+	 * @param fileName output file
+	 */
+	bool saveCurve(const std::string& fileName) {
+		std::vector<DetPoint> curve;
+		detCurve(curve);
+		FILE* f = fopen(fileName.c_str(), "w");
+		if (f == NULL) {
+			printf("Could not open file %s for writing\n", fileName.c_str());
+			return false;
+		}
+		fprintf(f, "threshold,miss_rate,fppw\n");
+		for (size_t i = 0; i < curve.size(); ++i)
+			fprintf(f, "%.9g,%.9g,%.9g\n", curve[i].threshold, curve[i].missRate, curve[i].fppw);
+		const bool ok = fclose(f) == 0;
+		if (!ok) printf("Error writing DET curve %s\n", fileName.c_str());
+		return ok;
+	}
+};
+
+// Scores labelled test images with a linear HOG detector on a worker pool,
+// every image is decoded once and all of its windows are scored with one
+// descriptor computation and one dot product per window. A positive image
+// larger than the window is scored on its centred window, a negative image
+// on every window of the stride grid. The images of a window pack are
+// scored the same way without decoding.
+class
+WindowScorer : public OrderedPipeline<std::vector<float> >{
+private:
+	const cv::HOGDescriptor& _hog;
+	const std::vector<std::string>* _posFileNames;
+	const std::vector<std::string>* _negFileNames;
+	const WindowPack* _pack;
+	cv::Size _winStride;
+	WindowScores& _scores;
+	size_t _skipped;
+
+	bool positive(size_t item) const { return _pack ? _pack->getLabel(item) > 0 : item < _posFileNames->size(); }
+
+	const std::string& fileName(size_t item) const {
+		return positive(item) ? (*_posFileNames)[item] : (*_negFileNames)[item - _posFileNames->size()];
+	}
+
+	// Decision values of all windows of an image
+	void scoreWindows(const cv::Mat& image, std::vector<float>& windowScores) const {
+		PD_TRACE_SCOPE("score windows");
+		std::vector<float> descriptors;
+		_hog.compute(image, descriptors, _winStride, cv::Size(0, 0));
+		const size_t descriptorSize = _hog.getDescriptorSize();
+		const float rho = _hog.svmDetector.size() > descriptorSize ? _hog.svmDetector[descriptorSize] : 0.f;
+		const size_t windows = descriptors.size() / descriptorSize;
+		for (size_t w = 0; w < windows; ++w)
+			windowScores.push_back(rho + dotProduct(&_hog.svmDetector[0], &descriptors[w * descriptorSize], (int) descriptorSize));
+	}
+
+protected:
+	void process(size_t item, std::vector<float>& windowScores) {
+		windowScores.clear();
+		cv::Mat image;
+		if (_pack) {
+			image = _pack->getImage(item);
+		} else {
+			PD_TRACE_SCOPE("decode");
+			image = cv::imread(fileName(item), cv::IMREAD_GRAYSCALE);
+		}
+		const cv::Size winSize = _hog.winSize;
+		if (image.cols < winSize.width || image.rows < winSize.height)
+			return;
+		if (positive(item) && image.size() != winSize)
+			image = image(cv::Rect((image.cols - winSize.width) / 2, (image.rows - winSize.height) / 2, winSize.width, winSize.height));
+		scoreWindows(image, windowScores);
+	}
+
+	void consume(size_t item, std::vector<float>& windowScores) {
+		if (windowScores.empty()) {
+			if (_pack) {
+				printf("Error: Packed test image %lu is smaller than the HOG window, skipped!\n", (unsigned long) item);
+			} else {
+				printf("Error: Test image '%s' is empty or smaller than the HOG window, skipped!\n", fileName(item).c_str());
+			}
+			++_skipped;
+		}
+		for (size_t w = 0; w < windowScores.size(); ++w)
+			_scores.add(positive(item), windowScores[w]);
+	}
+
+public:
+	/**
+	 * @param hog geometry and detector (svmDetector, optionally with rho appended)
+	 * @param posFileNames positive test images
+	 * @param negFileNames negative test images
+	 * @param winStride window stride on negative images
+	 * @param scores receives the decision values of all windows
+	 */
+	WindowScorer(const cv::HOGDescriptor& hog, const std::vector<std::string>& posFileNames, const std::vector<std::string>& negFileNames,
+		const cv::Size& winStride, WindowScores& scores):
+	_hog(hog), _posFileNames(&posFileNames), _negFileNames(&negFileNames), _pack(NULL), _winStride(winStride), _scores(scores), _skipped(0){
+	}
+
+	/**
+	 * @param hog geometry and detector (svmDetector, optionally with rho appended)
+	 * @param pack labelled test images, packed for the HOG window size
+	 * @param winStride window stride on negative images
+	 * @param scores receives the decision values of all windows
+	 */
+	WindowScorer(const cv::HOGDescriptor& hog, const WindowPack& pack, const cv::Size& winStride, WindowScores& scores):
+	_hog(hog), _posFileNames(NULL), _negFileNames(NULL), _pack(&pack), _winStride(winStride), _scores(scores), _skipped(0){
+	}
+
+	// Scores all images on workerCount threads (0 = one per CPU), returns the number of images scored
+	size_t score(unsigned int workerCount = 0) {
+		_skipped = 0;
+		if (_hog.svmDetector.size() < _hog.getDescriptorSize()) {
+			printf("Error: HOG descriptor has no detector set, nothing to evaluate!\n");
+			return 0;
+		}
+		if (_pack && _pack->getWindowSize() != _hog.winSize) {
+			printf("Error: Window pack does not match the HOG window size!\n");
+			return 0;
+		}
+		const size_t images = _pack ? _pack->getCount() : _posFileNames->size() + _negFileNames->size();
+		run(images, workerCount);
+		return images - _skipped;
+	}
+};
+
+#endif
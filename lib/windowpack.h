@@ -0,0 +1,272 @@
+#ifndef WINDOWPACK_H
+#define WINDOWPACK_H
+
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <opencv2/opencv.hpp>
+#include "mappedfile.h"
+#include "orderedpipeline.h"
+#include "featurestore.h"
+#include "trace.h"
+
+// Pre-decoded training or test images, so feature extraction and
+// evaluation run without an image decoder. Layout (little endian):
+//
+//   WindowPackHeader
+//   uint8 pixels[]                        at pixelsOffset, 8 bit grayscale images back to back
+//   WindowPackRecord records[count]       at recordsOffset, position and size of every image
+//   float labels[count]                   at labelsOffset
+//
+// The three arrays are 64 byte aligned; the file is mmap'ed and every image
+// is used in place as cv::Mat. Every image holds at least one window, a
+// training sample is exactly one window (4.6 KB for 48x96), test images
+// are stored whole.
+struct WindowPackHeader {
+	char magic[4];          // "PDWP"
+	uint32_t version;
+	int32_t width, height;  // window size
+	uint64_t count;
+	uint64_t positives;
+	uint64_t negatives;
+	uint64_t pixelsOffset;
+	uint64_t recordsOffset;
+	uint64_t labelsOffset;
+	uint32_t reserved[2];
+};
+
+struct WindowPackRecord {
+	uint64_t offset;        // of the first pixel, relative to pixelsOffset
+	int32_t width, height;
+};
+
+static const char windowPackMagic[4] = {'P', 'D', 'W', 'P'};
+// Version 1 held window sized tiles only
+static const uint32_t windowPackVersion = 2;
+
+// Streams images into a new pack. The records and labels follow the pixels,
+// so the number of images does not have to be known in advance.
+class
+WindowPackWriter{
+private:
+	FILE* _file;
+	WindowPackHeader _header;
+	std::vector<WindowPackRecord> _records;
+	std::vector<float> _labels;
+	uint64_t _pixelBytes;
+	std::string _fileName;
+
+	WindowPackWriter(const WindowPackWriter&);
+	WindowPackWriter& operator=(const WindowPackWriter&);
+
+public:
+	WindowPackWriter():
+	_file(NULL), _pixelBytes(0){
+	}
+
+	~WindowPackWriter(){
+		close();
+	}
+
+	// Create the pack file for images holding windows of the given size
+	bool open(const std::string& fileName, const cv::Size& winSize){
+		close();
+		_fileName = fileName;
+		_file = fopen(fileName.c_str(), "wb");
+		if(_file == NULL){
+			printf("Could not open file %s for writing\n", fileName.c_str());
+			return false;
+		}
+		memset(&_header, 0, sizeof(_header));
+		memcpy(_header.magic, windowPackMagic, sizeof(_header.magic));
+		_header.version = windowPackVersion;
+		_header.width = winSize.width;
+		_header.height = winSize.height;
+		_header.pixelsOffset = alignFeatureStoreOffset(sizeof(WindowPackHeader));
+		_records.clear();
+		_labels.clear();
+		_pixelBytes = 0;
+		// Images are appended sequentially starting at the pixels offset
+		return seekFeatureStore(_file, _header.pixelsOffset);
+	}
+
+	// Append one image, 8 bit grayscale of at least the pack window size
+	bool append(float label, const cv::Mat& image){
+		if(_file == NULL || image.type() != CV_8UC1 || image.cols < _header.width || image.rows < _header.height){
+			return false;
+		}
+		for(int y = 0; y < image.rows; ++y){
+			if(fwrite(image.ptr<uint8_t>(y), 1, image.cols, _file) != (size_t) image.cols){
+				printf("Error writing image to %s\n", _fileName.c_str());
+				return false;
+			}
+		}
+		const WindowPackRecord record = {_pixelBytes, image.cols, image.rows};
+		_records.push_back(record);
+		_pixelBytes += (uint64_t) image.cols * image.rows;
+		_labels.push_back(label);
+		if(label > 0) _header.positives++;
+		else if(label < 0) _header.negatives++;
+		return true;
+	}
+
+	// Write records, labels and the final header, returns false on I/O errors.
+	bool close(){
+		if(_file == NULL) return true;
+		_header.count = _labels.size();
+		_header.recordsOffset = alignFeatureStoreOffset(_header.pixelsOffset + _pixelBytes);
+		_header.labelsOffset = alignFeatureStoreOffset(_header.recordsOffset + _header.count * sizeof(WindowPackRecord));
+		bool ok = seekFeatureStore(_file, _header.recordsOffset);
+		if(ok && !_records.empty())
+			ok = fwrite(&_records[0], sizeof(WindowPackRecord), _records.size(), _file) == _records.size();
+		ok = ok && seekFeatureStore(_file, _header.labelsOffset);
+		if(ok && !_labels.empty())
+			ok = fwrite(&_labels[0], sizeof(float), _labels.size(), _file) == _labels.size();
+		ok = ok && seekFeatureStore(_file, 0);
+		ok = ok && fwrite(&_header, sizeof(_header), 1, _file) == 1;
+		ok = (fclose(_file) == 0) && ok;
+		_file = NULL;
+		return ok;
+	}
+
+	uint64_t getCount() const { return _labels.size(); }
+	uint64_t getPixelBytes() const { return _pixelBytes; }
+};
+
+// Read-only, memory mapped access to a window pack.
+class
+WindowPack{
+private:
+	MappedFile _mapping;
+	const WindowPackHeader* _header;
+
+	const WindowPackRecord& record(size_t idx) const {
+		return ((const WindowPackRecord*) (_mapping.data() + _header->recordsOffset))[idx];
+	}
+
+public:
+	WindowPack():
+	_header(NULL){
+	}
+
+	// Map a pack file and validate its header.
+	bool open(const std::string& fileName){
+		_header = NULL;
+		if(!_mapping.open(fileName)){
+			printf("Could not open window pack %s\n", fileName.c_str());
+			return false;
+		}
+		const WindowPackHeader* header = (const WindowPackHeader*) _mapping.data();
+		bool ok = _mapping.size() >= sizeof(WindowPackHeader)
+			&& memcmp(header->magic, windowPackMagic, sizeof(header->magic)) == 0
+			&& header->version == windowPackVersion
+			&& header->width > 0 && header->height > 0
+			&& header->count <= _mapping.size()
+			&& header->pixelsOffset <= header->recordsOffset
+			&& header->recordsOffset + header->count * sizeof(WindowPackRecord) <= header->labelsOffset
+			&& header->labelsOffset + header->count * sizeof(float) <= _mapping.size();
+		_header = header;
+		// Every image must lie within the pixels and hold a window
+		const uint64_t pixelBytes = ok ? header->recordsOffset - header->pixelsOffset : 0;
+		for(size_t i = 0; ok && i < header->count; ++i){
+			const WindowPackRecord& r = record(i);
+			ok = r.width >= header->width && r.height >= header->height
+				&& r.offset <= pixelBytes && (uint64_t) r.width * r.height <= pixelBytes - r.offset;
+		}
+		if(!ok){
+			printf("File %s is not a valid window pack, run pd build-packs\n", fileName.c_str());
+			_header = NULL;
+			_mapping.close();
+			return false;
+		}
+		return true;
+	}
+
+	bool isOpen() const { return _header != NULL; }
+	size_t getCount() const { return _header ? _header->count : 0; }
+	size_t getPositivesCount() const { return _header ? _header->positives : 0; }
+	size_t getNegativesCount() const { return _header ? _header->negatives : 0; }
+	cv::Size getWindowSize() const { return cv::Size(_header->width, _header->height); }
+
+	// Zero-copy access into the mapping, the images must not be written to
+	float getLabel(size_t idx) const { return ((const float*) (_mapping.data() + _header->labelsOffset))[idx]; }
+	cv::Mat getImage(size_t idx) const {
+		const WindowPackRecord& r = record(idx);
+		return cv::Mat(r.height, r.width, CV_8UC1, (void*) (_mapping.data() + _header->pixelsOffset + r.offset));
+	}
+};
+
+// An image to pack
+struct WindowPackSample {
+	std::string path;
+	float label;
+	cv::Rect region;      // sample region within the image, empty for the whole image
+};
+
+// Decodes the images of a sample list on a worker pool and writes them to a
+// pack in sample order. A sample region is cut out and resized to the
+// window, an image of the window size is one window. Larger images are
+// skipped like in the feature extraction, or for test sets stored whole,
+// so the evaluation scores them exactly like the image files.
+class
+WindowPackBuilder : public OrderedPipeline<cv::Mat>{
+private:
+	const std::vector<WindowPackSample>& _samples;
+	cv::Size _winSize;
+	WindowPackWriter& _writer;
+	bool _wholeImages;
+	size_t _skipped;
+
+protected:
+	void process(size_t item, cv::Mat& packed) {
+		packed = cv::Mat();
+		const WindowPackSample& sample = _samples[item];
+		cv::Mat image;
+		{
+			PD_TRACE_SCOPE("decode");
+			image = cv::imread(sample.path, cv::IMREAD_GRAYSCALE);
+		}
+		if (image.empty())
+			return;
+		if (sample.region.area() > 0) {
+			const cv::Rect region = sample.region & cv::Rect(0, 0, image.cols, image.rows);
+			if (region.area() == 0)
+				return;
+			cv::resize(image(region), packed, _winSize, 0, 0, cv::INTER_AREA);
+		} else if (image.size() == _winSize || (_wholeImages && image.cols >= _winSize.width && image.rows >= _winSize.height)) {
+			packed = image;
+		}
+	}
+
+	void consume(size_t item, cv::Mat& packed) {
+		if (packed.empty()) {
+			printf("Error: Image '%s' is empty or does not fit the window, skipped!\n", _samples[item].path.c_str());
+			++_skipped;
+		} else {
+			_writer.append(_samples[item].label, packed);
+		}
+		packed = cv::Mat();
+	}
+
+public:
+	/**
+	 * @param samples images to pack
+	 * @param winSize window size
+	 * @param writer opened pack
+	 * @param wholeImages store images larger than the window as they are instead of skipping them
+	 */
+	WindowPackBuilder(const std::vector<WindowPackSample>& samples, const cv::Size& winSize, WindowPackWriter& writer, bool wholeImages):
+	_samples(samples), _winSize(winSize), _writer(writer), _wholeImages(wholeImages), _skipped(0){
+	}
+
+	// Packs all samples on workerCount threads (0 = one per CPU), returns the number of images skipped
+	size_t build(unsigned int workerCount = 0) {
+		_skipped = 0;
+		run(_samples.size(), workerCount);
+		return _skipped;
+	}
+};
+
+#endif
@@ -1,8 +1,4 @@
 #include <stdio.h>
-#include <dirent.h>
-#ifdef __MINGW32__
-#include <sys/stat.h>
-#endif
 #include <ios>
 #include <fstream>
 #include <stdexcept>
@@ -11,12 +7,35 @@
 #include <opencv2/ml/ml.hpp>
 #include <opencv2/core/core.hpp>
 #include "lib/common.h"
-#include "lib/ImageDatabase.h"
+#include "lib/imagedatabase.h"
+#include "lib/orderedpipeline.h"
+#include "lib/featurestore.h"
 #include "thirdparty/svmlight/svmlight.h"
+#include "lib/linearsvm.h"
+#include "lib/hardnegativeminer.h"
+#include "lib/featurecache.h"
+#include "lib/detectormodel.h"
+#include "lib/detectionservice.h"
+#include "lib/blockgriddetector.h"
+#include "lib/videopipeline.h"
+#include "lib/trackingdetector.h"
+#include "lib/detectorset.h"
+#include "lib/nms.h"
+#include "lib/windowevaluation.h"
+#include "lib/trace.h"
+#include "lib/datasetwalker.h"
+#include "lib/windowpack.h"
+#include "lib/hogmirror.h"
 
 #define SVMLIGHT 1
+#define LINEARSVM 2
+// Training backend, LINEARSVM uses the built-in dense dual coordinate descent solver
 #define TRAINHOG_USEDSVM SVMLIGHT
+#if TRAINHOG_USEDSVM == SVMLIGHT
 #define TRAINHOG_SVM_TO_TRAIN SVMlight
+#else
+#define TRAINHOG_SVM_TO_TRAIN LinearSVM
+#endif
 
 using namespace cv;
 using namespace std;
@@ -31,18 +50,98 @@ static string posTestDir = "../pedestrian-detector/data/test/pos/";
 static string negTestDir = "../pedestrian-detector/data/test/neg/";
 // Directory containing detect test images
 static string detectTestDir = "../pedestrian-detector/data/test/detect/";
-// Set the file to write the features to
+// Directory containing full-size negative images (no pedestrians) for hard negative mining
+static string negMiningDir = "../pedestrian-detector/data/train/neg_full/";
+// Index of the training samples (label, path, optional bounding box, feature store row), written by every training run
+static string trainingDatabaseFile = "../pedestrian-detector/genfiles/trainingset.db";
+// Take the training samples from trainingDatabaseFile instead of walking the sample directories, e.g. after pd import-database
+static const bool trainFromDatabase = false;
+// Feed the database samples in a random order instead of the database order, the same seed gives the same order
+static const bool shuffleTrainingSamples = false;
+static const uint64_t sampleOrderSeed = 1;
+// Add the horizontal mirror image of every positive training sample, its HOG descriptor is derived by permutation
+static const bool mirrorPositives = false;
+// Pre-decoded training and test windows, written by pd build-packs
+static string trainingPackFile = "../pedestrian-detector/genfiles/training.pack";
+static string testPackFile = "../pedestrian-detector/genfiles/test.pack";
+// Read the training and test windows from the window packs instead of decoding the image files
+static const bool useWindowPacks = false;
+// Directory of the dataset manifests, later runs only re-list the directories that changed
+static string manifestDir = "../pedestrian-detector/genfiles/manifests/";
+// Directory of the persistent HOG feature cache
+static string featureCacheDir = "../pedestrian-detector/genfiles/featurecache/";
+// Set the binary feature store file to write the features to
+static string featureStoreFile = "../pedestrian-detector/genfiles/features.bin";
+// Keep the extracted features as feature store file, training itself does not need it
+static const bool writeFeatureStore = false;
+// Set the file to export the features to in SVMlight text format
 static string featuresFile = "../pedestrian-detector/genfiles/features.dat";
+// Additionally export the features as SVMlight text, e.g. for training with the svm_learn binary (implies writeFeatureStore)
+static const bool exportFeaturesText = false;
 // Set the file to write the SVM model to
 static string svmModelFile = "../pedestrian-detector/genfiles/svmlightmodel.dat";
+// Set the file to write the resulting binary detector model to
+static string detectorModelFile = "../pedestrian-detector/genfiles/detector.bin";
 // Set the file to write the resulting detecting descriptor vector to
 static string descriptorVectorFile = "../pedestrian-detector/genfiles/descriptorvector.dat";
 // Set the file to write the resulting opencv hog classifier as YAML file
 static string cvHOGFile = "../pedestrian-detector/genfiles/cvHOGClassifier.yaml";
+// Block order and rejection trace for early rejection of background windows
+static string softCascadeFile = "../pedestrian-detector/genfiles/softcascade.bin";
+// DET curve of the evaluation on the test set (threshold, miss rate, false positives per window)
+static string evaluationCurveFile = "../pedestrian-detector/genfiles/det.csv";
+// Chrome trace of the stages of a run, written at exit together with a summary table when built with PD_TRACING
+static string traceFile = "../pedestrian-detector/genfiles/trace.json";
 
 // HOG parameters for training that for some reason are not included in the HOG class
 static const Size trainingPadding = Size(0, 0);
 static const Size winStride = Size(8, 8);
+// Number of worker threads used for feature extraction, 0 uses one per CPU core
+static const unsigned int extractionThreads = 0;
+// Threads listing dataset directories, more than CPUs pay off on network file systems
+static const unsigned int walkerThreads = 16;
+// Serve unchanged training images from the feature cache instead of recomputing their HOG features
+static const bool useFeatureCache = true;
+// Size cap of the feature cache, least recently used entries are evicted beyond
+static const unsigned long long featureCacheMaxBytes = 2ULL << 30;
+// Detect with the block grid engine, which scores the HOG blocks once per pyramid level, instead of HOGDescriptor::detectMultiScale
+static const bool useBlockGridDetector = true;
+// Soft cascade: train it after the detector, allowing this fraction of the detected training positives to be rejected early
+static const bool trainSoftCascade = true;
+static const double softCascadeMissRate = 0.01;
+// Score the windows with early rejection by the soft cascade in softCascadeFile
+static const bool useSoftCascade = false;
+// Score on 8 bit block features with 8 or 16 bit fixed point weights calibrated from the detector, 0 = float scoring
+static const int quantisedScoringBits = 0;
+// Grouping of the raw detection windows: score aware greedy IoU non-maximum suppression, or mean-shift (Dalal)
+static const bool useMeanShiftGrouping = false;
+static const double nmsIouThreshold = 0.45;
+// Region of interest of the fixed camera (mask image or .txt polygon list), windows outside are never scanned, empty = whole frame
+static string roiMaskFile = "";
+// Ground plane calibration of the fixed camera: horizon row in a frame of groundPlaneImageHeight rows and camera height
+// above the ground in metres, each pyramid level only scans the rows where pedestrians of its scale can stand. 0 disables it
+static const double groundPlaneHorizonRow = 320.;
+static const double groundPlaneImageHeight = 640.;
+static const double groundPlaneCameraHeight = 0.;
+// Pedestrian height range in metres for the ground plane constraint
+static const double minPedestrianHeight = 1.0;
+static const double maxPedestrianHeight = 2.0;
+// Detection service: worker threads (0 = one per CPU core), each serves one request at a time
+static const unsigned int serviceWorkers = 0;
+// Video pipeline: detection worker threads (0 = one per CPU core) and capacity of the queues between the stages
+static const unsigned int videoWorkers = 0;
+static const unsigned int videoQueueCapacity = 4;
+// Also write the detector as descriptor vector text and OpenCV YAML file
+static const bool exportLegacyDetectorFiles = false;
+// Check the single detecting vector of SVMlight against a brute-force recomputation (slow for many support vectors)
+static const bool validateDetectorVector = false;
+// Hard negative mining: number of mining and retraining rounds, 0 disables mining
+static const int miningRounds = 1;
+// Hard negative mining: per round limits on the number of mined windows and on the time spent
+static const unsigned int maxMinedPerRound = 10000;
+static const double maxMiningSecondsPerRound = 600.;
+// False positive per window rates the evaluation reports the miss rate at
+static const double evaluationFppw[] = {1e-2, 1e-3, 1e-4};
 
 /* Helper functions */
 
@@ -63,82 +162,69 @@ static void resetCursor(void) {
 }
 
 
-static void saveDescriptorVectorToFile(vector<float>& descriptorVector, vector<unsigned int>& _vectorIndices, string fileName) {
-    printf("Saving descriptor vector to file '%s'\n", fileName.c_str());
-    string separator = " "; // Use blank as default separator between single features
-    fstream File;
-    float percent;
-    File.open(fileName.c_str(), ios::out);
-    if (File.good() && File.is_open()) {
-        printf("Saving %lu descriptor vector features:\t", descriptorVector.size());
-        storeCursor();
-        for (int feature = 0; feature < descriptorVector.size(); ++feature) {
-            if ((feature % 10 == 0) || (feature == (descriptorVector.size()-1)) ) {
-                percent = ((1 + feature) * 100 / descriptorVector.size());
-                printf("%4u (%3.0f%%)", feature, percent);
-                fflush(stdout);
-                resetCursor();
-            }
-            File << descriptorVector.at(feature) << separator;
-        }
-        printf("\n");
-        File << endl;
-        File.flush();
-        File.close();
-    }
-}
-
+/**
+ * Lists the sample files below a directory, recursively
+ * @param dirName directory to walk, a manifest of its listing is kept in manifestDir
+ * @param fileNames receives the paths in walk order
+ * @param validExtensions file extensions to collect
+ */
 static void getFilesInDirectory(const string& dirName, vector<string>& fileNames, const vector<string>& validExtensions) {
+    PD_TRACE_SCOPE("getFilesInDirectory");
     printf("Opening directory %s\n", dirName.c_str());
-#ifdef __MINGW32__
-	struct stat s;
-#endif
-    struct dirent* ep;
-    size_t extensionLocation;
-    DIR* dp = opendir(dirName.c_str());
-    if (dp != NULL) {
-        while ((ep = readdir(dp))) {
-            // Ignore (sub-)directories like . , .. , .svn, etc.
-#ifdef __MINGW32__
-			stat(ep->d_name, &s);
-			if (s.st_mode & S_IFDIR) {
-				continue;
-			}
-#else
-            if (ep->d_type & DT_DIR) {
-                continue;
-            }
-#endif
-            extensionLocation = string(ep->d_name).find_last_of("."); // Assume the last point marks beginning of extension like file.ext
-            // Check if extension is matching the wanted ones
-            string tempExt = toLowerCase(string(ep->d_name).substr(extensionLocation + 1));
-            if (find(validExtensions.begin(), validExtensions.end(), tempExt) != validExtensions.end()) {
-                //printf("Found matching data file '%s'\n", ep->d_name);
-                fileNames.push_back((string) dirName + ep->d_name);
-            } else {
-                printf("Found file does not match required file type, skipping: '%s'\n", ep->d_name);
-            }
-        }
-        (void) closedir(dp);
-    } else {
-        printf("Error opening directory '%s'!\n", dirName.c_str());
-    }
-    return;
+    DatasetWalker walker(validExtensions, manifestDir, walkerThreads);
+    walker.list(dirName, fileNames);
 }
 
-static void calculateFeaturesFromInput(const string& imageFilename, vector<float>& featureVector, HOGDescriptor& hog) {
+/**
+ * @param region optional sample region within the image, it is cut out and resized to the HOG window
+ */
+static void calculateFeaturesFromInput(const string& imageFilename, vector<float>& featureVector, const HOGDescriptor& hog, FeatureCache* cache = NULL, const Rect& region = Rect()) {
     /** for imread flags from openCV documentation,
      * @see http://docs.opencv.org/modules/highgui/doc/reading_and_writing_images_and_video.html?highlight=imread#Mat imread(const string& filename, int flags)
      * @note If you get a compile-time error complaining about following line (esp. imread),
      * you either do not have a current openCV version (>2.0)
      * or the linking order is incorrect, try g++ -o openCVHogTrainer main.cpp `pkg-config --cflags --libs opencv`
      */
-    Mat imageData = imread(imageFilename, IMREAD_GRAYSCALE);
+    PD_TRACE_SCOPE("calculateFeaturesFromInput");
+    Mat imageData;
+    uint64_t cacheKey = 0;
+    if (cache) {
+        PD_TRACE_SCOPE("feature cache lookup");
+        // The file content is needed for the cache key anyway, decode from memory on a miss
+        vector<uchar> fileContent;
+        ifstream file(imageFilename.c_str(), ios::in | ios::binary);
+        if (file.good()) {
+            fileContent.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+        }
+        cacheKey = cache->key(fileContent);
+        if (region.area() > 0) {
+            cacheKey = fnv1aHash(&region, sizeof(region), cacheKey);
+        }
+        if (!fileContent.empty() && cache->lookup(cacheKey, featureVector)) {
+            return;
+        }
+        if (!fileContent.empty()) {
+            PD_TRACE_SCOPE("decode");
+            imageData = imdecode(fileContent, IMREAD_GRAYSCALE);
+        }
+    } else {
+        PD_TRACE_SCOPE("decode");
+        imageData = imread(imageFilename, IMREAD_GRAYSCALE);
+    }
     if (imageData.empty()) {
         featureVector.clear();
         printf("Error: HOG image '%s' is empty, features calculation skipped!\n", imageFilename.c_str());
         return;
     }
+    if (region.area() > 0) {
+        const Rect sample = region & Rect(0, 0, imageData.cols, imageData.rows);
+        if (sample.area() == 0) {
+            featureVector.clear();
+            printf("Error: Sample region of image '%s' is outside the image, features calculation skipped!\n", imageFilename.c_str());
+            return;
+        }
+        resize(imageData(sample), imageData, hog.winSize, 0, 0, INTER_AREA);
+    }
     // Check for mismatching dimensions
     if (imageData.cols != hog.winSize.width || imageData.rows != hog.winSize.height) {
         featureVector.clear();
@@ -146,88 +232,1158 @@ static void calculateFeaturesFromInput(const string& imageFilename, vector<float
         return;
     }
     vector<Point> locations;
-    hog.compute(imageData, featureVector, winStride, trainingPadding, locations);
+    {
+        PD_TRACE_SCOPE("hog.compute");
+        hog.compute(imageData, featureVector, winStride, trainingPadding, locations);
+    }
     imageData.release(); // Release the image again after features are extracted
+    if (cache) {
+        cache->insert(cacheKey, featureVector);
+    }
+}
+
+/**
+ * Computes the HOG features of the training samples on a worker pool and hands them
+ * to the trainer in the original sample order, optionally also appending them to a
+ * feature store on disk and indexing them in an image database.
+ * The samples are either read from the directory walks while they are still running
+ * (positives first, then negatives) or from the records of an image database, whose
+ * feature vectors are taken from the feature store rows they reference if it is still
+ * the store the rows were written to.
+ * The order is the same as the one of a serial run, so the results are reproducible.
+ */
+class TrainingFeatureExtractor : public OrderedPipeline<vector<float> > {
+public:
+    TrainingFeatureExtractor(const HOGDescriptor& hog, const DatasetStream& positives, const DatasetStream& negatives, FeatureStoreWriter* store, FeatureCache* cache, ImageDatabaseWriter* index)
+    : _hog(hog), _positives(&positives), _negatives(&negatives), _database(NULL), _order(NULL), _pack(NULL), _storedFeatures(NULL), _store(store), _cache(cache), _index(index),
+      _mirror(NULL), _mirrored(0), _storedRowsUsed(0) {
+    }
+
+    /**
+     * @param database training samples
+     * @param order record order, empty for the database order
+     * @param storedFeatures feature store the feature rows of the records refer to, NULL to compute all features
+     */
+    TrainingFeatureExtractor(const HOGDescriptor& hog, const ImageDatabase& database, const vector<uint32_t>& order, const FeatureStore* storedFeatures,
+            FeatureStoreWriter* store, FeatureCache* cache, ImageDatabaseWriter* index)
+    : _hog(hog), _positives(NULL), _negatives(NULL), _database(&database), _order(&order), _pack(NULL), _storedFeatures(storedFeatures), _store(store), _cache(cache), _index(index),
+      _featureRows(database.getSize(), -1), _mirror(NULL), _mirrored(0), _storedRowsUsed(0) {
+    }
+
+    // Samples from a window pack, nothing is decoded
+    TrainingFeatureExtractor(const HOGDescriptor& hog, const WindowPack& pack, FeatureStoreWriter* store)
+    : _hog(hog), _positives(NULL), _negatives(NULL), _database(NULL), _order(NULL), _pack(&pack), _storedFeatures(NULL), _store(store), _cache(NULL), _index(NULL),
+      _mirror(NULL), _mirrored(0), _storedRowsUsed(0) {
+    }
+
+    // Also add the mirror image of every positive sample, NULL for none
+    void setMirror(const HogMirror* mirror) {
+        _mirror = mirror;
+    }
+
+    // Number of mirrored samples added
+    size_t getMirroredCount() const {
+        return _mirrored;
+    }
+
+    // Number of samples whose features were read from the stored feature rows
+    size_t getStoredRowsUsed() const {
+        return _storedRowsUsed;
+    }
+
+    // Row of every database record in the written feature store, by record, -1 if none
+    const vector<int64_t>& getFeatureRows() const {
+        return _featureRows;
+    }
+
+protected:
+    bool available(size_t currentFile) {
+        string fileName;
+        float label;
+        Rect region;
+        return sample(currentFile, fileName, label, region);
+    }
+
+    void process(size_t currentFile, vector<float>& featureVector) {
+        string fileName;
+        float label;
+        Rect region;
+        if (_pack) {
+            // Only single windows are training samples, whole test images would give several descriptors
+            const Mat window = _pack->getImage(currentFile);
+            if (_pack->getLabel(currentFile) == 0.f || window.size() != _hog.winSize) {
+                return;
+            }
+            PD_TRACE_SCOPE("hog.compute");
+            vector<Point> locations;
+            _hog.compute(window, featureVector, winStride, trainingPadding, locations);
+            return;
+        }
+        sample(currentFile, fileName, label, region);
+        // Unlabeled samples are indexed but not trained on
+        if (label == 0.f) {
+            return;
+        }
+        if (_storedFeatures) {
+            const int64_t row = _database->getFeatureRow(record(currentFile));
+            if (row >= 0 && row < (int64_t) _storedFeatures->getCount() && _storedFeatures->getLabel((uint32_t) row) == label) {
+                const float* features = _storedFeatures->getRow((uint32_t) row);
+                featureVector.assign(features, features + _storedFeatures->getDimension());
+                ++_storedRowsUsed;
+                return;
+            }
+        }
+        calculateFeaturesFromInput(fileName, featureVector, _hog, _cache, region);
+    }
+
+    void consume(size_t currentFile, vector<float>& featureVector) {
+        PD_TRACE_SCOPE("add example");
+        // The total is only known once both walks are done
+        const size_t overallSamples = _pack ? _pack->getCount() : _database ? _database->getSize()
+            : _positives->closed() && _negatives->closed() ? _positives->size() + _negatives->size() : 0;
+        // Output progress
+        if ((currentFile + 1) % 10 == 0 || (currentFile + 1) == overallSamples) {
+            storeCursor();
+            if (overallSamples > 0) {
+                printf("%5lu (%3.0f%%)", (unsigned long) (currentFile + 1), (float) ((currentFile + 1) * 100 / overallSamples));
+            } else {
+                printf("%5lu", (unsigned long) (currentFile + 1));
+            }
+            fflush(stdout);
+            resetCursor();
+        }
+        PD_TRACE_COUNTER("samples extracted", currentFile + 1);
+        // Consumed samples are available, this does not wait
+        string fileName;
+        float label;
+        Rect region;
+        sample(currentFile, fileName, label, region);
+        int64_t featureRow = -1;
+        if (!featureVector.empty() && label != 0.f) {
+            TRAINHOG_SVM_TO_TRAIN::getInstance()->add_example(label, featureVector);
+            if (_store && _store->append(label, featureVector)) {
+                featureRow = _store->getCount() - 1;
+            }
+            if (_mirror && label > 0) {
+                PD_TRACE_SCOPE("mirror");
+                _mirror->apply(featureVector, _mirroredVector);
+                TRAINHOG_SVM_TO_TRAIN::getInstance()->add_example(label, _mirroredVector);
+                if (_store) {
+                    _store->append(label, _mirroredVector);
+                }
+                ++_mirrored;
+            }
+        }
+        if (_index) {
+            _index->add(label, fileName, region, featureRow);
+        }
+        if (_database) {
+            _featureRows[record(currentFile)] = featureRow;
+        }
+    }
+
+private:
+    // Database record of a sample
+    size_t record(size_t currentFile) const {
+        return _order->empty() ? currentFile : (*_order)[currentFile];
+    }
+
+    /**
+     * Get a sample, waits for the walks
+     * @return false after the last sample
+     */
+    bool sample(size_t currentFile, string& fileName, float& label, Rect& region) const {
+        if (_pack) {
+            if (currentFile >= _pack->getCount()) {
+                return false;
+            }
+            label = _pack->getLabel(currentFile);
+            return true;
+        }
+        if (_database) {
+            if (currentFile >= _database->getSize()) {
+                return false;
+            }
+            fileName = _database->getPath(record(currentFile));
+            label = _database->getLabel(record(currentFile));
+            region = _database->getBoundingBox(record(currentFile));
+            return true;
+        }
+        region = Rect();
+        label = +1.f;
+        if (_positives->get(currentFile, fileName)) {
+            return true;
+        }
+        // The positives ended before this sample
+        label = -1.f;
+        return _negatives->get(currentFile - _positives->size(), fileName);
+    }
+
+    const HOGDescriptor& _hog;
+    const DatasetStream* _positives;
+    const DatasetStream* _negatives;
+    const ImageDatabase* _database;
+    const vector<uint32_t>* _order;
+    const WindowPack* _pack;
+    const FeatureStore* _storedFeatures;
+    FeatureStoreWriter* _store;
+    FeatureCache* _cache;
+    ImageDatabaseWriter* _index;
+    vector<int64_t> _featureRows;
+    const HogMirror* _mirror;
+    vector<float> _mirroredVector;
+    size_t _mirrored;
+    std::atomic<size_t> _storedRowsUsed;
+};
+
+/**
+ * Checks the mirror permutation of HOG descriptors against the descriptors of the flipped images
+ * @param fileNames window sized images
+ * @return failure if the permutation is clearly not the mirror image, e.g. after a HOG layout change
+ */
+static int verifyMirrorPermutation(const HOGDescriptor& hog, const vector<string>& fileNames) {
+    HogMirror mirror;
+    if (!mirror.init(hog)) {
+        return EXIT_FAILURE;
+    }
+    vector<float> descriptor, flippedDescriptor, mirrored;
+    vector<Point> locations;
+    Mat flipped;
+    double permutedError = 0., unpermutedError = 0., maxError = 0., computeSeconds = 0., permuteSeconds = 0.;
+    size_t images = 0;
+    for (size_t i = 0; i < fileNames.size(); ++i) {
+        const Mat image = imread(fileNames[i], IMREAD_GRAYSCALE);
+        if (image.size() != hog.winSize) {
+            continue;
+        }
+        hog.compute(image, descriptor, winStride, trainingPadding, locations);
+        int64 start = getTickCount();
+        flip(image, flipped, 1);
+        hog.compute(flipped, flippedDescriptor, winStride, trainingPadding, locations);
+        computeSeconds += (getTickCount() - start) / getTickFrequency();
+        start = getTickCount();
+        mirror.apply(descriptor, mirrored);
+        permuteSeconds += (getTickCount() - start) / getTickFrequency();
+
+        const Mat expected(flippedDescriptor, false);
+        const double expectedNorm = std::max(norm(expected), 1e-12);
+        permutedError += norm(Mat(mirrored, false), expected) / expectedNorm;
+        unpermutedError += norm(Mat(descriptor, false), expected) / expectedNorm;
+        maxError = std::max(maxError, norm(Mat(mirrored, false), expected, NORM_INF));
+        ++images;
+    }
+    if (images == 0) {
+        printf("Error: No images of the window size %dx%d found!\n", hog.winSize.width, hog.winSize.height);
+        return EXIT_FAILURE;
+    }
+    permutedError /= images;
+    unpermutedError /= images;
+    printf("Mirror permutation on %lu images: relative error %.4f (unmirrored descriptor %.4f), largest component error %.4f\n",
+            (unsigned long) images, permutedError, unpermutedError, maxError);
+    printf("Flip and hog.compute %.3f ms, permutation %.4f ms per window (%.0fx)\n",
+            computeSeconds * 1000. / images, permuteSeconds * 1000. / images, computeSeconds / std::max(permuteSeconds, 1e-9));
+    // The remaining error comes from the Gaussian block weights, which are not exactly symmetric
+    return permutedError < 0.1 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * Decodes samples once into a window pack
+ * @param samples images to pack
+ * @param packFile pack file to write
+ * @param testSet store images larger than the window whole, the evaluation scores them like the image files
+ */
+static bool buildWindowPack(const HOGDescriptor& hog, const vector<WindowPackSample>& samples, const string& packFile, bool testSet) {
+    PD_TRACE_SCOPE("buildWindowPack");
+    WindowPackWriter writer;
+    if (!writer.open(packFile, hog.winSize)) {
+        return false;
+    }
+    const int64 start = getTickCount();
+    const size_t skipped = WindowPackBuilder(samples, hog.winSize, writer, testSet).build(extractionThreads);
+    const uint64_t images = writer.getCount();
+    const uint64_t bytes = writer.getPixelBytes();
+    if (!writer.close()) {
+        printf("Error writing file '%s'!\n", packFile.c_str());
+        return false;
+    }
+    printf("Packed %lu of %lu images (%lu skipped) into '%s' in %.2f s, %.1f MB\n", (unsigned long) images, (unsigned long) samples.size(),
+            (unsigned long) skipped, packFile.c_str(), (getTickCount() - start) / getTickFrequency(), bytes / (1024. * 1024.));
+    return true;
+}
+
+/**
+ * Builds the training and test window packs. The training samples are taken from the training set index
+ * of the last training run if there is one, otherwise from the sample directories.
+ */
+static int buildWindowPacks(const HOGDescriptor& hog, const vector<string>& validExtensions) {
+    vector<WindowPackSample> training, test;
+    ImageDatabase database;
+    if (database.load(trainingDatabaseFile)) {
+        for (size_t i = 0; i < database.getSize(); ++i) {
+            // Unlabeled records are no training samples
+            if (database.getLabel(i) == 0.f) {
+                continue;
+            }
+            const WindowPackSample sample = {database.getPath(i), database.getLabel(i), database.getBoundingBox(i)};
+            training.push_back(sample);
+        }
+    } else {
+        const string directories[2] = {posSamplesDir, negSamplesDir};
+        for (int d = 0; d < 2; ++d) {
+            vector<string> fileNames;
+            getFilesInDirectory(directories[d], fileNames, validExtensions);
+            for (size_t i = 0; i < fileNames.size(); ++i) {
+                const WindowPackSample sample = {fileNames[i], d == 0 ? 1.f : -1.f, Rect()};
+                training.push_back(sample);
+            }
+        }
+    }
+    const string testDirectories[2] = {posTestDir, negTestDir};
+    for (int d = 0; d < 2; ++d) {
+        vector<string> fileNames;
+        getFilesInDirectory(testDirectories[d], fileNames, validExtensions);
+        for (size_t i = 0; i < fileNames.size(); ++i) {
+            const WindowPackSample sample = {fileNames[i], d == 0 ? 1.f : -1.f, Rect()};
+            test.push_back(sample);
+        }
+    }
+    return buildWindowPack(hog, training, trainingPackFile, false) && buildWindowPack(hog, test, testPackFile, true) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * Converts a text list of samples into a binary image database
+ * @param textFile one "label filename [x y width height]" line per sample
+ * @param databaseFile binary database to write
+ */
+static int importImageDatabase(const string& textFile, const string& databaseFile) {
+    ImageDatabaseWriter writer;
+    if (!writer.importText(textFile) || !writer.save(databaseFile)) {
+        return EXIT_FAILURE;
+    }
+    ImageDatabase database(databaseFile);
+    cout << database;
+    return database.isOpen() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * Groups the raw detection windows into one detection per pedestrian
+ * @param found raw detection windows, replaced by the grouped detections
+ * @param foundWeights decision values, replaced by those of the grouped detections
+ * @param hitThreshold detection threshold, mean-shift weights the windows by their margin above it
+ */
+static void groupDetections(vector<Rect>& found, vector<double>& foundWeights, const double hitThreshold) {
+    if (useMeanShiftGrouping) {
+        meanShiftGrouping(found, foundWeights, hitThreshold);
+    } else {
+        nonMaximumSuppression(found, foundWeights, nmsIouThreshold);
+    }
 }
 
 /**
  * Shows the detections in the image
  * @param found vector containing valid detection rectangles
+ * @param foundWeights decision values of the detections, drawn next to them
  * @param imageData the image in which the detections are drawn
  */
-static void showDetections(const vector<Rect>& found, Mat& imageData) {
-    vector<Rect> found_filtered;
-    size_t i, j;
-    for (i = 0; i < found.size(); ++i) {
+static void showDetections(const vector<Rect>& found, const vector<double>& foundWeights, Mat& imageData) {
+    for (size_t i = 0; i < found.size(); i++) {
         Rect r = found[i];
-        for (j = 0; j < found.size(); ++j)
-            if (j != i && (r & found[j]) == r)
-                break;
-        if (j == found.size())
-            found_filtered.push_back(r);
-    }
-    for (i = 0; i < found_filtered.size(); i++) {
-        Rect r = found_filtered[i];
         rectangle(imageData, r.tl(), r.br(), Scalar(64, 255, 64), 3);
+        if (i < foundWeights.size()) {
+            char score[16];
+            snprintf(score, sizeof(score), "%.2f", foundWeights[i]);
+            putText(imageData, score, r.tl() + Point(2, 14), FONT_HERSHEY_SIMPLEX, 0.5, Scalar(64, 255, 64));
+        }
     }
 }
 
 /**
- * Test the trained detector against the same training set to get an approximate idea of the detector.
- * Warning: This does not allow any statement about detection quality, as the detector might be overfitting.
- * Detector quality must be determined using an independent test set.
- * @param hog
+ * Evaluates the detector on labelled test windows: every image is decoded and scored once, the
+ * DET curve, the miss rates at fixed false positives per window and the best threshold are derived
+ * from the stored scores
+ * @param hog geometry and detector
+ * @param hitThreshold detection threshold of the detector
+ * @param posFileNames positive test windows
+ * @param negFileNames negative test images, every window is scored
+ * @param curveFile receives the DET curve as CSV, empty for none
+ */
+static void evaluateDetector(const HOGDescriptor& hog, const double hitThreshold, const vector<string>& posFileNames, const vector<string>& negFileNames, const string& curveFile) {
+    PD_TRACE_SCOPE("evaluateDetector");
+    WindowScores scores;
+    WindowPack pack;
+    const bool fromPack = useWindowPacks && pack.open(testPackFile);
+    WindowScorer* scorer = fromPack ? new WindowScorer(hog, pack, winStride, scores) : new WindowScorer(hog, posFileNames, negFileNames, winStride, scores);
+    int64 start = getTickCount();
+    const size_t images = scorer->score(extractionThreads);
+    const double scoringSeconds = (getTickCount() - start) / getTickFrequency();
+    delete scorer;
+    printf("Scored %lu positive and %lu negative windows of %lu %s in %.2f s\n", (unsigned long) scores.positives(), (unsigned long) scores.negatives(),
+            (unsigned long) images, fromPack ? "packed images" : "images", scoringSeconds);
+    if (scores.positives() == 0 || scores.negatives() == 0) {
+        printf("Error: Evaluation needs positive and negative test windows!\n");
+        return;
+    }
+
+    PD_TRACE_SCOPE("evaluation analysis");
+    start = getTickCount();
+    const DetPoint operating = scores.at(hitThreshold);
+    printf("Results:\n\tThreshold %g: miss rate %.4f, %.2e false positives per window\n", hitThreshold, operating.missRate, operating.fppw);
+    for (size_t i = 0; i < sizeof(evaluationFppw) / sizeof(evaluationFppw[0]); ++i) {
+        const DetPoint point = scores.atFppw(evaluationFppw[i]);
+        printf("\tMiss rate at %.0e FPPW: %.4f (threshold %g)\n", evaluationFppw[i], point.missRate, point.threshold);
+    }
+    double balancedError = 0.;
+    const DetPoint best = scores.bestThreshold(&balancedError);
+    printf("\tBest threshold %g: miss rate %.4f, %.2e FPPW, balanced error %.4f\n", best.threshold, best.missRate, best.fppw, balancedError);
+    printf("\tROC area %.5f\n", scores.rocArea());
+    if (!curveFile.empty() && scores.saveCurve(curveFile)) {
+        printf("\tDET curve written to '%s'\n", curveFile.c_str());
+    }
+    printf("Evaluated all thresholds in %.2f ms\n", (getTickCount() - start) * 1000. / getTickFrequency());
+}
+
+/**
+ * Restricts a detector to the region of interest in roiMaskFile and the ground plane band, and sets up
+ * early rejection with the soft cascade and quantised scoring, if configured
+ * @param detector block grid detector
+ * @param roiFile region of interest mask, empty for none
  */
-static void detectTrainingSetTest(const HOGDescriptor& hog, const double hitThreshold, const vector<string>& posFileNames, const vector<string>& negFileNames) {
-    unsigned int truePositives = 0;
-    unsigned int trueNegatives = 0;
-    unsigned int falsePositives = 0;
-    unsigned int falseNegatives = 0;
-    vector<Point> foundDetection;
-    // Walk over positive training samples, generate images and detect
-    for (vector<string>::const_iterator posTrainingIterator = posFileNames.begin(); posTrainingIterator != posFileNames.end(); ++posTrainingIterator) {
-        const Mat imageData = imread(*posTrainingIterator, IMREAD_GRAYSCALE);
-        hog.detect(imageData, foundDetection, hitThreshold, winStride, trainingPadding);
-        if (foundDetection.size() > 0) {
-            ++truePositives;
-            falseNegatives += foundDetection.size() - 1;
-        } else {
-            ++falseNegatives;
-        }
-    }
-    // Walk over negative training samples, generate images and detect
-    for (vector<string>::const_iterator negTrainingIterator = negFileNames.begin(); negTrainingIterator != negFileNames.end(); ++negTrainingIterator) {
-        const Mat imageData = imread(*negTrainingIterator, IMREAD_GRAYSCALE);
-        hog.detect(imageData, foundDetection, hitThreshold, winStride, trainingPadding);
-        if (foundDetection.size() > 0) {
-            falsePositives += foundDetection.size();
-        } else {
-            ++trueNegatives;
-        }
-    }
-
-    printf("Results:\n\tTrue Positives: %u\n\tTrue Negatives: %u\n\tFalse Positives: %u\n\tFalse Negatives: %u\n", truePositives, trueNegatives, falsePositives, falseNegatives);
+static void configureDetector(BlockGridDetector& detector, const string& roiFile = roiMaskFile) {
+    if (useSoftCascade) {
+        SoftCascade cascade;
+        if (cascade.load(softCascadeFile)) {
+            detector.setSoftCascade(cascade);
+        }
+    }
+    if (quantisedScoringBits) {
+        detector.setQuantisation(quantisedScoringBits);
+    }
+    GroundPlaneConstraint groundPlane;
+    groundPlane.horizonRow = groundPlaneHorizonRow;
+    groundPlane.imageHeight = groundPlaneImageHeight;
+    groundPlane.cameraHeight = groundPlaneCameraHeight;
+    groundPlane.minPedestrianHeight = minPedestrianHeight;
+    groundPlane.maxPedestrianHeight = maxPedestrianHeight;
+    detector.setGroundPlane(groundPlane);
+    Mat roiMask;
+    if (!roiFile.empty() && BlockGridDetector::loadRoiMask(roiFile, roiMask)) {
+        detector.setRoiMask(roiMask);
+    }
 }
+
 /**
  * Test detection with custom HOG description vector
  * @param hog
+ * @param detector block grid detector set up by configureDetector, NULL to detect with hog
  * @param hitThreshold threshold value for detection
  * @param imageData
  */
-static void detectTest(const HOGDescriptor& hog, const double hitThreshold, Mat& imageData) {
+static void detectTest(const HOGDescriptor& hog, const BlockGridDetector* detector, const double hitThreshold, Mat& imageData) {
     vector<Rect> found;
+    vector<double> foundWeights;
     Size padding(Size(8, 8));
     Size winStride(Size(8, 8));
-    hog.detectMultiScale(imageData, found, hitThreshold, winStride, padding);
-    showDetections(found, imageData);
+    if (detector) {
+        detector->detectMultiScale(imageData, found, foundWeights, hitThreshold, winStride, padding, 1.05, 0);
+    } else {
+        hog.detectMultiScale(imageData, found, foundWeights, hitThreshold, winStride, padding, 1.05, 0);
+    }
+    // Raw windows with their scores, grouped here instead of by groupRectangles
+    groupDetections(found, foundWeights, hitThreshold);
+    showDetections(found, foundWeights, imageData);
+}
+
+/**
+ * Learns block order and rejection trace of the saved detector model on the training features
+ * and writes them to softCascadeFile
+ * @param useFeatureStore read the features from the feature store written during extraction instead of recomputing them
+ * @param posFileNames positive training images
+ * @param negFileNames negative training images
+ */
+static void trainDetectorSoftCascade(bool useFeatureStore) {
+    PD_TRACE_SCOPE("trainDetectorSoftCascade");
+    DetectorModel model;
+    if (!model.open(detectorModelFile)) {
+        return;
+    }
+    HOGDescriptor modelHog;
+    model.configure(modelHog);
+    const BlockGridDetector detector(modelHog);
+
+    FeatureStore store;
+    WindowPack pack;
+    ImageDatabase samples;
+    vector<float> features, labels;
+    // The feature store already holds the mirrored samples, they are only added when recomputing
+    HogMirror mirror;
+    if (mirrorPositives) {
+        mirror.init(modelHog);
+    }
+    vector<float> mirrored;
+    const float* featureData = NULL;
+    const float* labelData = NULL;
+    size_t count = 0;
+    if (useFeatureStore && store.open(featureStoreFile)) {
+        if (store.getDimension() != model.getDimension()) {
+            printf("Feature store %s has dimension %u, the detector %u, not training the soft cascade\n",
+                    featureStoreFile.c_str(), store.getDimension(), model.getDimension());
+            return;
+        }
+        featureData = store.getFeatures();
+        labelData = store.getLabels();
+        count = store.getCount();
+    } else if (useWindowPacks && pack.open(trainingPackFile)) {
+        vector<float> featureVector;
+        vector<Point> locations;
+        for (size_t i = 0; i < pack.getCount(); ++i) {
+            if (pack.getImage(i).size() != modelHog.winSize || pack.getLabel(i) == 0.f) {
+                continue;
+            }
+            modelHog.compute(pack.getImage(i), featureVector, winStride, trainingPadding, locations);
+            if (featureVector.size() != model.getDimension()) {
+                continue;
+            }
+            features.insert(features.end(), featureVector.begin(), featureVector.end());
+            labels.push_back(pack.getLabel(i) > 0 ? 1.f : -1.f);
+            if (!mirror.empty() && labels.back() > 0) {
+                mirror.apply(featureVector, mirrored);
+                features.insert(features.end(), mirrored.begin(), mirrored.end());
+                labels.push_back(1.f);
+            }
+        }
+        featureData = features.empty() ? NULL : &features[0];
+        labelData = labels.empty() ? NULL : &labels[0];
+        count = labels.size();
+    } else if (samples.load(trainingDatabaseFile)) {
+        FeatureCache* cache = useFeatureCache ? new FeatureCache(featureCacheDir, featureCacheMaxBytes, modelHog, winStride, trainingPadding) : NULL;
+        vector<float> featureVector;
+        for (size_t i = 0; i < samples.getSize(); ++i) {
+            if (samples.getLabel(i) == 0.f) {
+                continue;
+            }
+            calculateFeaturesFromInput(samples.getPath(i), featureVector, modelHog, cache, samples.getBoundingBox(i));
+            if (featureVector.size() != model.getDimension()) {
+                continue;
+            }
+            features.insert(features.end(), featureVector.begin(), featureVector.end());
+            labels.push_back(samples.getLabel(i) > 0 ? 1.f : -1.f);
+            if (!mirror.empty() && labels.back() > 0) {
+                mirror.apply(featureVector, mirrored);
+                features.insert(features.end(), mirrored.begin(), mirrored.end());
+                labels.push_back(1.f);
+            }
+        }
+        delete cache;
+        featureData = features.empty() ? NULL : &features[0];
+        labelData = labels.empty() ? NULL : &labels[0];
+        count = labels.size();
+    }
+
+    printf("Training soft cascade on %lu samples, miss rate %g\n", (unsigned long) count, softCascadeMissRate);
+    SoftCascade cascade;
+    SoftCascadeTrainingStats stats;
+    if (count == 0 || !cascade.train(detector.getBlockWeights(), detector.getRho(), featureData, labelData, count, model.getThreshold(), softCascadeMissRate, &stats)) {
+        return;
+    }
+    printf("Soft cascade: %lu of %lu detected positives rejected, %lu of %lu negatives rejected, %.1f of %d blocks evaluated per negative\n",
+            stats.positivesRejected, stats.positives, stats.negativesRejected, stats.negatives, stats.averageBlocksNegatives, cascade.getBlockCount());
+    cascade.save(softCascadeFile);
+}
+
+/**
+ * Bootstraps the detector: scans the full-size negative images with the current detector,
+ * adds every window scoring within the margin to the training set as negative example and retrains
+ * @param hog HOG descriptor with the training parameters
+ * @param negImages full-size negative images
+ */
+static void mineHardNegatives(const HOGDescriptor& hog, const vector<string>& negImages) {
+    PD_TRACE_SCOPE("mineHardNegatives");
+    HardNegativeMiningParams params;
+    params.maxMined = maxMinedPerRound;
+    params.maxSeconds = maxMiningSecondsPerRound;
+    params.winStride = winStride;
+    params.threads = extractionThreads;
+
+    for (int round = 1; round <= miningRounds; ++round) {
+        vector<float> descriptorVector;
+        vector<unsigned int> descriptorVectorIndices;
+        TRAINHOG_SVM_TO_TRAIN::getInstance()->getSingleDetectingVector(descriptorVector, descriptorVectorIndices);
+        const float bias = TRAINHOG_SVM_TO_TRAIN::getInstance()->getThreshold();
+
+        printf("Hard negative mining round %d of %d over %lu images\n", round, miningRounds, negImages.size());
+        vector<vector<float> > mined;
+        HardNegativeMiner miner(hog, descriptorVector, bias, params);
+        const HardNegativeMiningStats stats = miner.mine(negImages, mined);
+        printf("Mined %lu of %lu windows from %lu images in %.2f s%s\n", stats.windowsMined, stats.windowsEvaluated,
+                stats.imagesScanned, stats.seconds, stats.limitReached ? " (round limit reached)" : "");
+        if (mined.empty()) {
+            printf("No hard negatives left, stopping\n");
+            break;
+        }
+
+        TRAINHOG_SVM_TO_TRAIN::getInstance()->reserve_examples(TRAINHOG_SVM_TO_TRAIN::getInstance()->getExampleCount() + mined.size());
+        for (size_t window = 0; window < mined.size(); ++window) {
+            TRAINHOG_SVM_TO_TRAIN::getInstance()->add_example(-1., mined[window]);
+        }
+        PD_TRACE_COUNTER("mined windows", mined.size());
+        printf("Retraining %s with %ld examples\n", TRAINHOG_SVM_TO_TRAIN::getInstance()->getSVMName(), TRAINHOG_SVM_TO_TRAIN::getInstance()->getExampleCount());
+        TRAINHOG_SVM_TO_TRAIN::getInstance()->train();
+    }
+}
+
+/**
+ * Trains SVMlight and the dense LinearSVM on the same feature store and compares
+ * their wall-clock training time and the resulting classifiers on the training set
+ * @param storeFile feature store written by a training run with writeFeatureStore enabled
+ */
+static int compareTrainingBackends(const string& storeFile) {
+    FeatureStore store;
+    if (!store.open(storeFile)) {
+        return EXIT_FAILURE;
+    }
+    printf("Comparing training backends on %u samples of dimension %u\n", store.getCount(), store.getDimension());
+    vector<unsigned int> descriptorVectorIndices;
+
+    int64 start = getTickCount();
+    readFeatureStore(storeFile, *SVMlight::getInstance());
+    const double svmlightLoadSeconds = (getTickCount() - start) / getTickFrequency();
+    start = getTickCount();
+    SVMlight::getInstance()->train();
+    const double svmlightTrainSeconds = (getTickCount() - start) / getTickFrequency();
+    vector<float> svmlightVector;
+    SVMlight::getInstance()->getSingleDetectingVector(svmlightVector, descriptorVectorIndices);
+    const float svmlightBias = SVMlight::getInstance()->getThreshold();
+
+    start = getTickCount();
+    readFeatureStore(storeFile, *LinearSVM::getInstance());
+    const double linearLoadSeconds = (getTickCount() - start) / getTickFrequency();
+    start = getTickCount();
+    LinearSVM::getInstance()->train();
+    const double linearTrainSeconds = (getTickCount() - start) / getTickFrequency();
+    vector<float> linearVector;
+    LinearSVM::getInstance()->getSingleDetectingVector(linearVector, descriptorVectorIndices);
+    const float linearBias = LinearSVM::getInstance()->getThreshold();
+
+    // Training set accuracy of both classifiers and how often they agree
+    unsigned int svmlightCorrect = 0, linearCorrect = 0, agreement = 0;
+    for (uint32_t sample = 0; sample < store.getCount(); ++sample) {
+        const float* row = store.getRow(sample);
+        const bool positive = store.getLabel(sample) > 0;
+        const bool svmlightPositive = dotProduct(&svmlightVector[0], row, store.getDimension()) - svmlightBias > 0;
+        const bool linearPositive = dotProduct(&linearVector[0], row, store.getDimension()) - linearBias > 0;
+        svmlightCorrect += (svmlightPositive == positive);
+        linearCorrect += (linearPositive == positive);
+        agreement += (svmlightPositive == linearPositive);
+    }
+    const double samples = store.getCount();
+    printf("%-12s %10s %10s %12s\n", "Backend", "Load [s]", "Train [s]", "Accuracy");
+    printf("%-12s %10.3f %10.3f %11.2f%%\n", "SVMlight", svmlightLoadSeconds, svmlightTrainSeconds, 100. * svmlightCorrect / samples);
+    printf("%-12s %10.3f %10.3f %11.2f%%\n", "LinearSVM", linearLoadSeconds, linearTrainSeconds, 100. * linearCorrect / samples);
+    printf("Training speedup %.1fx, the classifiers agree on %.2f%% of the samples\n", svmlightTrainSeconds / linearTrainSeconds, 100. * agreement / samples);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Converts a detector between the binary model (.bin), OpenCV YAML/XML and descriptor vector text (.dat) formats
+ * Text files carry no geometry, the given HOG descriptor is used for them
+ * @param hog HOG descriptor with the training parameters
+ * @param inputFile detector to convert
+ * @param outputFile converted detector
+ * @param threshold detection threshold for inputs without one (text files, YAML written by hog.save). Detectors
+ * exported before the binary model have no bias, their SVM bias was used as detection threshold
+ * @param bias bias for inputs without a bias component
+ */
+static int convertDetectorModel(const HOGDescriptor& hog, const string& inputFile, const string& outputFile, float threshold, float bias) {
+    const string inputExtension = toLowerCase(inputFile.substr(inputFile.find_last_of(".") + 1));
+    const string outputExtension = toLowerCase(outputFile.substr(outputFile.find_last_of(".") + 1));
+    // Convert to a temporary binary model first unless the input already is one
+    string binaryFile = inputFile;
+    if (inputExtension != "bin") {
+        binaryFile = (outputExtension == "bin") ? outputFile : outputFile + ".tmp.bin";
+        const bool converted = (inputExtension == "dat" || inputExtension == "txt")
+            ? DetectorModel::importText(inputFile, hog, bias, threshold, binaryFile)
+            : DetectorModel::importYAML(inputFile, bias, threshold, binaryFile);
+        if (!converted) {
+            return EXIT_FAILURE;
+        }
+        if (binaryFile == outputFile) {
+            return EXIT_SUCCESS;
+        }
+    }
+    DetectorModel model;
+    if (!model.open(binaryFile)) {
+        return EXIT_FAILURE;
+    }
+    bool ok;
+    if (outputExtension == "bin") {
+        vector<float> weights(model.getWeights(), model.getWeights() + model.getDimension());
+        HOGDescriptor modelHog;
+        model.configure(modelHog);
+        ok = DetectorModel::save(outputFile, modelHog, weights, model.getBias(), model.getThreshold());
+    } else if (outputExtension == "dat" || outputExtension == "txt") {
+        ok = model.exportText(outputFile);
+    } else {
+        ok = model.exportYAML(outputFile);
+    }
+    if (binaryFile != inputFile) {
+        remove(binaryFile.c_str());
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * Loads a trained detector once and answers detection requests over a Unix domain socket
+ * @param modelFile binary detector model
+ * @param socketPath path of the socket to listen on
+ */
+static int runDetectionService(const string& modelFile, const string& socketPath) {
+#if defined(_WIN32) || defined(_WIN64)
+    printf("Error: The detection service requires Unix domain sockets!\n");
+    return EXIT_FAILURE;
+#else
+    DetectorModel model;
+    if (!model.open(modelFile)) {
+        return EXIT_FAILURE;
+    }
+    DetectionServiceParams params;
+    params.socketPath = socketPath;
+    params.workers = serviceWorkers;
+    DetectionService service(model, params);
+    return service.run() ? EXIT_SUCCESS : EXIT_FAILURE;
+#endif
+}
+
+/**
+ * Loads the trained detector into hog, falls back to the OpenCV people detector (64x128) if there is none
+ * @param hog receives geometry and detector
+ * @param modelFile binary detector model
+ * @return detection threshold of the model
+ */
+static double loadDetector(HOGDescriptor& hog, const string& modelFile) {
+    DetectorModel model;
+    if (model.open(modelFile)) {
+        model.configure(hog);
+        return model.getThreshold();
+    }
+    printf("Using the OpenCV default people detector instead\n");
+    hog = HOGDescriptor();
+    hog.setSVMDetector(HOGDescriptor::getDefaultPeopleDetector());
+    return 0.;
+}
+
+/**
+ * Benchmarks the block grid engine against HOGDescriptor::detectMultiScale on 960x640 frames
+ * and checks that both find the same windows with the same scores
+ * @param modelFile binary detector model
+ * @param imageFile test image, resized to 960x640
+ * @param iterations timed runs per engine
+ * @param roiFile optional region of interest mask, with a mask or ground plane calibration the engine is also timed with the windows outside pruned
+ */
+static int benchmarkDetectionEngine(const string& modelFile, const string& imageFile, int iterations, const string& roiFile) {
+    iterations = max(1, iterations);
+    HOGDescriptor hog;
+    const double hitThreshold = loadDetector(hog, modelFile);
+    Mat image = imread(imageFile);
+    if (image.empty()) {
+        printf("Error: Could not read image '%s'!\n", imageFile.c_str());
+        return EXIT_FAILURE;
+    }
+    resize(image, image, Size(960, 640), 0, 0, INTER_LINEAR);
+    const Size padding(8, 8);
+    const Size stride(8, 8);
+    BlockGridDetector engine(hog);
+
+    // Raw single scale scores must agree before grouping
+    vector<Point> hogHits, engineHits;
+    vector<double> hogScores, engineScores;
+    hog.detect(image, hogHits, hogScores, hitThreshold - 1., stride, padding);
+    engine.detect(image, engineHits, engineScores, hitThreshold - 1., stride, padding);
+    double maxScoreError = 0.;
+    size_t matchedHits = 0;
+    for (size_t i = 0; i < hogHits.size(); ++i) {
+        for (size_t j = 0; j < engineHits.size(); ++j) {
+            if (hogHits[i].x == engineHits[j].x && hogHits[i].y == engineHits[j].y) {
+                maxScoreError = max(maxScoreError, fabs(hogScores[i] - engineScores[j]));
+                ++matchedHits;
+                break;
+            }
+        }
+    }
+    printf("Single scale: %lu HOG hits, %lu engine hits, %lu matched, max score difference %g\n",
+            (unsigned long) hogHits.size(), (unsigned long) engineHits.size(), (unsigned long) matchedHits, maxScoreError);
+
+    vector<Rect> hogFound, engineFound;
+    vector<double> hogWeights, engineWeights;
+    BlockGridDetectorStats stats;
+    double hogMs = 0., engineMs = 0.;
+    for (int i = 0; i < iterations; ++i) {
+        int64 start = getTickCount();
+        hog.detectMultiScale(image, hogFound, hogWeights, hitThreshold, stride, padding);
+        hogMs += (getTickCount() - start) * 1000. / getTickFrequency();
+        start = getTickCount();
+        engine.detectMultiScale(image, engineFound, engineWeights, hitThreshold, stride, padding, 1.05, 2.0, &stats);
+        engineMs += (getTickCount() - start) * 1000. / getTickFrequency();
+    }
+    size_t sameDetections = 0;
+    for (size_t i = 0; i < hogFound.size(); ++i) {
+        for (size_t j = 0; j < engineFound.size(); ++j) {
+            if ((hogFound[i] & engineFound[j]).area() > 0.9 * (hogFound[i] | engineFound[j]).area()) {
+                ++sameDetections;
+                break;
+            }
+        }
+    }
+    printf("Multi scale: %lu HOG detections, %lu engine detections, %lu matching\n",
+            (unsigned long) hogFound.size(), (unsigned long) engineFound.size(), (unsigned long) sameDetections);
+    printf("%lu levels, %lu blocks, %lu windows per frame\n", stats.levels, stats.blocksComputed, stats.windowsEvaluated);
+    printf("detectMultiScale %.2f ms/frame, block grid engine %.2f ms/frame (grid %.2f ms, scoring %.2f ms summed over levels), speedup %.2fx\n",
+            hogMs / iterations, engineMs / iterations, stats.gridMs, stats.scoringMs, hogMs / engineMs);
+
+    // Early rejection with the soft cascade against full scoring, on the raw windows
+    SoftCascade cascade;
+    if (cascade.load(softCascadeFile)) {
+        vector<Rect> fullHits, cascadeHits;
+        vector<double> fullScores, cascadeScores;
+        BlockGridDetectorStats fullStats, cascadeStats;
+        double fullMs = 0., cascadeMs = 0.;
+        for (int i = 0; i < iterations; ++i) {
+            int64 start = getTickCount();
+            engine.detectMultiScale(image, fullHits, fullScores, hitThreshold, stride, padding, 1.05, 0, &fullStats);
+            fullMs += (getTickCount() - start) * 1000. / getTickFrequency();
+        }
+        engine.setSoftCascade(cascade);
+        for (int i = 0; i < iterations; ++i) {
+            int64 start = getTickCount();
+            engine.detectMultiScale(image, cascadeHits, cascadeScores, hitThreshold, stride, padding, 1.05, 0, &cascadeStats);
+            cascadeMs += (getTickCount() - start) * 1000. / getTickFrequency();
+        }
+        engine.setSoftCascade(SoftCascade());
+        const int blocks = cascade.getBlockCount();
+        printf("Soft cascade: %lu of %lu raw hits kept (miss rate %.2f%%), %.1f of %d blocks per window (full scoring %.1f), %.2f ms/frame vs %.2f ms/frame, speedup %.2fx\n",
+                (unsigned long) cascadeHits.size(), (unsigned long) fullHits.size(),
+                fullHits.empty() ? 0. : 100. * (1. - (double) cascadeHits.size() / fullHits.size()),
+                cascadeStats.windowsEvaluated ? (double) cascadeStats.blockEvaluations / cascadeStats.windowsEvaluated : 0., blocks,
+                fullStats.windowsEvaluated ? (double) fullStats.blockEvaluations / fullStats.windowsEvaluated : 0.,
+                cascadeMs / iterations, fullMs / iterations, fullMs / cascadeMs);
+    }
+
+    // Quantised scoring against float scoring: grid memory, scoring time and agreement of the raw windows
+    vector<Point> floatHits;
+    vector<double> floatScores;
+    engine.detect(image, floatHits, floatScores, hitThreshold - 1., stride, padding);
+    vector<Rect> floatFound;
+    vector<double> floatWeights;
+    BlockGridDetectorStats floatStats;
+    engine.detectMultiScale(image, floatFound, floatWeights, hitThreshold, stride, padding, 1.05, 0, &floatStats);
+    const int quantisations[] = {0, 8, 16};
+    for (int q = 0; q < 3; ++q) {
+        engine.setQuantisation(quantisations[q]);
+        vector<Point> hits;
+        vector<double> scores;
+        engine.detect(image, hits, scores, hitThreshold - 1., stride, padding);
+        double maxError = 0.;
+        for (size_t i = 0; i < floatHits.size(); ++i) {
+            for (size_t j = 0; j < hits.size(); ++j) {
+                if (floatHits[i] == hits[j]) {
+                    maxError = max(maxError, fabs(floatScores[i] - scores[j]));
+                    break;
+                }
+            }
+        }
+        vector<Rect> found;
+        vector<double> weights;
+        BlockGridDetectorStats quantisedStats;
+        double quantisedMs = 0.;
+        for (int i = 0; i < iterations; ++i) {
+            const int64 start = getTickCount();
+            engine.detectMultiScale(image, found, weights, hitThreshold, stride, padding, 1.05, 0, &quantisedStats);
+            quantisedMs += (getTickCount() - start) * 1000. / getTickFrequency();
+        }
+        size_t sameHits = 0;
+        for (size_t i = 0; i < found.size(); ++i) {
+            sameHits += find(floatFound.begin(), floatFound.end(), found[i]) != floatFound.end();
+        }
+        printf("%-6s scoring: grids %.1f MB, %.2f ms/frame (scoring %.2f ms, %.1f Mwindows/s), %lu raw hits, %lu shared with float, max score error %g\n",
+                quantisations[q] ? (quantisations[q] == 8 ? "int8" : "int16") : "float",
+                quantisedStats.gridBytes / (1024. * 1024.), quantisedMs / iterations, quantisedStats.scoringMs,
+                quantisedStats.scoringMs > 0 ? quantisedStats.windowsEvaluated / (quantisedStats.scoringMs * 1000.) : 0.,
+                (unsigned long) found.size(), (unsigned long) sameHits, maxError);
+    }
+    engine.setQuantisation(0);
+
+    if (roiFile.empty() && groundPlaneCameraHeight <= 0) {
+        return EXIT_SUCCESS;
+    }
+    configureDetector(engine, roiFile);
+    // Constraints only, the soft cascade and quantisation are compared above
+    engine.setSoftCascade(SoftCascade());
+    engine.setQuantisation(0);
+    vector<Rect> roiFound;
+    vector<double> roiWeights;
+    BlockGridDetectorStats roiStats;
+    double roiMs = 0.;
+    for (int i = 0; i < iterations; ++i) {
+        const int64 start = getTickCount();
+        engine.detectMultiScale(image, roiFound, roiWeights, hitThreshold, stride, padding, 1.05, 2.0, &roiStats);
+        roiMs += (getTickCount() - start) * 1000. / getTickFrequency();
+    }
+    const unsigned long allWindows = roiStats.windowsEvaluated + roiStats.windowsPruned;
+    const unsigned long allBlocks = roiStats.blocksComputed + roiStats.blocksSkipped;
+    printf("Region of interest / ground plane: %.1f%% of %lu windows pruned, %.1f%% of %lu blocks skipped, %lu detections\n",
+            allWindows ? roiStats.windowsPruned * 100. / allWindows : 0., allWindows,
+            allBlocks ? roiStats.blocksSkipped * 100. / allBlocks : 0., allBlocks, (unsigned long) roiFound.size());
+    printf("Block grid engine with region of interest / ground plane %.2f ms/frame, speedup %.2fx over the whole frame\n",
+            roiMs / iterations, engineMs / roiMs);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Headless detection on a video: decode, resize, detect and write run as pipelined stages
+ * @param modelFile binary detector model
+ * @param videoFile input video
+ * @param detectionsFile text file receiving the detections of every frame, empty for none
+ * @param annotatedVideoFile output video with the detections drawn, empty for none
+ */
+static int runVideoDetection(const string& modelFile, const string& videoFile, const string& detectionsFile, const string& annotatedVideoFile) {
+    HOGDescriptor hog;
+    VideoPipelineParams params;
+    params.hitThreshold = loadDetector(hog, modelFile);
+    params.workers = videoWorkers;
+    params.queueCapacity = videoQueueCapacity;
+    params.detectionsFile = detectionsFile;
+    params.annotatedVideoFile = annotatedVideoFile;
+    BlockGridDetector detector(hog);
+    configureDetector(detector);
+    VideoPipeline pipeline(detector, params);
+    return pipeline.run(videoFile) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * Compares tracking-assisted detection with a full scan of every frame on the same video:
+ * fps of both and recall of the tracking mode against the full scan detections
+ * @param modelFile binary detector model
+ * @param videoFile input video, frames are resized to 960x640
+ * @param keyframeInterval frames between full scans of the tracking mode
+ */
+static int compareTrackingDetection(const string& modelFile, const string& videoFile, int keyframeInterval) {
+    HOGDescriptor hog;
+    TrackingDetectorParams params;
+    params.hitThreshold = loadDetector(hog, modelFile);
+    params.keyframeInterval = max(1, keyframeInterval);
+    BlockGridDetector detector(hog);
+    configureDetector(detector);
+    TrackingDetector tracker(detector, params);
+    VideoCapture capture(videoFile);
+    if (!capture.isOpened()) {
+        printf("Error: Could not open video '%s'!\n", videoFile.c_str());
+        return EXIT_FAILURE;
+    }
+
+    Mat frame;
+    vector<Rect> fullFound, trackFound;
+    vector<double> fullWeights, trackWeights;
+    double fullMs = 0., trackMs = 0.;
+    unsigned long frames = 0, fullDetections = 0, trackDetections = 0, recalled = 0;
+    while (capture.read(frame) && !frame.empty()) {
+        resize(frame, frame, Size(960, 640), 0, 0, INTER_LINEAR);
+        int64 start = getTickCount();
+        detector.detectMultiScale(frame, fullFound, fullWeights, params.hitThreshold, params.winStride, params.padding, params.scale0);
+        fullMs += (getTickCount() - start) * 1000. / getTickFrequency();
+        start = getTickCount();
+        tracker.detect(frame, trackFound, trackWeights);
+        trackMs += (getTickCount() - start) * 1000. / getTickFrequency();
+
+        for (size_t i = 0; i < fullFound.size(); ++i) {
+            for (size_t j = 0; j < trackFound.size(); ++j) {
+                if ((fullFound[i] & trackFound[j]).area() >= 0.5 * (fullFound[i] | trackFound[j]).area()) {
+                    ++recalled;
+                    break;
+                }
+            }
+        }
+        fullDetections += fullFound.size();
+        trackDetections += trackFound.size();
+        ++frames;
+    }
+    if (frames == 0) {
+        printf("Error: No frames in video '%s'!\n", videoFile.c_str());
+        return EXIT_FAILURE;
+    }
+    const TrackingDetectorStats& stats = tracker.getStats();
+    printf("%lu frames, keyframe interval %d: %lu full scans (%lu forced by lost or uncertain tracks), %lu track regions searched\n",
+            frames, params.keyframeInterval, stats.keyframes, stats.forcedKeyframes, stats.regionsSearched);
+    printf("Full scan: %.2f ms/frame, %.1f fps, %lu detections\n", fullMs / frames, frames * 1000. / fullMs, fullDetections);
+    printf("Tracking:  %.2f ms/frame, %.1f fps, %lu detections, speedup %.2fx\n", trackMs / frames, frames * 1000. / trackMs, trackDetections, fullMs / trackMs);
+    printf("Recall against full scan (IoU >= 0.5): %.2f%% (%lu of %lu)\n",
+            fullDetections ? recalled * 100. / fullDetections : 100., recalled, fullDetections);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Runs several detector models on one image with a shared pyramid and compares with separate detection runs
+ * @param imageFile test image, resized to 960x640
+ * @param modelFiles binary detector models with the same block geometry
+ * @param iterations timed runs
+ */
+static int detectWithModelSet(const string& imageFile, const vector<string>& modelFiles, int iterations) {
+    Mat image = imread(imageFile);
+    if (image.empty()) {
+        printf("Error: Could not read image '%s'!\n", imageFile.c_str());
+        return EXIT_FAILURE;
+    }
+    resize(image, image, Size(960, 640), 0, 0, INTER_LINEAR);
+    const Size padding(8, 8);
+    const Size stride(8, 8);
+    iterations = max(1, iterations);
+
+    DetectorSet detectors;
+    vector<BlockGridDetector> separate;
+    vector<double> thresholds;
+    for (size_t m = 0; m < modelFiles.size(); ++m) {
+        DetectorModel model;
+        HOGDescriptor modelHog;
+        if (!model.open(modelFiles[m])) {
+            return EXIT_FAILURE;
+        }
+        model.configure(modelHog);
+        if (!detectors.add(modelFiles[m], modelHog, model.getThreshold())) {
+            return EXIT_FAILURE;
+        }
+        separate.push_back(BlockGridDetector(modelHog));
+        thresholds.push_back(model.getThreshold());
+    }
+
+    vector<DetectorSetResult> results;
+    double setMs = 0., gridMs = 0.;
+    for (int i = 0; i < iterations; ++i) {
+        const int64 start = getTickCount();
+        detectors.detectMultiScale(image, results, stride, padding, 1.05, 2.0, &gridMs);
+        setMs += (getTickCount() - start) * 1000. / getTickFrequency();
+    }
+    vector<double> separateMs(separate.size(), 0.);
+    vector<Rect> found;
+    vector<double> foundWeights;
+    for (int i = 0; i < iterations; ++i) {
+        for (size_t m = 0; m < separate.size(); ++m) {
+            const int64 start = getTickCount();
+            separate[m].detectMultiScale(image, found, foundWeights, thresholds[m], stride, padding);
+            separateMs[m] += (getTickCount() - start) * 1000. / getTickFrequency();
+        }
+    }
+
+    double separateTotalMs = 0.;
+    for (size_t m = 0; m < results.size(); ++m) {
+        const Size winSize = separate[m].getDescriptor().winSize;
+        printf("%s (%dx%d): %lu detections, %lu windows, scoring %.2f ms (separate run %.2f ms/frame)\n",
+                results[m].name.c_str(), winSize.width, winSize.height, (unsigned long) results[m].found.size(),
+                results[m].windowsEvaluated, results[m].scoringMs, separateMs[m] / iterations);
+        separateTotalMs += separateMs[m];
+    }
+    printf("Shared pyramid: %.2f ms/frame for %lu models (block grids %.2f ms summed over levels), separate runs %.2f ms/frame, speedup %.2fx\n",
+            setMs / iterations, (unsigned long) results.size(), gridMs, separateTotalMs / iterations, separateTotalMs / setMs);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Benchmarks the grouping of raw detection windows on synthetic candidates: clusters of jittered
+ * windows at several scales around random pedestrians, as dense strides and low thresholds produce them
+ * @param candidates number of raw windows
+ * @param iterations timed runs
+ */
+static int benchmarkGrouping(int candidates, int iterations) {
+    RNG rng(12345);
+    vector<Rect> boxes;
+    vector<double> scores;
+    const int pedestrians = max(1, candidates / 200);
+    while ((int) boxes.size() < candidates) {
+        const int pedestrian = (int) boxes.size() % pedestrians;
+        RNG centre(pedestrian + 1);
+        const double height = centre.uniform(96., 400.);
+        const Point2d c(centre.uniform(0., 960.), centre.uniform(0., 640.));
+        const double h = height * exp(rng.gaussian(0.1));
+        boxes.push_back(Rect(cvRound(c.x + rng.gaussian(0.08 * h) - h / 4), cvRound(c.y + rng.gaussian(0.08 * h) - h / 2), cvRound(h / 2), cvRound(h)));
+        scores.push_back(rng.uniform(0., 2.));
+    }
+
+    // Reference: quadratic greedy NMS over all candidates
+    vector<int> order(boxes.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = (int) i;
+    }
+    stable_sort(order.begin(), order.end(), [&scores](int a, int b) { return scores[a] > scores[b]; });
+    int64 start = getTickCount();
+    vector<int> reference;
+    for (size_t k = 0; k < order.size(); ++k) {
+        const Rect& r = boxes[order[k]];
+        bool suppressed = false;
+        for (size_t j = 0; j < reference.size() && !suppressed; ++j) {
+            const double intersection = (r & boxes[reference[j]]).area();
+            suppressed = intersection > nmsIouThreshold * (r.area() + boxes[reference[j]].area() - intersection);
+        }
+        if (!suppressed) {
+            reference.push_back(order[k]);
+        }
+    }
+    const double referenceMs = (getTickCount() - start) * 1000. / getTickFrequency();
+
+    vector<int> keep;
+    double nmsMs = 0.;
+    for (int i = 0; i < iterations; ++i) {
+        start = getTickCount();
+        nonMaximumSuppression(boxes, scores, nmsIouThreshold, keep);
+        nmsMs += (getTickCount() - start) * 1000. / getTickFrequency();
+    }
+    double meanShiftMs = 0.;
+    size_t modes = 0;
+    for (int i = 0; i < iterations; ++i) {
+        vector<Rect> grouped = boxes;
+        vector<double> groupedScores = scores;
+        start = getTickCount();
+        meanShiftGrouping(grouped, groupedScores, 0.);
+        meanShiftMs += (getTickCount() - start) * 1000. / getTickFrequency();
+        modes = grouped.size();
+    }
+    printf("%lu candidates around %d pedestrians\n", (unsigned long) boxes.size(), pedestrians);
+    printf("Greedy IoU NMS: %lu kept, %.3f ms (quadratic reference %lu kept, %.3f ms, %s)\n", (unsigned long) keep.size(),
+            nmsMs / iterations, (unsigned long) reference.size(), referenceMs, keep == reference ? "identical" : "DIFFERENT");
+    printf("Mean-shift grouping: %lu modes, %.3f ms\n", (unsigned long) modes, meanShiftMs / iterations);
+    return keep == reference ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 int main(int argc, char** argv ){
+    PD_TRACE_START(traceFile);
+    PD_TRACE_SCOPE("main");
     HOGDescriptor hog; // Use standard parameters here
     hog.winSize = Size(48, 96); // Training images size
 
-    static vector<string> positiveTrainingImages;
-    static vector<string> negativeTrainingImages;
+    if (argc > 1 && string(argv[1]) == "compare-trainers") {
+        return compareTrainingBackends(argc > 2 ? argv[2] : featureStoreFile);
+    }
+    if (argc > 3 && string(argv[1]) == "convert-model") {
+        return convertDetectorModel(hog, argv[2], argv[3], argc > 4 ? atof(argv[4]) : 0.f, argc > 5 ? atof(argv[5]) : 0.f);
+    }
+    if (argc > 2 && string(argv[1]) == "bench-detect") {
+        return benchmarkDetectionEngine(detectorModelFile, argv[2], argc > 3 ? atoi(argv[3]) : 20, argc > 4 ? argv[4] : roiMaskFile);
+    }
+    if (argc > 1 && string(argv[1]) == "serve") {
+        return runDetectionService(argc > 2 ? argv[2] : detectorModelFile, argc > 3 ? argv[3] : "/tmp/pd.sock");
+    }
+    if (argc > 1 && string(argv[1]) == "bench-nms") {
+        return benchmarkGrouping(argc > 2 ? atoi(argv[2]) : 10000, 20);
+    }
+    if (argc > 3 && string(argv[1]) == "multi-detect") {
+        return detectWithModelSet(argv[2], vector<string>(argv + 3, argv + argc), 20);
+    }
+    if (argc > 2 && string(argv[1]) == "track-video") {
+        return compareTrackingDetection(detectorModelFile, argv[2], argc > 3 ? atoi(argv[3]) : 10);
+    }
+    if (argc > 2 && string(argv[1]) == "import-database") {
+        return importImageDatabase(argv[2], argc > 3 ? argv[3] : trainingDatabaseFile);
+    }
+    if (argc > 2 && string(argv[1]) == "video") {
+        return runVideoDetection(detectorModelFile, argv[2], argc > 3 ? argv[3] : "detections.txt", argc > 4 ? argv[4] : "");
+    }
+
     static vector<string> positiveTestImages;
     static vector<string> negativeTestImages;
     static vector<string> detectTestImages;
@@ -238,72 +1394,178 @@ int main(int argc, char** argv ){
     validExtensions.push_back("pgm");
     validExtensions.push_back("mp4");
 
-
-    getFilesInDirectory(posSamplesDir, positiveTrainingImages, validExtensions);
-    getFilesInDirectory(negSamplesDir, negativeTrainingImages, validExtensions);
-    unsigned long overallSamples = positiveTrainingImages.size() + negativeTrainingImages.size();
-    //cout << overallSamples << endl;
-
-    // <editor-fold defaultstate="collapsed" desc="Calculate HOG features and save to file">
-    // Make sure there are actually samples to train
-    if (overallSamples == 0) {
-        printf("No training sample files found, nothing to do!\n");
+    if (argc > 1 && string(argv[1]) == "verify-mirror") {
+        vector<string> fileNames;
+        getFilesInDirectory(argc > 2 ? argv[2] : posSamplesDir, fileNames, validExtensions);
+        return verifyMirrorPermutation(hog, fileNames);
+    }
+    if (argc > 1 && string(argv[1]) == "build-packs") {
+        return buildWindowPacks(hog, validExtensions);
+    }
+    if (argc > 1 && string(argv[1]) == "evaluate") {
+        const double modelThreshold = loadDetector(hog, argc > 2 ? argv[2] : detectorModelFile);
+        getFilesInDirectory(posTestDir, positiveTestImages, validExtensions);
+        getFilesInDirectory(negTestDir, negativeTestImages, validExtensions);
+        evaluateDetector(hog, modelThreshold, positiveTestImages, negativeTestImages, argc > 3 ? argv[3] : evaluationCurveFile);
         return EXIT_SUCCESS;
     }
 
+    WindowPack trainingPack;
+    bool fromPack = useWindowPacks && trainingPack.open(trainingPackFile);
+    if (fromPack && trainingPack.getWindowSize() != hog.winSize) {
+        printf("Window pack '%s' holds %dx%d windows, not %dx%d\n", trainingPackFile.c_str(), trainingPack.getWindowSize().width,
+                trainingPack.getWindowSize().height, hog.winSize.width, hog.winSize.height);
+        fromPack = false;
+    }
+    if (useWindowPacks && !fromPack) {
+        printf("Run pd build-packs first, reading the image files instead\n");
+    }
+    ImageDatabase trainingDatabase;
+    const bool fromDatabase = !fromPack && trainFromDatabase;
+    if (fromDatabase && !trainingDatabase.load(trainingDatabaseFile)) {
+        return EXIT_FAILURE;
+    }
+    DatasetStream positiveSamples, negativeSamples;
+    DatasetWalker positiveWalker(validExtensions, manifestDir, walkerThreads), negativeWalker(validExtensions, manifestDir, walkerThreads);
+    if (fromPack) {
+        printf("Reading %lu windows from '%s'\n", (unsigned long) trainingPack.getCount(), trainingPackFile.c_str());
+    } else if (fromDatabase) {
+        cout << trainingDatabase;
+    } else {
+        // List the positive and negative samples in the background, the extraction starts on the first files found
+        printf("Opening directories %s and %s\n", posSamplesDir.c_str(), negSamplesDir.c_str());
+        positiveWalker.setRoot(posSamplesDir);
+        positiveWalker.start(positiveSamples);
+        negativeWalker.setRoot(negSamplesDir);
+        negativeWalker.start(negativeSamples);
+    }
+
     /// @WARNING: This is really important, some libraries (e.g. ROS) seems to set the system locale which takes decimal commata instead of points which causes the file input parsing to fail
     setlocale(LC_ALL, "C"); // Do not use the system locale
     setlocale(LC_NUMERIC,"C");
     setlocale(LC_ALL, "POSIX");
 
-    printf("Reading files, generating HOG features and save them to file '%s':\n", featuresFile.c_str());
-    float percent;
+    // <editor-fold defaultstate="collapsed" desc="Calculate HOG features and save to file">
+    printf("Reading files and generating HOG features for %s:\n", TRAINHOG_SVM_TO_TRAIN::getInstance()->getSVMName());
 
-    fstream File;
-    File.open(featuresFile.c_str(), ios::out);
-    if (File.good() && File.is_open()) {
-        #if TRAINHOG_USEDSVM == SVMLIGHT
-            File << "# Use this file to train, e.g. SVMlight by issuing $ svm_learn -i 1 -a weights.txt " << featuresFile.c_str() << endl;
-        #endif
-        // Iterate over sample images
-        for (unsigned long currentFile = 0; currentFile < overallSamples; ++currentFile) {
-            storeCursor();
-            vector<float> featureVector;
-            // Get positive or negative sample image file path
-            const string currentImageFile = (currentFile < positiveTrainingImages.size() ? positiveTrainingImages.at(currentFile) : negativeTrainingImages.at(currentFile - positiveTrainingImages.size()));
-            // Output progress
-            if ( (currentFile+1) % 10 == 0 || (currentFile+1) == overallSamples ) {
-                percent = ((currentFile+1) * 100 / overallSamples);
-                //printf("%5lu (%3.0f%%):\tFile '%s'", (currentFile+1), percent, currentImageFile.c_str());
-                fflush(stdout);
-                resetCursor();
+    // Feature rows of the database records, only while the store is the one they were written to
+    FeatureStore storedFeatures;
+    const bool useStoredFeatures = fromDatabase && trainingDatabase.getFeatureGeneration() != 0 && storedFeatures.open(featureStoreFile)
+        && storedFeatures.getGeneration() == trainingDatabase.getFeatureGeneration() && storedFeatures.matches(hog, winStride, trainingPadding)
+        && storedFeatures.getDimension() == hog.getDescriptorSize();
+
+    FeatureStoreWriter store;
+    const bool keepFeatures = writeFeatureStore || exportFeaturesText;
+    if (keepFeatures) {
+        // The feature store is sized up front, so it has to wait for the complete listings
+        size_t capacity = fromPack ? trainingPack.getCount() : fromDatabase ? trainingDatabase.getSize()
+            : positiveSamples.waitForEnd() + negativeSamples.waitForEnd();
+        if (mirrorPositives) {
+            capacity += fromPack ? trainingPack.getPositivesCount() : fromDatabase ? trainingDatabase.getPositivesCount() : positiveSamples.size();
+        }
+        if (!store.open(featureStoreFile, hog, winStride, trainingPadding, capacity)) {
+            printf("Error opening file '%s'!\n", featureStoreFile.c_str());
+            return EXIT_FAILURE;
+        }
+    }
+    vector<uint32_t> sampleOrder;
+    if (fromDatabase && shuffleTrainingSamples) {
+        trainingDatabase.shuffledOrder(sampleOrder, sampleOrderSeed);
+    }
+    // Decode and compute the samples in parallel, the examples are still passed on in sample order
+    FeatureCache* cache = useFeatureCache ? new FeatureCache(featureCacheDir, featureCacheMaxBytes, hog, winStride, trainingPadding) : NULL;
+    ImageDatabaseWriter trainingIndex;
+    TrainingFeatureExtractor* extractor = fromPack ? new TrainingFeatureExtractor(hog, trainingPack, keepFeatures ? &store : NULL)
+        : fromDatabase ? new TrainingFeatureExtractor(hog, trainingDatabase, sampleOrder, useStoredFeatures ? &storedFeatures : NULL, keepFeatures ? &store : NULL, cache, &trainingIndex)
+        : new TrainingFeatureExtractor(hog, positiveSamples, negativeSamples, keepFeatures ? &store : NULL, cache, &trainingIndex);
+    HogMirror mirror;
+    if (mirrorPositives && mirror.init(hog)) {
+        extractor->setMirror(&mirror);
+    }
+    const int64 extractionStart = getTickCount();
+    {
+        PD_TRACE_SCOPE("feature extraction");
+        extractor->runUntilEnd(extractionThreads);
+    }
+    const double extractionSeconds = (getTickCount() - extractionStart) / getTickFrequency();
+    const size_t mirroredSamples = extractor->getMirroredCount();
+    const size_t storedRowsUsed = extractor->getStoredRowsUsed();
+    const vector<int64_t> featureRows = extractor->getFeatureRows();
+    delete extractor;
+    positiveWalker.wait();
+    negativeWalker.wait();
+    const unsigned long overallSamples = fromPack ? trainingPack.getCount() : trainingIndex.getSize();
+    printf("\nExtracted %lu samples in %.2f s (%.1f samples/s)\n", overallSamples, extractionSeconds, overallSamples / extractionSeconds);
+    if (mirroredSamples > 0) {
+        printf("Added %lu mirrored positive samples\n", (unsigned long) mirroredSamples);
+    }
+    if (useStoredFeatures) {
+        printf("Read %lu samples from the stored feature rows\n", (unsigned long) storedRowsUsed);
+    }
+    if (cache) {
+        cache->printStatistics();
+        delete cache; // Writes back the cache index
+    }
+
+    // Make sure there are actually samples to train
+    if (overallSamples == 0) {
+        printf("No training sample files found, nothing to do!\n");
+        return EXIT_SUCCESS;
+    }
+
+    if (keepFeatures) {
+        if (!store.close()) {
+            printf("Error writing file '%s'!\n", featureStoreFile.c_str());
+            return EXIT_FAILURE;
+        }
+        printf("Saved features to '%s'\n", featureStoreFile.c_str());
+    }
+    // Index of the samples in training order with their feature store rows, replaces the database only once it is complete.
+    // A window pack has no image paths to index. A database the samples were read from keeps its record order and only gets
+    // the rows of the rewritten store; a store written from a window pack makes the rows of the database stale by its generation.
+    if (fromDatabase) {
+        if (keepFeatures) {
+            ImageDatabaseWriter refreshed;
+            for (size_t i = 0; i < trainingDatabase.getSize(); ++i) {
+                refreshed.add(trainingDatabase.getLabel(i), trainingDatabase.getPath(i), trainingDatabase.getBoundingBox(i), featureRows[i]);
             }
-            // Calculate feature vector from current image file
-            calculateFeaturesFromInput(currentImageFile, featureVector, hog);
-            if (!featureVector.empty()) {
-
-                File << ((currentFile < positiveTrainingImages.size()) ? "+1" : "-1");
-                // Save feature vector components
-                for (unsigned int feature = 0; feature < featureVector.size(); ++feature) {
-                    File << " " << (feature + 1) << ":" << featureVector.at(feature);
-                }
-                File << endl;
+            refreshed.setFeatureGeneration(store.getGeneration());
+            if (refreshed.save(trainingDatabaseFile)) {
+                printf("Updated the feature rows of '%s'\n", trainingDatabaseFile.c_str());
             }
         }
-        printf("\n");
-        File.flush();
-        File.close();
-    } else {
-        printf("Error opening file '%s'!\n", featuresFile.c_str());
-        return EXIT_FAILURE;
+    } else if (!fromPack) {
+        trainingIndex.setFeatureGeneration(keepFeatures ? store.getGeneration() : 0);
+        if (trainingIndex.save(trainingDatabaseFile)) {
+            printf("Saved training set index to '%s'\n", trainingDatabaseFile.c_str());
+        }
+    }
+
+    if (exportFeaturesText) {
+        printf("Exporting features in SVMlight format to '%s'\n", featuresFile.c_str());
+        #if TRAINHOG_USEDSVM == SVMLIGHT
+            string comment = "Use this file to train, e.g. SVMlight by issuing $ svm_learn -i 1 -a weights.txt " + featuresFile;
+        #else
+            string comment;
+        #endif
+        FeatureStore(featureStoreFile).exportSvmlight(featuresFile, comment);
     }
 
-    /// Read in and train the calculated feature vectors
+    /// Train the calculated feature vectors
     printf("Calling %s\n", TRAINHOG_SVM_TO_TRAIN::getInstance()->getSVMName());
-    TRAINHOG_SVM_TO_TRAIN::getInstance()->read_problem(const_cast<char*> (featuresFile.c_str()));
     TRAINHOG_SVM_TO_TRAIN::getInstance()->train(); // Call the core libsvm training procedure
+
+    // Bootstrap with false positives from the full-size negative images
+    if (miningRounds > 0) {
+        vector<string> negativeMiningImages;
+        getFilesInDirectory(negMiningDir, negativeMiningImages, validExtensions);
+        mineHardNegatives(hog, negativeMiningImages);
+    }
     printf("Training done, saving model file!\n");
-    TRAINHOG_SVM_TO_TRAIN::getInstance()->saveModelToFile(svmModelFile);
+    {
+        PD_TRACE_SCOPE("saveModelToFile");
+        TRAINHOG_SVM_TO_TRAIN::getInstance()->saveModelToFile(svmModelFile);
+    }
 
     // Generating representative single HOG feature
     printf("Generating representative single HOG feature vector using svmlight!\n");
@@ -311,28 +1573,48 @@ int main(int argc, char** argv ){
     vector<unsigned int> descriptorVectorIndices;
     // Generate a single detecting feature vector (v1 | b) from the trained support vectors, for use e.g. with the HOG algorithm
     TRAINHOG_SVM_TO_TRAIN::getInstance()->getSingleDetectingVector(descriptorVector, descriptorVectorIndices);
-    // And save the precious to file system
-    saveDescriptorVectorToFile(descriptorVector, descriptorVectorIndices, descriptorVectorFile);
+    #if TRAINHOG_USEDSVM == SVMLIGHT
+        if (validateDetectorVector && !TRAINHOG_SVM_TO_TRAIN::getInstance()->validateSingleDetectingVector(descriptorVector)) {
+            printf("Warning: Single detecting vector does not match the SVMlight model!\n");
+        }
+    #endif
 
     // Detector detection tolerance threshold
     const double hitThreshold = TRAINHOG_SVM_TO_TRAIN::getInstance()->getThreshold();
+    // And save the precious to file system, the decision value w*x - b is thresholded at 0
+    printf("Saving detector model to file '%s'\n", detectorModelFile.c_str());
+    DetectorModel::save(detectorModelFile, hog, descriptorVector, hitThreshold, 0.f);
+    if (exportLegacyDetectorFiles) {
+        DetectorModel model;
+        if (model.open(detectorModelFile)) {
+            model.exportText(descriptorVectorFile);
+            model.exportYAML(cvHOGFile);
+        }
+    }
+    if (trainSoftCascade) {
+        trainDetectorSoftCascade(keepFeatures);
+    }
     // Set our custom detecting vector
     hog.setSVMDetector(descriptorVector);
-    hog.save(cvHOGFile);
 
     // Test against test set
     getFilesInDirectory(posTestDir, positiveTestImages, validExtensions);
     getFilesInDirectory(negTestDir, negativeTestImages, validExtensions);
-    detectTrainingSetTest(hog, hitThreshold, positiveTestImages, negativeTestImages);
+    evaluateDetector(hog, hitThreshold, positiveTestImages, negativeTestImages, evaluationCurveFile);
 
 
     // Test the model against detection test set.
     getFilesInDirectory(detectTestDir, detectTestImages, validExtensions);
+    // Mask, cascade and quantisation are loaded once for all test images
+    BlockGridDetector detector(hog);
+    if (useBlockGridDetector) {
+        configureDetector(detector);
+    }
 
     cout << hitThreshold << endl;
     for (vector<string>::const_iterator detectTestIterator = detectTestImages.begin(); detectTestIterator != detectTestImages.end(); ++detectTestIterator) {
         Mat testImage = imread(*detectTestIterator);
-        detectTest(hog, 1.6, testImage);
+        detectTest(hog, useBlockGridDetector ? &detector : NULL, 1.6, testImage);
         imshow("HOG custom detection", testImage);
         waitKey(0);
     }
@@ -354,7 +1636,7 @@ int main(int argc, char** argv ){
                 break;
             resize(frame, frame, Size(960, 640), 0, 0, INTER_CUBIC);
             //cvtColor(frame, frame, CV_BGR2GRAY);
-            detectTest(hog, hitThreshold * 2, frame);
+            detectTest(hog, useBlockGridDetector ? &detector : NULL, hitThreshold * 2, frame);
             namedWindow( "Test", 1);
             imshow("Test", frame);
             waitKey(1); // waits to display frame
@@ -11,7 +11,14 @@
 #define	SVMLIGHT_H_INCLUDED
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <vector>
+#include <string>
+#include <algorithm>
+#include <thread>
+#include <cmath>
+#include "../../lib/simd.h"
+#include "../../lib/trace.h"
 
 // svmlight related
 // namespace required for avoiding collisions of declarations (e.g. LINEAR being declared in flann, svmlight and libsvm)
@@ -28,10 +35,13 @@ class SVMlight {
 private:
     DOC** docs; // training examples
     long totwords, totdoc, i; // support vector stuff
+    long capacity; // allocated entries of docs and target
+    bool trained; // model holds the result of a previous train() call
     double* target;
     double* alpha_in;
     KERNEL_CACHE* kernel_cache;
     MODEL* model; // SVM model
+    std::vector<WORD> words; // scratch buffer for building examples
 
     SVMlight() {
         // Init variables
@@ -75,6 +85,22 @@ private:
         totwords = 0;
         i = 0;
         totdoc = 0;
+        capacity = 0;
+        trained = false;
+    }
+
+    // Sums alpha_i * x_i of the support vectors [first, last) into a dense vector, walking only the stored components
+    void accumulateSupportVectors(long first, long last, std::vector<float>* partialSum) const {
+        partialSum->assign(model->totwords, 0.f);
+        float* sum = &(*partialSum)[0];
+        for (long ssv = first; ssv < last; ++ssv) {
+            for (SVECTOR* fvec = model->supvec[ssv]->fvec; fvec; fvec = fvec->next) {
+                const float alpha = (float) (model->alpha[ssv] * fvec->factor);
+                for (const WORD* word = fvec->words; word->wnum; ++word) {
+                    sum[word->wnum - 1] += alpha * word->weight;
+                }
+            }
+        }
     }
 
     virtual ~SVMlight() {
@@ -107,41 +133,148 @@ public:
     // read in a problem (in svmlight format)
     void read_problem(char* filename) {
         // Reads and parses the specified file
+        PD_TRACE_SCOPE("read_documents");
         read_documents(filename, &docs, &target, &totwords, &totdoc);
     }
 
+    /**
+     * Makes room for at least count training examples, avoids reallocations when feeding examples
+     * @param count number of examples expected in total
+     */
+    void reserve_examples(long count) {
+        if (count <= capacity)
+            return;
+        docs = (DOC **) realloc(docs, sizeof (DOC *) * count);
+        target = (double *) realloc(target, sizeof (double) * count);
+        if (!docs || !target) {
+            perror("Error: Not enough memory");
+            exit(1);
+        }
+        capacity = count;
+    }
+
+    /**
+     * Appends a single dense training example, e.g. straight from the feature extraction,
+     * so the training documents are built in memory without a features file round trip
+     * @param label target value (+1 / -1)
+     * @param features feature vector components
+     * @param dimension number of components, all examples must have the same dimension
+     */
+    void add_example(double label, const float* features, long dimension) {
+        if (totdoc == capacity)
+            reserve_examples(capacity > 0 ? 2 * capacity : 1024);
+        // SVMlight expects the component list to be terminated by wnum 0
+        words.resize(dimension + 1);
+        for (long feature = 0; feature < dimension; ++feature) {
+            words[feature].wnum = feature + 1;
+            words[feature].weight = features[feature];
+        }
+        words[dimension].wnum = 0;
+        totwords = std::max(totwords, dimension);
+        target[totdoc] = label;
+        docs[totdoc] = create_example(totdoc, 0, 0, 1.0, create_svector(&words[0], const_cast<char*> (""), 1.0));
+        ++totdoc;
+    }
+
+    inline void add_example(double label, const std::vector<float>& featureVector) {
+        add_example(label, &featureVector[0], featureVector.size());
+    }
+
     // Calls the actual machine learning algorithm
     void train() {
+        if (trained) {
+            // Retraining, e.g. after adding mined examples, starts from a fresh model
+            free_model(model, 0);
+            model = (MODEL *) my_malloc(sizeof (MODEL));
+        }
+        trained = true;
+        PD_TRACE_SCOPE("svm_learn_regression");
         svm_learn_regression(docs, target, totdoc, totwords, learn_parm, kernel_parm, &kernel_cache, model);
     }
 
     /**
      * Generates a single detecting feature vector (vec1) from the trained support vectors, for use e.g. with the HOG algorithm
      * vec1 = sum_1_n (alpha_y*x_i). (vec1 is a 1 x n column vector. n = feature vector length)
+     * Uses the linear weights of the model if present, otherwise a single pass over the sparse support vectors
+     * split across threads, whose partial sums are reduced at the end.
      * @param singleDetectorVector resulting single detector vector for use in openCV HOG
      * @param singleDetectorVectorIndices dummy vector for this implementation
      */
     void getSingleDetectingVector(std::vector<float>& singleDetectorVector, std::vector<unsigned int>& singleDetectorVectorIndices) {
-        // Now we use the trained svm to retrieve the single detector vector
-        DOC** supveclist = model->supvec;
-        printf("Calculating single descriptor vector out of support vectors (may take some time)\n");
-        // Retrieve single detecting vector (v1) from returned ones by calculating vec1 = sum_1_n (alpha_y*x_i). (vec1 is a n x1 column vector. n = feature vector length)
+        PD_TRACE_SCOPE("getSingleDetectingVector");
         singleDetectorVector.clear();
         singleDetectorVector.resize(model->totwords, 0.);
-        printf("Resulting vector size %lu\n", singleDetectorVector.size());
-
-        // Walk over every support vector
-        for (long ssv = 1; ssv < model->sv_num; ++ssv) { // Don't know what's inside model->supvec[0] ?!
-            // Get a single support vector
-            DOC* singleSupportVector = supveclist[ssv]; // Get next support vector
-            SVECTOR* singleSupportVectorValues = singleSupportVector->fvec;
-            WORD singleSupportVectorComponent;
-            // Walk through components of the support vector and populate our detector vector
-            for (unsigned long singleFeature = 0; singleFeature < model->totwords; ++singleFeature) {
-                singleSupportVectorComponent = singleSupportVectorValues->words[singleFeature];
-                singleDetectorVector.at(singleSupportVectorComponent.wnum-1) += (singleSupportVectorComponent.weight * model->alpha[ssv]);
+        if (verbosity >= 1) {
+            printf("Resulting vector size %lu\n", singleDetectorVector.size());
+        }
+        if (kernel_parm->kernel_type != LINEAR) {
+            printf("Warning: Single detector vector is only meaningful for the linear kernel!\n");
+        }
+
+        // Weight vector already maintained for the model, lin_weights is 1-indexed like the feature numbers
+        if (model->lin_weights) {
+            for (long feature = 0; feature < model->totwords; ++feature) {
+                singleDetectorVector[feature] = model->lin_weights[feature + 1];
+            }
+            return;
+        }
+
+        if (verbosity >= 1) {
+            printf("Calculating single descriptor vector out of %ld support vectors\n", model->sv_num - 1);
+        }
+        // supvec[0] is reserved and empty, the support vectors start at 1
+        const long supportVectors = model->sv_num - 1;
+        unsigned int threadCount = std::thread::hardware_concurrency();
+        threadCount = std::max(1u, std::min(threadCount, (unsigned int) (supportVectors / 256 + 1)));
+        std::vector<std::vector<float> > partialSums(threadCount);
+        std::vector<std::thread> threads;
+        for (unsigned int t = 0; t < threadCount; ++t) {
+            const long first = 1 + supportVectors * t / threadCount;
+            const long last = 1 + supportVectors * (t + 1) / threadCount;
+            threads.push_back(std::thread(&SVMlight::accumulateSupportVectors, this, first, last, &partialSums[t]));
+        }
+        for (unsigned int t = 0; t < threadCount; ++t) {
+            threads[t].join();
+            addScaled(&singleDetectorVector[0], &partialSums[t][0], 1.f, model->totwords);
+        }
+    }
+
+    /**
+     * Checks a single detecting vector and the bias against a brute-force recomputation:
+     * the weights against a straight sum over all support vector components in double precision,
+     * and w*x - b against the kernel expansion of SVMlight for some of the support vectors.
+     * @param singleDetectorVector vector returned by getSingleDetectingVector
+     * @param tolerance maximum accepted absolute difference
+     * @return true if both checks pass
+     */
+    bool validateSingleDetectingVector(const std::vector<float>& singleDetectorVector, double tolerance = 1e-4) {
+        std::vector<double> reference(model->totwords, 0.);
+        for (long ssv = 1; ssv < model->sv_num; ++ssv) {
+            for (SVECTOR* fvec = model->supvec[ssv]->fvec; fvec; fvec = fvec->next) {
+                for (WORD* word = fvec->words; word->wnum; ++word) {
+                    reference[word->wnum - 1] += model->alpha[ssv] * fvec->factor * word->weight;
+                }
             }
         }
+        double maxWeightError = 0.;
+        for (long feature = 0; feature < model->totwords; ++feature) {
+            maxWeightError = std::max(maxWeightError, std::fabs(reference[feature] - singleDetectorVector[feature]));
+        }
+
+        // Compare the decision values on up to 16 support vectors, each is O(#SV x dim) for SVMlight
+        double maxDecisionError = 0.;
+        const long step = std::max(1L, (model->sv_num - 1) / 16);
+        for (long ssv = 1; ssv < model->sv_num; ssv += step) {
+            double linear = 0.;
+            for (SVECTOR* fvec = model->supvec[ssv]->fvec; fvec; fvec = fvec->next) {
+                for (WORD* word = fvec->words; word->wnum; ++word) {
+                    linear += fvec->factor * word->weight * singleDetectorVector[word->wnum - 1];
+                }
+            }
+            maxDecisionError = std::max(maxDecisionError, std::fabs(classify_example(model, model->supvec[ssv]) - (linear - model->b)));
+        }
+        printf("Detector vector validation: max weight error %g, max decision value error %g\n", maxWeightError, maxDecisionError);
+        return maxWeightError <= tolerance && maxDecisionError <= tolerance * 10;
     }
 
     /**
@@ -156,6 +289,10 @@ public:
         return "SVMlight";
     }
 
+    long getExampleCount() const {
+        return totdoc;
+    }
+
 };
 
 /// Singleton